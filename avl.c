@@ -1,14 +1,90 @@
 #include <assert.h>
-#include <setjmp.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include "avl.h"
 
 
 typedef unsigned avl_dir_t;
 
 
+#ifdef AVL_STATS
+
+static _Thread_local struct avl_stats  avl_thread_stats;    /* This thread's counters */
+static _Thread_local struct avl_stats *avl_tree_stats;      /* Counters bound by avl_stats_bind */
+
+/** @brief Add @p n to counter @p field of this thread, and of the tree bound to
+ *      it if there is one
+ */
+#define AVL_COUNT(field, n) \
+    (avl_thread_stats.field += (n), \
+     avl_tree_stats ? (void)(avl_tree_stats->field += (n)) : (void)0)
+
+void avl_stats_snapshot(struct avl_stats *stats)
+{
+    *stats = avl_thread_stats;
+}
+
+
+void avl_stats_reset(void)
+{
+    memset(&avl_thread_stats, 0, sizeof avl_thread_stats);
+}
+
+
+struct avl_stats *avl_stats_bind(struct avl_stats *tree)
+{
+    struct avl_stats *prev = avl_tree_stats;
+
+    avl_tree_stats = tree;
+    return prev;
+}
+
+
+void avl_stats_add(struct avl_stats *sum, const struct avl_stats *stats)
+{
+    sum->compares += stats->compares;
+    sum->rotations += stats->rotations;
+    sum->double_rotations += stats->double_rotations;
+    sum->descents += stats->descents;
+    sum->depth += stats->depth;
+    sum->rebalances += stats->rebalances;
+    sum->retraced += stats->retraced;
+    sum->early_exits += stats->early_exits;
+}
+
+#else
+# define AVL_COUNT(field, n) ((void)0)
+#endif /* AVL_STATS */
+
+#ifdef AVL_PREFIX
+
+/** @brief Compare the prefixes of @p n1 and @p n2, calling @p cmpfn only when
+ *      they tie. Only those calls are counted
+ */
+static inline int avl_cmp_prefixed(avl_cmpfn_t *cmpfn, const struct avl *n1, const struct avl *n2)
+{
+    int res = avl_prefix_cmp(n1, n2);
+
+    if (!res) {
+        AVL_COUNT(compares, 1);
+        res = cmpfn(n1, n2);
+    }
+    return res;
+}
+
+# define AVL_CMP(cmpfn, n1, n2) avl_cmp_prefixed((cmpfn), (n1), (n2))
+
+#else
+
+/** @brief Call the comparison function @p cmpfn, counting the call */
+# define AVL_CMP(cmpfn, n1, n2) (AVL_COUNT(compares, 1), (cmpfn)((n1), (n2)))
+
+#endif /* AVL_PREFIX */
+
+
 /** @brief Signed byte max-of-two */
 static signed char avl_max(signed char x, signed char y)
 {
@@ -16,26 +92,82 @@ static signed char avl_max(signed char x, signed char y)
 }
 
 
+/** @brief Set the parent link of @p node, if it is not NULL. This does nothing
+ *      unless the library is built with AVL_PARENT
+ */
+static void avl_set_parent(struct avl *node, struct avl *parent)
+{
+#ifdef AVL_PARENT
+    if (node) {
+        AVL_SET_PARENT_OF(node, parent);
+    }
+#else
+    (void)node;
+    (void)parent;
+#endif
+}
+
+
+#ifdef AVL_SIZE
+
+/** @brief Get the number of nodes in the subtree at @p node, which may be NULL */
+static size_t avl_subtree_size(const struct avl *node)
+{
+    return node ? node->size : 0;
+}
+
+#endif /* AVL_SIZE */
+
+
+/** @brief Recompute the augmented data of @p node from its children
+ *  @param node
+ *      Node whose children have changed
+ *  @param update
+ *      User update function. This may be NULL
+ */
+static void avl_update(struct avl *node, avl_updatefn_t *update)
+{
+#ifdef AVL_SIZE
+    node->size = 1 + avl_subtree_size(AVL_CHILD(node, 0))
+                   + avl_subtree_size(AVL_CHILD(node, 1));
+#endif
+    if (update) {
+        update(node);
+    }
+}
+
+
 /** @brief Rotate @p root in direction @p dir
  *  @param root
- *      Pointer to pointer to root node to rotate
+ *      Root node to rotate
  *  @param dir
  *      Direction to rotate: 0 for a left rotation, 1 for a right
+ *  @param update
+ *      User update function, called on both nodes that change children. This
+ *      may be NULL
+ *  @returns The new subtree root. The caller must link it in place of @p root
  */
-static void avl_rotate(struct avl **root, avl_dir_t dir)
+static struct avl *avl_rotate(struct avl *root, avl_dir_t dir, avl_updatefn_t *update)
 {
-    struct avl *A = *root, *B, *y;
+    struct avl *A = root, *B, *y;
     signed char chg;
 
-    B = A->next[!dir];
-    y = B->next[dir];
-    *root = B;
-    A->next[!dir] = y;
-    B->next[dir] = A;
-    chg = avl_max(dir ? -B->balance : B->balance, 0) + 1;
-    A->balance += dir ? chg : -chg;
-    chg = avl_max(dir ? A->balance : -A->balance, 0) + 1;
-    B->balance += dir ? chg : -chg;
+    B = AVL_CHILD(A, !dir);
+    y = AVL_CHILD(B, dir);
+    AVL_SET_CHILD(A, !dir, y);
+    AVL_SET_CHILD(B, dir, A);
+#ifdef AVL_PARENT
+    AVL_SET_PARENT_OF(B, AVL_PARENT_OF(A));
+#endif
+    avl_set_parent(A, B);
+    avl_set_parent(y, A);
+    chg = avl_max(dir ? -AVL_BALANCE(B) : AVL_BALANCE(B), 0) + 1;
+    AVL_SET_BALANCE(A, AVL_BALANCE(A) + (dir ? chg : -chg));
+    chg = avl_max(dir ? AVL_BALANCE(A) : -AVL_BALANCE(A), 0) + 1;
+    AVL_SET_BALANCE(B, AVL_BALANCE(B) + (dir ? chg : -chg));
+    avl_update(A, update);
+    avl_update(B, update);
+    return B;
 }
 
 
@@ -59,332 +191,2044 @@ static int avl_double_rot(signed char rbal, signed char cbal)
 /** @brief Restructure @p root if needed to restore the AVL property after an
  *      insertion
  *  @param root
- *      Address of the pointer to the root node
+ *      Root node
+ *  @param update
+ *      User update function passed to avl_rotate. This may be NULL
+ *  @returns The new subtree root, which is @p root if nothing was rotated
  */
-static void avl_restructure(struct avl **root)
+static struct avl *avl_restructure(struct avl *root, avl_updatefn_t *update)
 {
-    signed char bal = (*root)->balance, bal2;
+    signed char bal = AVL_BALANCE(root), bal2;
     avl_dir_t inext;
 
     if (bal < -1 || bal > 1) {
         inext = bal < 0 ? 0 : 1;
-        bal2 = (*root)->next[inext]->balance;
+        bal2 = AVL_BALANCE(AVL_CHILD(root, inext));
         if (avl_double_rot(bal, bal2)) {
-            avl_rotate(&(*root)->next[inext], inext);
+            AVL_SET_CHILD(root, inext, avl_rotate(AVL_CHILD(root, inext), inext, update));
+            AVL_COUNT(double_rotations, 1);
+        } else {
+            AVL_COUNT(rotations, 1);
         }
-        avl_rotate(root, !inext);
+        root = avl_rotate(root, !inext, update);
     }
+    return root;
 }
 
 
-struct avl_insctx {
-    jmp_buf      env;
-    volatile int ret;
-};
+/** @brief Replace the node at depth @p depth along @p path
+ *  @param root
+ *      Address of the tree root pointer, which holds the node at depth zero
+ *  @param path
+ *      Recorded path. Only the first @p depth entries are used
+ *  @param depth
+ *      Depth of the node being replaced
+ *  @param node
+ *      Its replacement, which may be NULL
+ */
+static void avl_path_set(struct avl           **root,
+                         const struct avl_path *path,
+                         unsigned               depth,
+                         struct avl            *node)
+{
+    if (depth) {
+        AVL_SET_CHILD(path->node[depth - 1], path->dir[depth - 1], node);
+    } else {
+        *root = node;
+    }
+}
 
 
-/** @brief Attempt to restructure @p node and longjmp if the subtree height
- *      remains unchanged
- *  @param node
- *      Node to try rebalancing
- *  @param ctx
- *      Deletion context
+/** @brief Update the augmented data of every node remaining on @p path, from
+ *      the bottom up, after the subtree at its end has changed. This is a no-op
+ *      when nodes carry no augmented data
  */
-static void avl_insert_commit(struct avl **node, struct avl_insctx *ctx)
+static void avl_path_update(struct avl_path *path)
 {
-    avl_restructure(node);
-    if (!(*node)->balance) {
-        longjmp(ctx->env, 1);
+#ifndef AVL_SIZE
+    if (!path->update) {
+        return;
+    }
+#endif
+    while (path->len) {
+        path->len--;
+        avl_update(path->node[path->len], path->update);
     }
 }
 
 
-/** @brief Recursive insertion
+/** @brief Rebalance the ancestors recorded in @p path after the subtree at its
+ *      end has grown by one level. This stops as soon as a subtree is found
+ *      whose height did not change
  *  @param root
- *      Root node pointer address
- *  @param node
- *      Node to insert
- *  @param cmpfn
- *      Comparison function
- *  @param joinfn
- *      Possibly NULL joining function
- *  @param ctx
- *      Context struct for insertion
- */
-static void avl_insert_thunk(struct avl       **root,
-                             struct avl        *node,
-                             avl_cmpfn_t       *cmpfn,
-                             avl_joinfn_t      *joinfn,
-                             struct avl_insctx *ctx)
-{
-    struct avl **next;
-    int cmp;
+ *      Address of the tree root pointer
+ *  @param path
+ *      Path to the subtree that grew. This is consumed
+ *  @returns Nonzero if the height of the whole tree changed
+ */
+static int avl_fix_grow(struct avl **root, struct avl_path *path)
+{
+    struct avl *node;
+    unsigned i;
 
-    if (!*root) {
-        *root = node;
-        return;
+    AVL_COUNT(rebalances, 1);
+    while (path->len) {
+        i = --path->len;
+        AVL_COUNT(retraced, 1);
+        node = path->node[i];
+        AVL_SET_BALANCE(node, AVL_BALANCE(node) + (path->dir[i] ? 1 : -1));
+        node = avl_restructure(node, path->update);
+        if (node == path->node[i]) {
+            avl_update(node, path->update);
+        }
+        avl_path_set(root, path, i, node);
+        if (!AVL_BALANCE(node)) {
+            AVL_COUNT(early_exits, 1);
+            avl_path_update(path);
+            return 0;
+        }
     }
-    cmp = cmpfn(node, *root);
-    if (!cmp) {
-        if (joinfn) {
-            joinfn(root, node);
+    return 1;
+}
+
+
+/** @brief Rebalance the ancestors recorded in @p path after the subtree at its
+ *      end has shrunk by one level. This stops as soon as a subtree is found
+ *      whose height did not change
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param path
+ *      Path to the subtree that shrank. This is consumed
+ *  @returns Nonzero if the height of the whole tree changed
+ */
+static int avl_fix_shrink(struct avl **root, struct avl_path *path)
+{
+    struct avl *node;
+    unsigned i;
+
+    AVL_COUNT(rebalances, 1);
+    while (path->len) {
+        i = --path->len;
+        AVL_COUNT(retraced, 1);
+        node = path->node[i];
+        AVL_SET_BALANCE(node, AVL_BALANCE(node) + (path->dir[i] ? -1 : 1));
+        node = avl_restructure(node, path->update);
+        if (node == path->node[i]) {
+            avl_update(node, path->update);
+        }
+        avl_path_set(root, path, i, node);
+        if (AVL_BALANCE(node)) {
+            AVL_COUNT(early_exits, 1);
+            avl_path_update(path);
+            return 0;
         }
-        ctx->ret = 1;
-        longjmp(ctx->env, 1);
     }
-    next = &(*root)->next[cmp < 0 ? 0 : 1];
-    avl_insert_thunk(next, node, cmpfn, joinfn, ctx);
-    (*root)->balance += cmp < 0 ? -1 : 1;
-    avl_insert_commit(root, ctx);
+    return 1;
+}
+
+
+/** @brief Link @p join into the tree in place of the node that a join function
+ *      replaced it with. Every link is set explicitly, because a struct copy
+ *      of the old node's links is wrong at the new address under AVL_RELATIVE
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param path
+ *      Path to the parent of the replaced node
+ *  @param join
+ *      The replacement
+ *  @param child
+ *      The children of the replaced node
+ */
+static void avl_replace(struct avl      **root,
+                        struct avl_path  *path,
+                        struct avl       *join,
+                        struct avl *const child[2])
+{
+    avl_path_set(root, path, path->len, join);
+    avl_set_parent(join, path->len ? path->node[path->len - 1] : NULL);
+    AVL_SET_CHILD(join, 0, child[0]);
+    AVL_SET_CHILD(join, 1, child[1]);
+    avl_set_parent(child[0], join);
+    avl_set_parent(child[1], join);
 }
 
 
 int avl_insert(struct avl **root,  struct avl   *node,
                avl_cmpfn_t *cmpfn, avl_joinfn_t *joinfn)
 {
-    struct avl_insctx ctx;
+    return avl_insert_aug(root, node, cmpfn, joinfn, NULL);
+}
+
+
+int avl_insert_aug(struct avl    **root,  struct avl     *node,
+                   avl_cmpfn_t    *cmpfn, avl_joinfn_t   *joinfn,
+                   avl_updatefn_t *update)
+{
+    struct avl_path path;
+    struct avl *cur = *root, *join, *child[2];
+    int cmp;
 
-    ctx.ret = 0;
-    if (!setjmp(ctx.env)) {
-        avl_insert_thunk(root, node, cmpfn, joinfn, &ctx);
+    avl_path_init(&path, update);
+    AVL_COUNT(descents, 1);
+    while (cur) {
+        AVL_COUNT(depth, 1);
+        cmp = AVL_CMP(cmpfn, node, cur);
+        if (!cmp) {
+            if (joinfn) {
+                join = cur;
+                child[0] = AVL_CHILD(cur, 0);
+                child[1] = AVL_CHILD(cur, 1);
+                joinfn(&join, node);
+                if (join != cur) {
+                    /* The join function moved a new node into place */
+                    avl_replace(root, &path, join, child);
+                }
+                /* Joining may have changed the data aggregated above it */
+                if (update) {
+                    update(join);
+                    avl_path_update(&path);
+                }
+            }
+            return 1;
+        }
+        avl_path_push(&path, cur, cmp < 0 ? 0 : 1);
+        cur = AVL_CHILD(cur, cmp < 0 ? 0 : 1);
     }
-    return ctx.ret;
+    avl_insert_at(root, &path, node);
+    return 0;
 }
 
 
-struct avl_delctx {
-    jmp_buf              env;
-    struct avl *volatile res;
-};
+void avl_insert_at(struct avl **root, struct avl_path *path, struct avl *node)
+{
+    avl_path_set(root, path, path->len, node);
+    avl_set_parent(node, path->len ? path->node[path->len - 1] : NULL);
+    avl_update(node, path->update);
+    avl_fix_grow(root, path);
+}
 
 
-/** @brief Attempt to restructure @p node and longjmp if the subtree height
- *      remains unchanged
+/** @brief Remove @p node from the tree and rebalance
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param path
+ *      Path from the root to the parent of @p node. This is consumed
  *  @param node
- *      Node to try rebalancing
- *  @param ctx
- *      Deletion context
+ *      The node to remove. If it has two children, its in-order successor is
+ *      unlinked instead and moved into its place
+ *  @returns Nonzero if the height of the tree decreased
  */
-static void avl_delete_commit(struct avl **node, struct avl_delctx *ctx)
+static int avl_unlink(struct avl **root, struct avl_path *path, struct avl *node)
 {
-    avl_restructure(node);
-    if ((*node)->balance) {
-        longjmp(ctx->env, 1);
+    struct avl *succ, *parent, *child, *up;
+    unsigned depth;
+
+    depth = path->len;
+    parent = depth ? path->node[depth - 1] : NULL;
+    if (!AVL_CHILD(node, 0) || !AVL_CHILD(node, 1)) {
+        child = AVL_CHILD(node, 0) ? AVL_CHILD(node, 0) : AVL_CHILD(node, 1);
+        avl_path_set(root, path, depth, child);
+        avl_set_parent(child, parent);
+    } else {
+        avl_path_push(path, node, 1);
+        up = node;
+        succ = AVL_CHILD(node, 1);
+        while (AVL_CHILD(succ, 0)) {
+            avl_path_push(path, succ, 0);
+            up = succ;
+            succ = AVL_CHILD(succ, 0);
+        }
+        child = AVL_CHILD(succ, 1);
+        avl_path_set(root, path, path->len, child);
+        avl_set_parent(child, up);
+        /* The successor assumes the removed node's position */
+        AVL_SET_CHILD(succ, 0, AVL_CHILD(node, 0));
+        AVL_SET_CHILD(succ, 1, AVL_CHILD(node, 1));
+        AVL_SET_BALANCE(succ, AVL_BALANCE(node));
+        avl_set_parent(succ, parent);
+        avl_set_parent(AVL_CHILD(succ, 0), succ);
+        avl_set_parent(AVL_CHILD(succ, 1), succ);
+        avl_path_set(root, path, depth, succ);
+        path->node[depth] = succ;
     }
+    return avl_fix_shrink(root, path);
 }
 
 
-/** @brief Find the minimum node in the tree at @p root and unlink it
- *  @param root
- *      Subtree root. This may NOT address a NULL pointer!
- *  @param ctx
- *      Deletion context. The unlinked node is placed here on completion, and
- *      the jmp_buf is used to exit when no more rotations are required
+void avl_delete_at(struct avl **root, struct avl_path *path, struct avl *node)
+{
+    avl_unlink(root, path, node);
+}
+
+
+struct avl *avl_delete(struct avl **root,  struct avl  *node,
+                       avl_cmpfn_t *cmpfn, avl_delfn_t *delfn)
+{
+    return avl_delete_aug(root, node, cmpfn, delfn, NULL);
+}
+
+
+struct avl *avl_delete_aug(struct avl    **root,  struct avl   *node,
+                           avl_cmpfn_t    *cmpfn, avl_delfn_t  *delfn,
+                           avl_updatefn_t *update)
+{
+    struct avl_path path;
+    struct avl *res = *root;
+    int cmp;
+
+    avl_path_init(&path, update);
+    AVL_COUNT(descents, 1);
+    while (res) {
+        AVL_COUNT(depth, 1);
+        cmp = AVL_CMP(cmpfn, node, res);
+        if (!cmp) {
+            if (!delfn || delfn(res)) {
+                avl_unlink(root, &path, res);
+            } else if (update) {
+                /* The node stays, but the delete callback may have changed it */
+                update(res);
+                avl_path_update(&path);
+            }
+            break;
+        }
+        avl_path_push(&path, res, cmp < 0 ? 0 : 1);
+        res = AVL_CHILD(res, cmp < 0 ? 0 : 1);
+    }
+    return res;
+}
+
+
+#ifndef AVL_PARENT
+
+/** @brief State of one copy-on-write update. At most one node is replaced per
+ *  level of the path, plus two more per level for rotations during deletion
+ */
+struct avl_cow_op {
+    struct avl_cow *cow;                            /* User hooks */
+    struct avl     *old[3 * AVL_MAX_HEIGHT];        /* Nodes replaced by copies */
+    struct avl     *fresh[3 * AVL_MAX_HEIGHT];      /* Their copies */
+    unsigned        len;                            /* Number of copies */
+};
+
+
+/** @brief Copy @p node, recording both it and the copy
+ *  @returns The copy, whose links lead to the same children, or NULL on
+ *      failure
  */
-static void avl_unlink_min(struct avl **root, struct avl_delctx *ctx)
+static struct avl *avl_cow_clone(struct avl_cow_op *op, struct avl *node)
 {
-    if ((*root)->next[0]) {
-        avl_unlink_min(&(*root)->next[0], ctx);
-        (*root)->balance++;
-        avl_delete_commit(root, ctx);
-    } else {
-        ctx->res = *root;
-        *root = (*root)->next[1];
+    struct avl *copy;
+
+    assert(op->len < 3 * AVL_MAX_HEIGHT);
+    copy = op->cow->copy(op->cow, node);
+    if (!copy) {
+        return NULL;
     }
+    /* Set the links again: a copied link is wrong under AVL_RELATIVE */
+    AVL_SET_CHILD(copy, 0, AVL_CHILD(node, 0));
+    AVL_SET_CHILD(copy, 1, AVL_CHILD(node, 1));
+    op->old[op->len] = node;
+    op->fresh[op->len] = copy;
+    op->len++;
+    return copy;
 }
 
 
-/** @brief Delete @p root by replacing it with a valid replacement node
- *  @param root
- *      Root node to delete
- *  @param ctx
- *      Deletion context
+/** @brief Finish an update, retiring the replaced nodes if it succeeded or
+ *      discarding the copies if it failed
+ *  @returns @p res
  */
-static void avl_delete_replace(struct avl **root, struct avl_delctx *ctx)
+static int avl_cow_finish(struct avl_cow_op *op, int res)
 {
-    struct avl_delctx ctx2;
+    unsigned i;
 
-    if (!(*root)->next[0] || !(*root)->next[1]) {
-        *root = (*root)->next[0] ? (*root)->next[0] : (*root)->next[1];
-    } else {
-        if (!setjmp(ctx2.env)) {
-            avl_unlink_min(&(*root)->next[1], &ctx2);
-            /* Continue unwinding and rebalancing */
-            *ctx2.res = **root;
-            *root = ctx2.res;
-            (*root)->balance--;
-            avl_delete_commit(root, ctx);
+    for (i = 0; i < op->len; i++) {
+        if (res < 0) {
+            op->cow->discard(op->cow, op->fresh[i]);
         } else {
-            /* No further rotations are required, but we still must update the
-            pointers */
-            *ctx2.res = **root;
-            *root = ctx2.res;
-            longjmp(ctx->env, 1);
+            op->cow->retire(op->cow, op->old[i]);
         }
     }
+    return res;
 }
 
 
-/** @brief Search for the node to be deleted
- *  @param root
- *      Root node pointer
- *  @param test
- *      Test node used for comparing to the query node
- *  @param cmpfn
- *      Comparison function
- *  @param ctx
- *      Deletion context
+/** @brief Replace every node recorded in @p path with a copy, from the top
+ *      down, linking each copy to the previous one and the first to @p root
+ *  @returns Zero on success, or -1 if a copy failed
  */
-static void avl_delete_thunk(struct avl       **root,
-                             struct avl        *test,
-                             avl_cmpfn_t       *cmpfn,
-                             avl_delfn_t       *delfn,
-                             struct avl_delctx *ctx)
+static int avl_cow_path(struct avl **root, struct avl_path *path, struct avl_cow_op *op)
 {
-    struct avl **next;
-    int cmp;
+    struct avl *copy;
+    unsigned i;
 
-    if (!*root) {
-        longjmp(ctx->env, 1);
+    for (i = 0; i < path->len; i++) {
+        copy = avl_cow_clone(op, path->node[i]);
+        if (!copy) {
+            return -1;
+        }
+        avl_path_set(root, path, i, copy);
+        path->node[i] = copy;
     }
-    cmp = cmpfn(test, *root);
-    if (!cmp) {
-        ctx->res = *root;
-        if (delfn && !delfn(*root)) {
-            longjmp(ctx->env, 1);
+    return 0;
+}
+
+
+/** @brief avl_fix_shrink on a path of copies. Before a rotation, the nodes it
+ *      moves that are still shared with the old version are copied too: the
+ *      sibling of the shrunken subtree, and its inner child for a double
+ *      rotation
+ *  @returns Zero on success, or -1 if a copy failed
+ */
+static int avl_cow_shrink(struct avl **root, struct avl_path *path, struct avl_cow_op *op)
+{
+    struct avl *node, *heavy, *inner;
+    signed char bal;
+    avl_dir_t dir;
+    unsigned i;
+
+    AVL_COUNT(rebalances, 1);
+    while (path->len) {
+        i = --path->len;
+        AVL_COUNT(retraced, 1);
+        node = path->node[i];
+        bal = AVL_BALANCE(node) + (path->dir[i] ? -1 : 1);
+        AVL_SET_BALANCE(node, bal);
+        if (bal < -1 || bal > 1) {
+            dir = bal < 0 ? 0 : 1;
+            heavy = avl_cow_clone(op, AVL_CHILD(node, dir));
+            if (!heavy) {
+                return -1;
+            }
+            AVL_SET_CHILD(node, dir, heavy);
+            if (avl_double_rot(bal, AVL_BALANCE(heavy))) {
+                inner = avl_cow_clone(op, AVL_CHILD(heavy, !dir));
+                if (!inner) {
+                    return -1;
+                }
+                AVL_SET_CHILD(heavy, !dir, inner);
+            }
+        }
+        node = avl_restructure(node, NULL);
+        if (node == path->node[i]) {
+            avl_update(node, NULL);
+        }
+        avl_path_set(root, path, i, node);
+        if (AVL_BALANCE(node)) {
+            AVL_COUNT(early_exits, 1);
+            avl_path_update(path);
+            return 0;
         }
-        avl_delete_replace(root, ctx);
-    } else {
-        next = &(*root)->next[cmp < 0 ? 0 : 1];
-        avl_delete_thunk(next, test, cmpfn, delfn, ctx);
-        (*root)->balance += cmp < 0 ? 1 : -1;
-        avl_delete_commit(root, ctx);
     }
+    return 0;
 }
 
 
-struct avl *avl_delete(struct avl **root,  struct avl  *node,
-                       avl_cmpfn_t *cmpfn, avl_delfn_t *delfn)
+int avl_insert_cow(struct avl **root,  struct avl     *node,
+                   avl_cmpfn_t *cmpfn, struct avl_cow *cow)
 {
-    struct avl_delctx ctx;
+    struct avl_cow_op op;
+    struct avl_path path;
+    struct avl *cur = *root, *next = *root;
+    int cmp;
 
-    ctx.res = NULL;
-    if (!setjmp(ctx.env)) {
-        avl_delete_thunk(root, node, cmpfn, delfn, &ctx);
+    avl_path_init(&path, NULL);
+    AVL_COUNT(descents, 1);
+    while (cur) {
+        AVL_COUNT(depth, 1);
+        cmp = AVL_CMP(cmpfn, node, cur);
+        if (!cmp) {
+            return 1;
+        }
+        avl_path_push(&path, cur, cmp > 0);
+        cur = AVL_CHILD(cur, cmp > 0);
+    }
+    op.cow = cow;
+    op.len = 0;
+    if (avl_cow_path(&next, &path, &op)) {
+        return avl_cow_finish(&op, -1);
     }
-    return ctx.res;
+    /* Insertion only rotates nodes on the path, which are all copies now */
+    avl_insert_at(&next, &path, node);
+    *root = next;
+    return avl_cow_finish(&op, 0);
 }
 
 
-struct avl *avl_lookup(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn)
+int avl_delete_cow(struct avl    **root,  struct avl     *query,
+                   avl_cmpfn_t    *cmpfn, struct avl_cow *cow,
+                   struct avl    **removed)
 {
+    struct avl_cow_op op;
+    struct avl_path path;
+    struct avl *cur = *root, *next = *root, *succ, *node, *copy;
+    unsigned depth;
     int cmp;
 
-    while (root) {
-        cmp = cmpfn(query, root);
+    avl_path_init(&path, NULL);
+    AVL_COUNT(descents, 1);
+    while (cur) {
+        AVL_COUNT(depth, 1);
+        cmp = AVL_CMP(cmpfn, query, cur);
         if (!cmp) {
             break;
-        } else {
-            root = root->next[cmp < 0 ? 0 : 1];
         }
+        avl_path_push(&path, cur, cmp > 0);
+        cur = AVL_CHILD(cur, cmp > 0);
     }
-    return root;
+    if (!cur) {
+        return 1;
+    }
+    op.cow = cow;
+    op.len = 0;
+    if (avl_cow_path(&next, &path, &op)) {
+        return avl_cow_finish(&op, -1);
+    }
+    depth = path.len;
+    if (!AVL_CHILD(cur, 0) || !AVL_CHILD(cur, 1)) {
+        avl_path_set(&next, &path, depth, AVL_CHILD(cur, AVL_CHILD(cur, 0) == NULL));
+    } else {
+        /* A copy of the successor takes the removed node's position, and the
+        path down to the successor is copied below it */
+        for (succ = AVL_CHILD(cur, 1); AVL_CHILD(succ, 0); succ = AVL_CHILD(succ, 0));
+        copy = avl_cow_clone(&op, succ);
+        if (!copy) {
+            return avl_cow_finish(&op, -1);
+        }
+        AVL_SET_CHILD(copy, 0, AVL_CHILD(cur, 0));
+        AVL_SET_CHILD(copy, 1, AVL_CHILD(cur, 1));
+        AVL_SET_BALANCE(copy, AVL_BALANCE(cur));
+        avl_path_set(&next, &path, depth, copy);
+        avl_path_push(&path, copy, 1);
+        for (node = AVL_CHILD(cur, 1); node != succ; node = AVL_CHILD(node, 0)) {
+            copy = avl_cow_clone(&op, node);
+            if (!copy) {
+                return avl_cow_finish(&op, -1);
+            }
+            avl_path_set(&next, &path, path.len, copy);
+            avl_path_push(&path, copy, 0);
+        }
+        avl_path_set(&next, &path, path.len, AVL_CHILD(succ, 1));
+    }
+    if (avl_cow_shrink(&next, &path, &op)) {
+        return avl_cow_finish(&op, -1);
+    }
+    *root = next;
+    *removed = cur;
+    return avl_cow_finish(&op, 0);
 }
 
+#endif /* AVL_PARENT */
 
-struct avl_iterctx {
-    jmp_buf      env;
-    volatile int ret;
-};
 
+#ifdef AVL_PARENT
 
-/** @brief Invoke the callback, and longjmp if requested
- *  @param node
- *      Tree node to supply to the callback
- *  @param fn
- *      Callback function
- *  @param data
- *      Callback data
- *  @param ctx
- *      Iteration context
+void avl_remove_node(struct avl **root, struct avl *node)
+{
+    avl_remove_node_aug(root, node, NULL);
+}
+
+
+void avl_remove_node_aug(struct avl **root, struct avl *node, avl_updatefn_t *update)
+{
+    struct avl_path path;
+    struct avl *anc;
+    unsigned i;
+
+    avl_path_init(&path, update);
+    for (anc = AVL_PARENT_OF(node); anc; anc = AVL_PARENT_OF(anc)) {
+        path.len++;
+    }
+    assert(path.len <= AVL_MAX_HEIGHT);
+    anc = node;
+    for (i = path.len; i--; ) {
+        path.node[i] = AVL_PARENT_OF(anc);
+        path.dir[i] = AVL_CHILD(path.node[i], 1) == anc;
+        anc = path.node[i];
+    }
+    avl_unlink(root, &path, node);
+}
+
+
+/** @brief Find the in-order neighbor of @p node in direction @p dir using only
+ *      the parent links
  */
-static void avl_foreach_invoke(struct avl         *node,
-                               avl_iterfn_t       *fn,
-                               void               *data,
-                               struct avl_iterctx *ctx)
+static struct avl *avl_adjacent(struct avl *node, avl_dir_t dir)
 {
-    int res;
+    struct avl *parent;
 
-    res = fn(node, data);
-    if (res) {
-        ctx->ret = res;
-        longjmp(ctx->env, 1);
+    if (AVL_CHILD(node, dir)) {
+        node = AVL_CHILD(node, dir);
+        while (AVL_CHILD(node, !dir)) {
+            node = AVL_CHILD(node, !dir);
+        }
+        return node;
+    }
+    for (parent = AVL_PARENT_OF(node); parent && AVL_CHILD(parent, dir) == node; parent = AVL_PARENT_OF(parent)) {
+        node = parent;
     }
+    return parent;
 }
 
 
-/** @brief Iterate in preorder */
-static void avl_foreach_preorder(struct avl         *node,
-                                 avl_iterfn_t       *fn,
-                                 void               *data,
-                                 struct avl_iterctx *ctx)
+struct avl *avl_next(struct avl *node)
 {
-    if (node) {
-        avl_foreach_invoke(node, fn, data, ctx);
-        avl_foreach_preorder(node->next[0], fn, data, ctx);
-        avl_foreach_preorder(node->next[1], fn, data, ctx);
+    return avl_adjacent(node, 1);
+}
+
+
+struct avl *avl_prev(struct avl *node)
+{
+    return avl_adjacent(node, 0);
+}
+
+#endif /* AVL_PARENT */
+
+
+/** @brief Postorder callback applying the update function */
+static int avl_augment_invoke(struct avl *node, void *data)
+{
+    avl_updatefn_t **update = data;
+
+    avl_update(node, *update);
+    return 0;
+}
+
+
+void avl_augment(struct avl *root, avl_updatefn_t *update)
+{
+    avl_foreach(root, AVL_POSTORDER, avl_augment_invoke, &update);
+}
+
+
+/** @brief Make @p left and @p right the children of @p root and set its
+ *      balance from their heights
+ *  @returns The height of the resulting subtree
+ */
+static unsigned avl_build_node(struct avl *root,
+                               struct avl *left,  unsigned hl,
+                               struct avl *right, unsigned hr)
+{
+    AVL_SET_CHILD(root, 0, left);
+    AVL_SET_CHILD(root, 1, right);
+    AVL_SET_BALANCE(root, (int)hr - (int)hl);
+    avl_set_parent(left, root);
+    avl_set_parent(right, root);
+    avl_update(root, NULL);
+    return (hl > hr ? hl : hr) + 1;
+}
+
+
+/** @brief Build a perfectly balanced tree from @p n sorted nodes
+ *  @param nodes
+ *      Node array
+ *  @param n
+ *      Array length
+ *  @param height
+ *      The height of the result is written here
+ *  @returns The root of the subtree
+ */
+static struct avl *avl_build_array(struct avl **nodes, size_t n, unsigned *height)
+{
+    struct avl *left, *right;
+    unsigned hl, hr;
+    size_t mid;
+
+    if (!n) {
+        *height = 0;
+        return NULL;
     }
+    mid = (n - 1) / 2;
+    left = avl_build_array(nodes, mid, &hl);
+    right = avl_build_array(nodes + mid + 1, n - mid - 1, &hr);
+    *height = avl_build_node(nodes[mid], left, hl, right, hr);
+    return nodes[mid];
 }
 
 
-/** @brief Iterate in-order */
-static void avl_foreach_inorder(struct avl         *node,
-                                avl_iterfn_t       *fn,
-                                void               *data,
-                                struct avl_iterctx *ctx)
+/** @brief Build a perfectly balanced tree from the next @p n nodes produced by
+ *      @p nextfn. The shape is identical to that made by avl_build_array
+ */
+static struct avl *avl_build_next(avl_nextfn_t *nextfn,
+                                  void         *data,
+                                  size_t        n,
+                                  unsigned     *height)
 {
-    if (node) {
-        avl_foreach_inorder(node->next[0], fn, data, ctx);
-        avl_foreach_invoke(node, fn, data, ctx);
-        avl_foreach_inorder(node->next[1], fn, data, ctx);
+    struct avl *left, *root, *right;
+    unsigned hl, hr;
+    size_t mid;
+
+    if (!n) {
+        *height = 0;
+        return NULL;
     }
+    mid = (n - 1) / 2;
+    left = avl_build_next(nextfn, data, mid, &hl);
+    root = nextfn(data);
+    right = avl_build_next(nextfn, data, n - mid - 1, &hr);
+    *height = avl_build_node(root, left, hl, right, hr);
+    return root;
 }
 
 
-/** @brief Iterate in postorder */
-static void avl_foreach_postorder(struct avl         *node,
-                                  avl_iterfn_t       *fn,
-                                  void               *data,
-                                  struct avl_iterctx *ctx)
+struct avl *avl_build_sorted(struct avl **nodes, size_t n)
 {
-    if (node) {
-        avl_foreach_postorder(node->next[0], fn, data, ctx);
-        avl_foreach_postorder(node->next[1], fn, data, ctx);
-        avl_foreach_invoke(node, fn, data, ctx);
+    struct avl *root;
+    unsigned height;
+
+    root = avl_build_array(nodes, n, &height);
+    avl_set_parent(root, NULL);
+    return root;
+}
+
+
+struct avl *avl_build_stream(avl_nextfn_t *nextfn, void *data, size_t n)
+{
+    struct avl *root;
+    unsigned height;
+
+    root = avl_build_next(nextfn, data, n, &height);
+    avl_set_parent(root, NULL);
+    return root;
+}
+
+
+/** @brief Get the heights of the children of a node at height @p height */
+static void avl_child_heights(const struct avl *node, unsigned height, unsigned h[2])
+{
+    h[0] = height - 1 - (AVL_BALANCE(node) > 0);
+    h[1] = height - 1 - (AVL_BALANCE(node) < 0);
+}
+
+
+unsigned avl_height(const struct avl *root)
+{
+    unsigned height = 0;
+
+    while (root) {
+        height++;
+        root = AVL_CHILD(root, AVL_BALANCE(root) < 0 ? 0 : 1);
     }
+    return height;
 }
 
 
-int avl_foreach(struct avl   *root,
-                avl_iterdir_t dir,
-                avl_iterfn_t *fn,
-                void         *data)
+/** @brief Join two trees of known heights around @p node
+ *  @param left
+ *      Tree whose nodes all compare less than @p node
+ *  @param hl
+ *      Height of @p left
+ *  @param node
+ *      Middle node, which need not be initialized
+ *  @param right
+ *      Tree whose nodes all compare greater than @p node
+ *  @param hr
+ *      Height of @p right
+ *  @param height
+ *      The height of the joined tree is written here
+ *  @returns The root of the joined tree. Its parent link is not set
+ */
+static struct avl *avl_join_h(struct avl *left,  unsigned hl,
+                              struct avl *node,
+                              struct avl *right, unsigned hr,
+                              unsigned   *height)
 {
-    struct avl_iterctx ctx;
+    struct avl_path path;
+    struct avl *root, *cur;
+    unsigned hcur, hshort;
+    avl_dir_t dir;
 
-    ctx.ret = 0;
-    if (!setjmp(ctx.env)) {
-        switch (dir) {
-        case AVL_PREORDER:
-            avl_foreach_preorder(root, fn, data, &ctx);
-            break;
-        case AVL_INORDER:
-            avl_foreach_inorder(root, fn, data, &ctx);
-            break;
-        case AVL_POSTORDER:
-            avl_foreach_postorder(root, fn, data, &ctx);
-            break;
+    if (hl <= hr + 1 && hr <= hl + 1) {
+        *height = avl_build_node(node, left, hl, right, hr);
+        return node;
+    }
+    /* Walk down the inner spine of the taller tree to the first subtree that is
+    short enough to pair with the other tree */
+    dir = hl > hr;
+    root = cur = dir ? left : right;
+    hcur = dir ? hl : hr;
+    hshort = dir ? hr : hl;
+    avl_path_init(&path, NULL);
+    while (hcur > hshort + 1) {
+        avl_path_push(&path, cur, dir);
+        hcur -= AVL_BALANCE(cur) == (dir ? -1 : 1) ? 2 : 1;
+        cur = AVL_CHILD(cur, dir);
+    }
+    if (dir) {
+        avl_build_node(node, cur, hcur, right, hr);
+    } else {
+        avl_build_node(node, left, hl, cur, hcur);
+    }
+    avl_set_parent(node, path.node[path.len - 1]);
+    avl_path_set(&root, &path, path.len, node);
+    *height = (dir ? hl : hr) + avl_fix_grow(&root, &path);
+    return root;
+}
+
+
+/** @brief Join two trees of known heights without a middle node
+ *  @param left
+ *      Tree whose nodes all compare less than those in @p right
+ *  @param hl
+ *      Height of @p left
+ *  @param right
+ *      The other tree
+ *  @param hr
+ *      Height of @p right
+ *  @param height
+ *      The height of the joined tree is written here
+ *  @returns The root of the joined tree. Its parent link is not set
+ */
+static struct avl *avl_concat_h(struct avl *left,  unsigned hl,
+                                struct avl *right, unsigned hr,
+                                unsigned   *height)
+{
+    struct avl_path path;
+    struct avl *min;
+
+    if (!left || !right) {
+        *height = left ? hl : hr;
+        return left ? left : right;
+    }
+    /* Borrow the least node of the right tree to use as the middle */
+    avl_path_init(&path, NULL);
+    for (min = right; AVL_CHILD(min, 0); min = AVL_CHILD(min, 0)) {
+        avl_path_push(&path, min, 0);
+    }
+    hr -= avl_unlink(&right, &path, min);
+    return avl_join_h(left, hl, min, right, hr, height);
+}
+
+
+/** @brief Split a tree of known height around @p key
+ *  @param root
+ *      Tree to split
+ *  @param height
+ *      Height of @p root
+ *  @param key
+ *      Key to split around
+ *  @param cmpfn
+ *      Comparison function
+ *  @param left
+ *      Tree of nodes comparing less than @p key
+ *  @param hl
+ *      Height of @p left
+ *  @param right
+ *      Tree of nodes comparing greater than @p key
+ *  @param hr
+ *      Height of @p right
+ *  @returns The node comparing equal to @p key, or NULL if there is none. The
+ *      parent links of the results are not set
+ */
+static struct avl *avl_split_h(struct avl  *root,
+                               unsigned     height,
+                               struct avl  *key,
+                               avl_cmpfn_t *cmpfn,
+                               struct avl **left,  unsigned *hl,
+                               struct avl **right, unsigned *hr)
+{
+    unsigned heights[AVL_MAX_HEIGHT], h[2];
+    struct avl_path path;
+    struct avl *node;
+    int cmp = 1;
+
+    avl_path_init(&path, NULL);
+    while (root) {
+        cmp = AVL_CMP(cmpfn, key, root);
+        if (!cmp) {
+            break;
+        }
+        heights[path.len] = height;
+        avl_path_push(&path, root, cmp < 0 ? 0 : 1);
+        height -= AVL_BALANCE(root) == (cmp < 0 ? 1 : -1) ? 2 : 1;
+        root = AVL_CHILD(root, cmp < 0 ? 0 : 1);
+    }
+    if (root) {
+        avl_child_heights(root, height, h);
+        *left = AVL_CHILD(root, 0);
+        *hl = h[0];
+        *right = AVL_CHILD(root, 1);
+        *hr = h[1];
+    } else {
+        *left = *right = NULL;
+        *hl = *hr = 0;
+    }
+    /* Reassemble the pieces hanging off the search path from the bottom up */
+    while (path.len) {
+        path.len--;
+        node = path.node[path.len];
+        avl_child_heights(node, heights[path.len], h);
+        if (path.dir[path.len]) {
+            *left = avl_join_h(AVL_CHILD(node, 0), h[0], node, *left, *hl, hl);
+        } else {
+            *right = avl_join_h(*right, *hr, node, AVL_CHILD(node, 1), h[1], hr);
+        }
+    }
+    return root;
+}
+
+
+struct avl *avl_join(struct avl *left, struct avl *node, struct avl *right)
+{
+    unsigned height;
+
+    node = avl_join_h(left, avl_height(left), node, right, avl_height(right), &height);
+    avl_set_parent(node, NULL);
+    return node;
+}
+
+
+struct avl *avl_concat(struct avl *left, struct avl *right)
+{
+    unsigned height;
+
+    left = avl_concat_h(left, avl_height(left), right, avl_height(right), &height);
+    avl_set_parent(left, NULL);
+    return left;
+}
+
+
+struct avl *avl_split(struct avl  *root,  struct avl  *key, avl_cmpfn_t *cmpfn,
+                      struct avl **left,  struct avl **right)
+{
+    unsigned hl, hr;
+
+    root = avl_split_h(root, avl_height(root), key, cmpfn, left, &hl, right, &hr);
+    avl_set_parent(*left, NULL);
+    avl_set_parent(*right, NULL);
+    return root;
+}
+
+
+struct avl *avl_extract_range(struct avl **root,  struct avl  *lo,
+                              struct avl  *hi,    avl_cmpfn_t *cmpfn)
+{
+    struct avl *left, *mid, *right, *node;
+    unsigned hl, hm, hr;
+
+    node = avl_split_h(*root, avl_height(*root), lo, cmpfn, &left, &hl, &mid, &hm);
+    if (node) {
+        mid = avl_join_h(NULL, 0, node, mid, hm, &hm);
+    }
+    node = avl_split_h(mid, hm, hi, cmpfn, &mid, &hm, &right, &hr);
+    if (node) {
+        right = avl_join_h(NULL, 0, node, right, hr, &hr);
+    }
+    *root = avl_concat_h(left, hl, right, hr, &hl);
+    avl_set_parent(*root, NULL);
+    avl_set_parent(mid, NULL);
+    return mid;
+}
+
+
+/** @brief Context for handing discarded nodes to the user */
+struct avl_dropctx {
+    avl_dropfn_t *fn;
+    void         *data;
+};
+
+
+/** @brief Postorder callback passing each node to the drop function */
+static int avl_drop_invoke(struct avl *node, void *data)
+{
+    struct avl_dropctx *ctx = data;
+
+    ctx->fn(node, ctx->data);
+    return 0;
+}
+
+
+/** @brief Pass a single node to the drop function if there is one */
+static void avl_drop(struct avl *node, struct avl_dropctx *ctx)
+{
+    if (ctx->fn) {
+        ctx->fn(node, ctx->data);
+    }
+}
+
+
+/** @brief Pass every node in @p root to the drop function if there is one */
+static void avl_drop_all(struct avl *root, struct avl_dropctx *ctx)
+{
+    if (ctx->fn) {
+        avl_foreach(root, AVL_POSTORDER, avl_drop_invoke, ctx);
+    }
+}
+
+
+/** @brief Recursive union of trees of known heights
+ *  @param height
+ *      The height of the result is written here
+ *  @returns The root of the union
+ */
+static struct avl *avl_union_h(struct avl   *t1,    unsigned h1,
+                               struct avl   *t2,    unsigned h2,
+                               avl_cmpfn_t  *cmpfn, avl_joinfn_t *joinfn,
+                               unsigned     *height)
+{
+    struct avl *l2, *r2, *dup, *left, *right, *node;
+    unsigned hl2, hr2, hl, hr, h[2];
+
+    if (!t1 || !t2) {
+        *height = t1 ? h1 : h2;
+        return t1 ? t1 : t2;
+    }
+    dup = avl_split_h(t2, h2, t1, cmpfn, &l2, &hl2, &r2, &hr2);
+    avl_child_heights(t1, h1, h);
+    left = avl_union_h(AVL_CHILD(t1, 0), h[0], l2, hl2, cmpfn, joinfn, &hl);
+    right = avl_union_h(AVL_CHILD(t1, 1), h[1], r2, hr2, cmpfn, joinfn, &hr);
+    node = t1;
+    if (dup && joinfn) {
+        joinfn(&node, dup);
+    }
+    return avl_join_h(left, hl, node, right, hr, height);
+}
+
+
+void avl_union(struct avl  **root,  struct avl   *other,
+               avl_cmpfn_t  *cmpfn, avl_joinfn_t *joinfn)
+{
+    unsigned height;
+
+    *root = avl_union_h(*root, avl_height(*root), other, avl_height(other),
+                        cmpfn, joinfn, &height);
+    avl_set_parent(*root, NULL);
+}
+
+
+/** @brief Recursive intersection of trees of known heights
+ *  @param height
+ *      The height of the result is written here
+ *  @returns The root of the intersection
+ */
+static struct avl *avl_intersect_h(struct avl         *t1,    unsigned h1,
+                                   struct avl         *t2,    unsigned h2,
+                                   avl_cmpfn_t        *cmpfn, avl_joinfn_t *joinfn,
+                                   struct avl_dropctx *ctx,   unsigned     *height)
+{
+    struct avl *l2, *r2, *dup, *left, *right, *node;
+    unsigned hl2, hr2, hl, hr, h[2];
+
+    if (!t1 || !t2) {
+        avl_drop_all(t1, ctx);
+        avl_drop_all(t2, ctx);
+        *height = 0;
+        return NULL;
+    }
+    dup = avl_split_h(t2, h2, t1, cmpfn, &l2, &hl2, &r2, &hr2);
+    avl_child_heights(t1, h1, h);
+    left = AVL_CHILD(t1, 0);
+    right = AVL_CHILD(t1, 1);
+    left = avl_intersect_h(left, h[0], l2, hl2, cmpfn, joinfn, ctx, &hl);
+    right = avl_intersect_h(right, h[1], r2, hr2, cmpfn, joinfn, ctx, &hr);
+    if (!dup) {
+        avl_drop(t1, ctx);
+        return avl_concat_h(left, hl, right, hr, height);
+    }
+    node = t1;
+    if (joinfn) {
+        joinfn(&node, dup);
+    } else {
+        avl_drop(dup, ctx);
+    }
+    return avl_join_h(left, hl, node, right, hr, height);
+}
+
+
+void avl_intersect(struct avl  **root,  struct avl   *other,
+                   avl_cmpfn_t  *cmpfn, avl_joinfn_t *joinfn,
+                   avl_dropfn_t *dropfn, void        *data)
+{
+    struct avl_dropctx ctx;
+    unsigned height;
+
+    ctx.fn = dropfn;
+    ctx.data = data;
+    *root = avl_intersect_h(*root, avl_height(*root), other, avl_height(other),
+                            cmpfn, joinfn, &ctx, &height);
+    avl_set_parent(*root, NULL);
+}
+
+
+/** @brief Recursive difference of trees of known heights
+ *  @param height
+ *      The height of the result is written here
+ *  @returns The root of the difference
+ */
+static struct avl *avl_difference_h(struct avl         *t1,    unsigned h1,
+                                    struct avl         *t2,    unsigned h2,
+                                    avl_cmpfn_t        *cmpfn,
+                                    struct avl_dropctx *ctx,   unsigned *height)
+{
+    struct avl *l1, *r1, *dup, *left, *right;
+    unsigned hl1, hr1, hl, hr, h[2];
+
+    if (!t1 || !t2) {
+        avl_drop_all(t2, ctx);
+        *height = h1;
+        return t1;
+    }
+    dup = avl_split_h(t1, h1, t2, cmpfn, &l1, &hl1, &r1, &hr1);
+    avl_child_heights(t2, h2, h);
+    left = AVL_CHILD(t2, 0);
+    right = AVL_CHILD(t2, 1);
+    avl_drop(t2, ctx);
+    if (dup) {
+        avl_drop(dup, ctx);
+    }
+    left = avl_difference_h(l1, hl1, left, h[0], cmpfn, ctx, &hl);
+    right = avl_difference_h(r1, hr1, right, h[1], cmpfn, ctx, &hr);
+    return avl_concat_h(left, hl, right, hr, height);
+}
+
+
+void avl_difference(struct avl  **root,   struct avl *other,
+                    avl_cmpfn_t  *cmpfn,
+                    avl_dropfn_t *dropfn, void       *data)
+{
+    struct avl_dropctx ctx;
+    unsigned height;
+
+    ctx.fn = dropfn;
+    ctx.data = data;
+    *root = avl_difference_h(*root, avl_height(*root), other, avl_height(other),
+                             cmpfn, &ctx, &height);
+    avl_set_parent(*root, NULL);
+}
+
+
+/** @brief Find the first of @p n sorted nodes that does not compare less than
+ *      @p key, by binary search
+ */
+static size_t avl_batch_split(struct avl *const *nodes, size_t n,
+                              struct avl        *key,   avl_cmpfn_t *cmpfn)
+{
+    size_t lo = 0, mid;
+
+    while (n) {
+        mid = lo + n / 2;
+        if (AVL_CMP(cmpfn, nodes[mid], key) < 0) {
+            lo = mid + 1;
+            n -= n / 2 + 1;
+        } else {
+            n /= 2;
+        }
+    }
+    return lo;
+}
+
+
+/** @brief Recursive batch insertion into a tree of known height
+ *  @param count
+ *      Incremented once for each node linked into the tree
+ *  @param height
+ *      The height of the result is written here
+ *  @returns The new root
+ */
+static struct avl *avl_insert_batch_h(struct avl   *root,  unsigned      hroot,
+                                      struct avl  **nodes, size_t        n,
+                                      avl_cmpfn_t  *cmpfn, avl_joinfn_t *joinfn,
+                                      size_t       *count, unsigned     *height)
+{
+    struct avl *left, *right, *node;
+    unsigned hl, hr, h[2];
+    size_t mid, skip;
+
+    if (!n) {
+        *height = hroot;
+        return root;
+    } else if (!root) {
+        *count += n;
+        return avl_build_array(nodes, n, height);
+    }
+    mid = avl_batch_split(nodes, n, root, cmpfn);
+    skip = mid < n && !AVL_CMP(cmpfn, nodes[mid], root);
+    avl_child_heights(root, hroot, h);
+    left = avl_insert_batch_h(AVL_CHILD(root, 0), h[0], nodes, mid,
+                              cmpfn, joinfn, count, &hl);
+    right = avl_insert_batch_h(AVL_CHILD(root, 1), h[1], nodes + mid + skip,
+                               n - mid - skip, cmpfn, joinfn, count, &hr);
+    node = root;
+    if (skip && joinfn) {
+        joinfn(&node, nodes[mid]);
+    }
+    return avl_join_h(left, hl, node, right, hr, height);
+}
+
+
+size_t avl_insert_batch(struct avl  **root,  struct avl  **nodes,
+                        size_t        n,     avl_cmpfn_t  *cmpfn,
+                        avl_joinfn_t *joinfn)
+{
+    unsigned height;
+    size_t count = 0;
+
+    *root = avl_insert_batch_h(*root, avl_height(*root), nodes, n,
+                               cmpfn, joinfn, &count, &height);
+    avl_set_parent(*root, NULL);
+    return count;
+}
+
+
+/** @brief Recursive batch deletion from a tree of known height
+ *  @param out
+ *      Result array, offset to match @p nodes, or NULL
+ *  @param count
+ *      Incremented once for each node unlinked from the tree
+ *  @param height
+ *      The height of the result is written here
+ *  @returns The new root
+ */
+static struct avl *avl_delete_batch_h(struct avl         *root,  unsigned     hroot,
+                                      struct avl *const  *nodes, size_t       n,
+                                      avl_cmpfn_t        *cmpfn, avl_delfn_t *delfn,
+                                      struct avl        **out,   size_t      *count,
+                                      unsigned           *height)
+{
+    struct avl *left, *right;
+    unsigned hl, hr, h[2];
+    size_t mid, skip, i;
+
+    if (!n || !root) {
+        for (i = 0; out && i < n; i++) {
+            out[i] = NULL;
+        }
+        *height = hroot;
+        return root;
+    }
+    mid = avl_batch_split(nodes, n, root, cmpfn);
+    skip = mid < n && !AVL_CMP(cmpfn, nodes[mid], root);
+    avl_child_heights(root, hroot, h);
+    left = avl_delete_batch_h(AVL_CHILD(root, 0), h[0], nodes, mid, cmpfn,
+                              delfn, out, count, &hl);
+    right = avl_delete_batch_h(AVL_CHILD(root, 1), h[1], nodes + mid + skip,
+                               n - mid - skip, cmpfn, delfn,
+                               out ? out + mid + skip : NULL, count, &hr);
+    if (skip) {
+        if (out) {
+            out[mid] = root;
+        }
+        if (!delfn || delfn(root)) {
+            ++*count;
+            return avl_concat_h(left, hl, right, hr, height);
+        }
+    }
+    return avl_join_h(left, hl, root, right, hr, height);
+}
+
+
+size_t avl_delete_batch(struct avl        **root,  struct avl *const *nodes,
+                        size_t              n,     avl_cmpfn_t       *cmpfn,
+                        avl_delfn_t        *delfn, struct avl       **out)
+{
+    unsigned height;
+    size_t count = 0;
+
+    *root = avl_delete_batch_h(*root, avl_height(*root), nodes, n,
+                               cmpfn, delfn, out, &count, &height);
+    avl_set_parent(*root, NULL);
+    return count;
+}
+
+
+#ifdef AVL_SIZE
+
+size_t avl_size(const struct avl *root)
+{
+    return avl_subtree_size(root);
+}
+
+
+size_t avl_rank(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn)
+{
+    size_t rank = 0;
+    int cmp;
+
+    while (root) {
+        cmp = AVL_CMP(cmpfn, query, root);
+        if (cmp > 0) {
+            rank += avl_subtree_size(AVL_CHILD(root, 0)) + 1;
+            root = AVL_CHILD(root, 1);
+        } else if (cmp < 0) {
+            root = AVL_CHILD(root, 0);
+        } else {
+            return rank + avl_subtree_size(AVL_CHILD(root, 0));
+        }
+    }
+    return rank;
+}
+
+
+struct avl *avl_select(struct avl *root, size_t index)
+{
+    size_t lsize;
+
+    while (root) {
+        lsize = avl_subtree_size(AVL_CHILD(root, 0));
+        if (index < lsize) {
+            root = AVL_CHILD(root, 0);
+        } else if (index > lsize) {
+            index -= lsize + 1;
+            root = AVL_CHILD(root, 1);
+        } else {
+            break;
+        }
+    }
+    return root;
+}
+
+
+size_t avl_count_range(struct avl  *root, struct avl *lo,
+                       struct avl  *hi,   avl_cmpfn_t *cmpfn)
+{
+    size_t rlo, rhi;
+
+    rlo = avl_rank(root, lo, cmpfn);
+    rhi = avl_rank(root, hi, cmpfn);
+    return rhi > rlo ? rhi - rlo : 0;
+}
+
+#endif /* AVL_SIZE */
+
+
+struct avl *avl_lookup(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn)
+{
+    int cmp;
+
+    AVL_COUNT(descents, 1);
+    while (root) {
+        AVL_COUNT(depth, 1);
+        cmp = AVL_CMP(cmpfn, query, root);
+        if (!cmp) {
+            break;
+        } else {
+            root = AVL_CHILD(root, cmp < 0 ? 0 : 1);
+        }
+    }
+    return root;
+}
+
+
+#ifndef AVL_BATCH_WIDTH
+/** @brief Number of searches avl_lookup_batch keeps in flight. This should be
+ *      about the number of outstanding cache misses the core can track
+ */
+# define AVL_BATCH_WIDTH 16
+#endif
+
+#if defined(__GNUC__)
+# define AVL_PREFETCH(addr) __builtin_prefetch((addr), 0, 3)
+#else
+# define AVL_PREFETCH(addr) ((void)(addr))
+#endif
+
+
+void avl_lookup_batch(struct avl  *root,  struct avl *const *queries,
+                      size_t       n,     avl_cmpfn_t       *cmpfn,
+                      struct avl **out)
+{
+    struct avl *node[AVL_BATCH_WIDTH];
+    size_t slot[AVL_BATCH_WIDTH];
+    size_t next = 0;
+    unsigned i, live = 0;
+    int cmp;
+
+    if (!root) {
+        while (n--) {
+            out[n] = NULL;
+        }
+        return;
+    }
+    AVL_COUNT(descents, n);
+    while (live < AVL_BATCH_WIDTH && next < n) {
+        node[live] = root;
+        slot[live++] = next++;
+    }
+    /* Each pass takes one step in every live search. By the time a search is
+    revisited its prefetched child has had a whole pass to arrive */
+    while (live) {
+        for (i = 0; i < live; ) {
+            AVL_COUNT(depth, 1);
+            cmp = AVL_CMP(cmpfn, queries[slot[i]], node[i]);
+            if (cmp) {
+                node[i] = AVL_CHILD(node[i], cmp < 0 ? 0 : 1);
+                if (node[i]) {
+                    AVL_PREFETCH(node[i]);
+                    i++;
+                    continue;
+                }
+            }
+            out[slot[i]] = node[i];
+            if (next < n) {
+                node[i] = root;
+                slot[i] = next++;
+                i++;
+            } else {
+                /* Fill the hole with the last live search */
+                live--;
+                node[i] = node[live];
+                slot[i] = slot[live];
+            }
+        }
+    }
+}
+
+
+/** @brief Find the nearest node to @p query on one side of it
+ *  @param root
+ *      Tree root
+ *  @param query
+ *      Test node
+ *  @param cmpfn
+ *      Comparison function
+ *  @param dir
+ *      1 for the least node greater than @p query, 0 for the greatest node less
+ *      than it
+ *  @param inclusive
+ *      Nonzero if a node comparing equal to @p query is an acceptable answer
+ *  @returns The node found, or NULL if there is none
+ */
+static struct avl *avl_bound(struct avl  *root,  struct avl *query,
+                             avl_cmpfn_t *cmpfn, avl_dir_t   dir,
+                             int          inclusive)
+{
+    struct avl *best = NULL;
+    int cmp;
+
+    while (root) {
+        cmp = AVL_CMP(cmpfn, query, root);
+        if (!cmp && inclusive) {
+            return root;
+        } else if (dir ? cmp < 0 : cmp > 0) {
+            best = root;
+            root = AVL_CHILD(root, !dir);
+        } else {
+            root = AVL_CHILD(root, dir);
+        }
+    }
+    return best;
+}
+
+
+struct avl *avl_lower_bound(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn)
+{
+    return avl_bound(root, query, cmpfn, 1, 1);
+}
+
+
+struct avl *avl_upper_bound(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn)
+{
+    return avl_bound(root, query, cmpfn, 1, 0);
+}
+
+
+struct avl *avl_floor(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn)
+{
+    return avl_bound(root, query, cmpfn, 0, 1);
+}
+
+
+struct avl *avl_ceil(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn)
+{
+    return avl_bound(root, query, cmpfn, 1, 1);
+}
+
+
+struct avl *avl_cursor_get(const struct avl_cursor *cur)
+{
+    return cur->depth ? cur->stack[cur->depth - 1] : NULL;
+}
+
+
+/** @brief Push @p node onto the cursor stack */
+static void avl_cursor_push(struct avl_cursor *cur, struct avl *node)
+{
+    assert(cur->depth < AVL_MAX_HEIGHT);
+    cur->stack[cur->depth++] = node;
+}
+
+
+/** @brief Descend from @p node as far as possible in direction @p dir,
+ *      recording the path in @p cur
+ *  @returns The last node reached
+ */
+static struct avl *avl_cursor_extreme(struct avl_cursor *cur,
+                                      struct avl        *node,
+                                      avl_dir_t          dir)
+{
+    while (node) {
+        avl_cursor_push(cur, node);
+        node = AVL_CHILD(node, dir);
+    }
+    return avl_cursor_get(cur);
+}
+
+
+/** @brief Step the cursor to the adjacent node in direction @p dir: 1 for the
+ *      successor, 0 for the predecessor
+ */
+static struct avl *avl_cursor_step(struct avl_cursor *cur, avl_dir_t dir)
+{
+    struct avl *node;
+
+    if (!cur->depth) {
+        return NULL;
+    }
+    node = cur->stack[cur->depth - 1];
+    if (AVL_CHILD(node, dir)) {
+        return avl_cursor_extreme(cur, AVL_CHILD(node, dir), !dir);
+    }
+    /* Climb until we leave a subtree from its @p !dir side */
+    do {
+        node = cur->stack[--cur->depth];
+    } while (cur->depth && AVL_CHILD(cur->stack[cur->depth - 1], dir) == node);
+    return avl_cursor_get(cur);
+}
+
+
+struct avl *avl_cursor_first(struct avl_cursor *cur, struct avl *root)
+{
+    cur->depth = 0;
+    return avl_cursor_extreme(cur, root, 0);
+}
+
+
+struct avl *avl_cursor_last(struct avl_cursor *cur, struct avl *root)
+{
+    cur->depth = 0;
+    return avl_cursor_extreme(cur, root, 1);
+}
+
+
+struct avl *avl_cursor_next(struct avl_cursor *cur)
+{
+    return avl_cursor_step(cur, 1);
+}
+
+
+struct avl *avl_cursor_prev(struct avl_cursor *cur)
+{
+    return avl_cursor_step(cur, 0);
+}
+
+
+struct avl *avl_cursor_seek(struct avl_cursor *cur,   struct avl  *root,
+                            struct avl        *query, avl_cmpfn_t *cmpfn)
+{
+    unsigned keep = 0;
+    int cmp;
+
+    cur->depth = 0;
+    while (root) {
+        avl_cursor_push(cur, root);
+        cmp = AVL_CMP(cmpfn, query, root);
+        if (!cmp) {
+            keep = cur->depth;
+            break;
+        } else if (cmp < 0) {
+            keep = cur->depth;
+            root = AVL_CHILD(root, 0);
+        } else {
+            root = AVL_CHILD(root, 1);
+        }
+    }
+    /* The deepest node we went left from is the least node above @p query */
+    cur->depth = keep;
+    return avl_cursor_get(cur);
+}
+
+
+/** @brief Move @p cur from its current node toward @p query: climb only as far
+ *      as the nearest ancestor bounding the subtree that contains @p query,
+ *      then descend from there. This costs O(1) comparisons when @p query is
+ *      adjacent to the current node
+ *  @param cur
+ *      Cursor positioned on a node
+ *  @param query
+ *      Test node
+ *  @param cmpfn
+ *      Comparison function
+ *  @returns Zero if the cursor ended on a node equal to @p query. Otherwise the
+ *      cursor is on the node whose empty child slot @p query belongs in, and
+ *      the result is the sign of the comparison with that node
+ */
+static int avl_finger(struct avl_cursor *cur, struct avl *query, avl_cmpfn_t *cmpfn)
+{
+    struct avl *node;
+    avl_dir_t dir;
+    unsigned i, j;
+    int cmp, bound;
+
+    i = cur->depth - 1;
+    cmp = AVL_CMP(cmpfn, query, cur->stack[i]);
+    while (cmp) {
+        /* The subtree at i is bounded on side @p dir by the nearest ancestor
+        that the path passes on its @p !dir side */
+        dir = cmp > 0;
+        for (j = i; j && AVL_CHILD(cur->stack[j - 1], !dir) != cur->stack[j]; j--);
+        if (!j) {
+            break;
+        }
+        bound = AVL_CMP(cmpfn, query, cur->stack[j - 1]);
+        if (dir ? bound < 0 : bound > 0) {
+            break;
+        }
+        i = j - 1;
+        cmp = bound;
+    }
+    cur->depth = i + 1;
+    while (cmp) {
+        node = AVL_CHILD(cur->stack[cur->depth - 1], cmp > 0);
+        if (!node) {
+            break;
+        }
+        avl_cursor_push(cur, node);
+        cmp = AVL_CMP(cmpfn, query, node);
+    }
+    return cmp;
+}
+
+
+struct avl *avl_cursor_finger(struct avl_cursor *cur,   struct avl  *root,
+                              struct avl        *query, avl_cmpfn_t *cmpfn)
+{
+    int cmp;
+
+    if (!cur->depth) {
+        return avl_cursor_seek(cur, root, query, cmpfn);
+    }
+    cmp = avl_finger(cur, query, cmpfn);
+    return cmp > 0 ? avl_cursor_next(cur) : avl_cursor_get(cur);
+}
+
+
+/** @brief Point @p cur at @p node after it was linked at the end of @p path and
+ *      the tree was rebalanced. No comparisons are needed: the ancestors of
+ *      @p node after rebalancing are a subset of those on @p path, and the
+ *      directions recorded there still lead toward @p node
+ *  @param root
+ *      Tree root
+ *  @param cur
+ *      Cursor to reposition
+ *  @param path
+ *      The path @p node was inserted at. Its entries are still intact, though
+ *      rebalancing has consumed its length
+ *  @param len
+ *      The original length of @p path
+ *  @param node
+ *      The inserted node
+ */
+static void avl_cursor_repair(struct avl        *root,
+                              struct avl_cursor *cur,
+                              struct avl_path   *path,
+                              unsigned           len,
+                              struct avl        *node)
+{
+    struct avl *at = root;
+    unsigned i = 0, j;
+
+    /* Keep the prefix of the path above any rotation */
+    while (i < len && at == path->node[i]) {
+        at = AVL_CHILD(at, path->dir[i]);
+        i++;
+    }
+    cur->depth = i;
+    j = i;
+    while (at != node) {
+        avl_cursor_push(cur, at);
+        if (j >= len || path->node[j] != at) {
+            for (j = i; path->node[j] != at; j++);
+        }
+        at = AVL_CHILD(at, path->dir[j]);
+        j++;
+    }
+    avl_cursor_push(cur, node);
+}
+
+
+int avl_insert_hint(struct avl  **root,  struct avl_cursor *hint,
+                    struct avl   *node,  avl_cmpfn_t       *cmpfn,
+                    avl_joinfn_t *joinfn)
+{
+    struct avl_path path;
+    struct avl *cur, *join, *child[2];
+    unsigned i, len;
+    int cmp;
+
+    if (!*root) {
+        *root = node;
+        avl_set_parent(node, NULL);
+        avl_update(node, NULL);
+        hint->depth = 0;
+        avl_cursor_push(hint, node);
+        return 0;
+    }
+    if (!hint->depth) {
+        avl_cursor_last(hint, *root);
+    }
+    cmp = avl_finger(hint, node, cmpfn);
+    avl_path_init(&path, NULL);
+    for (i = 0; i + 1 < hint->depth; i++) {
+        avl_path_push(&path, hint->stack[i],
+                      AVL_CHILD(hint->stack[i], 1) == hint->stack[i + 1]);
+    }
+    cur = hint->stack[hint->depth - 1];
+    if (!cmp) {
+        if (joinfn) {
+            join = cur;
+            child[0] = AVL_CHILD(cur, 0);
+            child[1] = AVL_CHILD(cur, 1);
+            joinfn(&join, node);
+            if (join != cur) {
+                /* The join function moved a new node into place */
+                avl_replace(root, &path, join, child);
+                hint->stack[hint->depth - 1] = join;
+            }
+        }
+        return 1;
+    }
+    avl_path_push(&path, cur, cmp > 0);
+    len = path.len;
+    avl_insert_at(root, &path, node);
+    avl_cursor_repair(*root, hint, &path, len, node);
+    return 0;
+}
+
+
+int avl_range_foreach(struct avl   *root, struct avl  *lo,
+                      struct avl   *hi,   avl_cmpfn_t *cmpfn,
+                      avl_iterfn_t *fn,   void        *data)
+{
+    struct avl_cursor cur;
+    struct avl *node;
+    int res;
+
+    node = lo ? avl_cursor_seek(&cur, root, lo, cmpfn) : avl_cursor_first(&cur, root);
+    for (; node && (!hi || AVL_CMP(cmpfn, hi, node) > 0); node = avl_cursor_next(&cur)) {
+        res = fn(node, data);
+        if (res) {
+            return res;
+        }
+    }
+    return 0;
+}
+
+
+/** @brief State of an iterative traversal. The stack holds the nodes yet to be
+ *      visited, or whose subtrees are partly visited, so it needs one entry
+ *      more than the height at most
+ */
+struct avl_walk {
+    struct avl   *stack[AVL_MAX_HEIGHT + 1];
+    unsigned      depth;    /* Stack depth */
+    struct avl   *node;     /* In order, the subtree to descend into next */
+    avl_iterdir_t dir;      /* Traversal order */
+};
+
+
+/** @brief Push the path from @p node to the first node of its subtree in
+ *      postorder
+ */
+static void avl_walk_postorder_descend(struct avl_walk *walk, struct avl *node)
+{
+    while (node) {
+        walk->stack[walk->depth++] = node;
+        if (AVL_CHILD(node, 0)) {
+            /* The right subtree comes next after the left one */
+            if (AVL_CHILD(node, 1)) {
+                AVL_PREFETCH(AVL_CHILD(node, 1));
+            }
+            node = AVL_CHILD(node, 0);
+        } else {
+            node = AVL_CHILD(node, 1);
+        }
+    }
+}
+
+
+static void avl_walk_init(struct avl_walk *walk, struct avl *root, avl_iterdir_t dir)
+{
+    walk->depth = 0;
+    walk->node = NULL;
+    walk->dir = dir;
+    switch (dir) {
+    case AVL_PREORDER:
+        if (root) {
+            walk->stack[walk->depth++] = root;
+        }
+        break;
+    case AVL_INORDER:
+        walk->node = root;
+        break;
+    case AVL_POSTORDER:
+        avl_walk_postorder_descend(walk, root);
+        break;
+    }
+}
+
+
+/** @brief Collect the next nodes of a traversal
+ *  @param walk
+ *      Traversal state
+ *  @param out
+ *      Receives up to AVL_VISIT_BATCH nodes. Everything the traversal needs
+ *      from them is read before they are returned, so they may be freed by the
+ *      caller, as long as the ones not yet returned stay in place
+ *  @returns The number of nodes collected, zero once the traversal is done
+ */
+static size_t avl_walk_fill(struct avl_walk *walk, struct avl **out)
+{
+    struct avl *node, *parent;
+    size_t n = 0;
+
+    switch (walk->dir) {
+    case AVL_PREORDER:
+        while (n < AVL_VISIT_BATCH && walk->depth) {
+            node = walk->stack[--walk->depth];
+            /* The right child is visited after the whole left subtree */
+            if (AVL_CHILD(node, 1)) {
+                AVL_PREFETCH(AVL_CHILD(node, 1));
+                walk->stack[walk->depth++] = AVL_CHILD(node, 1);
+            }
+            if (AVL_CHILD(node, 0)) {
+                walk->stack[walk->depth++] = AVL_CHILD(node, 0);
+            }
+            out[n++] = node;
+        }
+        break;
+    case AVL_INORDER:
+        node = walk->node;
+        while (n < AVL_VISIT_BATCH) {
+            /* Each right subtree is entered once the left one is done, so its
+            root is fetched while that happens */
+            while (node) {
+                walk->stack[walk->depth++] = node;
+                if (AVL_CHILD(node, 1)) {
+                    AVL_PREFETCH(AVL_CHILD(node, 1));
+                }
+                node = AVL_CHILD(node, 0);
+            }
+            if (!walk->depth) {
+                break;
+            }
+            node = walk->stack[--walk->depth];
+            out[n++] = node;
+            node = AVL_CHILD(node, 1);
+        }
+        walk->node = node;
+        break;
+    case AVL_POSTORDER:
+        while (n < AVL_VISIT_BATCH && walk->depth) {
+            node = walk->stack[--walk->depth];
+            out[n++] = node;
+            parent = walk->depth ? walk->stack[walk->depth - 1] : NULL;
+            if (parent && AVL_CHILD(parent, 0) == node && AVL_CHILD(parent, 1)) {
+                avl_walk_postorder_descend(walk, AVL_CHILD(parent, 1));
+            }
+        }
+        break;
+    }
+    return n;
+}
+
+
+int avl_foreach(struct avl   *root,
+                avl_iterdir_t dir,
+                avl_iterfn_t *fn,
+                void         *data)
+{
+    struct avl *batch[AVL_VISIT_BATCH];
+    struct avl_walk walk;
+    size_t i, n;
+    int res;
+
+    /* The pointer chasing of each batch happens before any of its callbacks run,
+    so they find their nodes in cache */
+    avl_walk_init(&walk, root, dir);
+    while ((n = avl_walk_fill(&walk, batch))) {
+        for (i = 0; i < n; i++) {
+            res = fn(batch[i], data);
+            if (res) {
+                return res;
+            }
+        }
+    }
+    return 0;
+}
+
+
+int avl_foreach_batch(struct avl    *root,
+                      avl_iterdir_t  dir,
+                      avl_batchfn_t *fn,
+                      void          *data)
+{
+    struct avl *batch[AVL_VISIT_BATCH];
+    struct avl_walk walk;
+    size_t n;
+    int res;
+
+    avl_walk_init(&walk, root, dir);
+    while ((n = avl_walk_fill(&walk, batch))) {
+        res = fn(batch, n, data);
+        if (res) {
+            return res;
+        }
+    }
+    return 0;
+}
+
+
+/** @brief Produce the next node of a list chained through the right links, for
+ *      avl_build_stream. The link is read before the build overwrites it
+ *  @param data
+ *      Address of the list head, which is advanced
+ */
+static struct avl *avl_chain_next(void *data)
+{
+    struct avl **head = data, *node = *head;
+
+    *head = AVL_CHILD(node, 1);
+    return node;
+}
+
+
+size_t avl_delete_if(struct avl  **root,   avl_predfn_t *pred,
+                     avl_dropfn_t *dropfn, void         *data)
+{
+    struct avl *batch[AVL_VISIT_BATCH], *head = NULL, *tail = NULL;
+    struct avl_walk walk;
+    size_t i, n, kept = 0, removed = 0;
+
+    /* The walk is done with every node it returns, so the survivors can be
+    chained together through their right links as they come */
+    avl_walk_init(&walk, *root, AVL_INORDER);
+    while ((n = avl_walk_fill(&walk, batch))) {
+        for (i = 0; i < n; i++) {
+            if (pred(batch[i], data)) {
+                removed++;
+                if (dropfn) {
+                    dropfn(batch[i], data);
+                }
+            } else {
+                if (tail) {
+                    AVL_SET_CHILD(tail, 1, batch[i]);
+                } else {
+                    head = batch[i];
+                }
+                tail = batch[i];
+                kept++;
+            }
+        }
+    }
+    *root = avl_build_stream(avl_chain_next, &head, kept);
+    return removed;
+}
+
+
+/** @brief A node on the explicit stack of avl_analyze */
+struct avl_analyze_frame {
+    struct avl *node;       /* The node */
+    size_t      before;     /* Nodes counted before it was reached */
+    unsigned    hl;         /* Height of its left subtree, once known */
+    unsigned    state;      /* 0 on arrival, 1 after the left subtree, 2 after the right */
+};
+
+
+/** @brief Record the first violation found by avl_analyze */
+static void avl_shape_fail(struct avl_shape *shape, avl_shape_err_t error, struct avl *node)
+{
+    if (shape->error == AVL_SHAPE_OK) {
+        shape->error = error;
+        shape->bad = node;
+    }
+}
+
+
+avl_shape_err_t avl_analyze(struct avl       *root,
+                            avl_cmpfn_t      *cmpfn,
+                            struct avl_shape *shape)
+{
+    struct avl_analyze_frame stack[AVL_MAX_HEIGHT], *f;
+    struct avl *node, *child, *prev = NULL;
+    unsigned sp = 0, ret = 0, hr;
+    unsigned long long depths = 0;
+    int bal;
+
+    memset(shape, 0, sizeof *shape);
+    if (root) {
+        stack[sp].node = root;
+        stack[sp++].state = 0;
+#ifdef AVL_PARENT
+        if (AVL_PARENT_OF(root)) {
+            avl_shape_fail(shape, AVL_SHAPE_PARENT, root);
+        }
+#endif
+    }
+    /* A postorder walk. Each node reports its measured height in @p ret as it
+    is popped, and the in-order check happens between its two subtrees */
+    while (sp) {
+        f = &stack[sp - 1];
+        node = f->node;
+        child = NULL;
+        if (f->state == 0) {
+            f->before = shape->nodes++;
+            depths += sp;
+            if (sp > shape->max_depth) {
+                shape->max_depth = sp;
+            }
+            bal = AVL_BALANCE(node);
+            if (bal >= -1 && bal <= 1) {
+                shape->balance[bal + 1]++;
+            }
+            if (AVL_CHILD(node, 1)) {
+                AVL_PREFETCH(AVL_CHILD(node, 1));
+            }
+            f->state = 1;
+            child = AVL_CHILD(node, 0);
+            ret = 0;
+        } else if (f->state == 1) {
+            f->hl = ret;
+            if (cmpfn && prev && AVL_CMP(cmpfn, prev, node) >= 0) {
+                avl_shape_fail(shape, AVL_SHAPE_ORDER, node);
+            }
+            prev = node;
+            f->state = 2;
+            child = AVL_CHILD(node, 1);
+            ret = 0;
+        } else {
+            hr = ret;
+            if ((int)hr - (int)f->hl != AVL_BALANCE(node)) {
+                avl_shape_fail(shape, AVL_SHAPE_BALANCE, node);
+            }
+            if (hr > f->hl + 1 || f->hl > hr + 1) {
+                avl_shape_fail(shape, AVL_SHAPE_UNBALANCED, node);
+            }
+#ifdef AVL_SIZE
+            if (node->size != shape->nodes - f->before) {
+                avl_shape_fail(shape, AVL_SHAPE_SIZE, node);
+            }
+#endif
+            ret = 1 + (hr > f->hl ? hr : f->hl);
+            sp--;
+            continue;
+        }
+        if (child) {
+            if (sp == AVL_MAX_HEIGHT) {
+                /* This overrides any earlier violation, as the counts are cut short */
+                shape->error = AVL_SHAPE_DEPTH;
+                shape->bad = child;
+                return shape->error;
+            }
+#ifdef AVL_PARENT
+            if (AVL_PARENT_OF(child) != node) {
+                avl_shape_fail(shape, AVL_SHAPE_PARENT, child);
+            }
+#endif
+            stack[sp].node = child;
+            stack[sp++].state = 0;
         }
     }
-    return ctx.ret;
+    shape->height = ret;
+    shape->avg_depth = shape->nodes ? (double)depths / shape->nodes : 0.0;
+    return shape->error;
 }
@@ -3,14 +3,207 @@
 #ifndef AVL_H
 #define AVL_H
 
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
 
-/** @brief A generic AVL tree node */
+
+#if defined(AVL_COMPACT) || defined(AVL_RELATIVE) || defined(AVL_PREFIX)
+# include <stdint.h>
+#endif
+
+
+/** @brief A generic AVL tree node
+ *  @note Defining AVL_PARENT when building the library (and everything that
+ *      includes this header) adds a parent link to each node. This enables
+ *      avl_remove_node, avl_next and avl_prev, none of which need the
+ *      comparison function
+ *  @note Defining AVL_SIZE keeps the size of every subtree in its root, which
+ *      enables the O(log n) order statistics avl_rank, avl_select and
+ *      avl_count_range
+ *  @note Defining AVL_COMPACT stores the balance in the low bits of the child
+ *      links, which shrinks the node to two words. The links can then only be
+ *      accessed through the AVL_CHILD and AVL_BALANCE family of macros, which
+ *      work in either layout
+ *  @note Defining AVL_RELATIVE stores every link as the distance from the link
+ *      itself to its target instead of as an address. A tree whose nodes all
+ *      live in one block of memory is then position independent: the block can
+ *      be copied, written to a file or mapped at any address, and used as is
+ *      (see avl_image.h). This combines with all of the options above, at the
+ *      cost of an addition per link followed: searches of a tree in cache run
+ *      about a fifth slower
+ *  @note Defining AVL_STATS counts comparisons, rotations and path lengths
+ *      per thread and per tree, see struct avl_stats. The node is unchanged
+ *  @note Defining AVL_PREFIX adds a 64-bit key prefix to each node, which the
+ *      searches compare before calling the comparison function, and which
+ *      spares them the load of the key itself wherever the prefixes differ.
+ *      See avl_prefix_bytes
+ */
 struct avl {
+#if defined(AVL_COMPACT) || defined(AVL_RELATIVE)
+    uintptr_t   link[2];    /* The encoded child links */
+#else
     struct avl *next[2];    /* The child pointers */
+#endif
+#ifdef AVL_PREFIX
+    uint64_t    prefix;     /* Order-preserving summary of the key */
+#endif
+#ifdef AVL_PARENT
+# ifdef AVL_RELATIVE
+    uintptr_t   parent;     /* The encoded parent link */
+# else
+    struct avl *parent;     /* The parent node, or NULL at the root */
+# endif
+#endif
+#ifdef AVL_SIZE
+    size_t      size;       /* The number of nodes in this subtree */
+#endif
+#ifndef AVL_COMPACT
     signed char balance;    /* The current AVL balance */
+#endif
 };
 
 
+#if defined(AVL_COMPACT) || defined(AVL_RELATIVE)
+
+#ifdef AVL_COMPACT
+/* The balance is kept as a three-bit two's complement integer, because it
+briefly reaches +/-2 during rebalancing. Bits 0 and 1 live in link[0] and bit 2
+lives in link[1] */
+#define AVL_TAG_MASK ((uintptr_t)3)
+#else
+#define AVL_TAG_MASK ((uintptr_t)0)
+#endif
+
+/* A relative link holds the target address minus the address of the link word.
+Zero means NULL in either encoding, since no node links into itself. Nodes are
+word aligned, so the distance leaves the tag bits clear */
+static inline struct avl *avl_link_get(const uintptr_t *link)
+{
+    uintptr_t raw = *link & ~AVL_TAG_MASK;
+
+#ifdef AVL_RELATIVE
+    return raw ? (struct avl *)((uintptr_t)link + raw) : NULL;
+#else
+    return (struct avl *)raw;
+#endif
+}
+
+static inline void avl_link_set(uintptr_t *link, const struct avl *target)
+{
+    uintptr_t raw = (uintptr_t)target;
+
+#ifdef AVL_RELATIVE
+    raw = target ? raw - (uintptr_t)link : 0;
+#endif
+    *link = raw | (*link & AVL_TAG_MASK);
+}
+
+#define AVL_CHILD(node, dir) avl_link_get(&(node)->link[dir])
+
+#define AVL_SET_CHILD(node, dir, child) avl_link_set(&(node)->link[dir], (child))
+
+#else
+
+/** @brief Get the child of @p node in direction @p dir (0 left, 1 right) */
+#define AVL_CHILD(node, dir) ((node)->next[dir])
+
+/** @brief Set the child of @p node in direction @p dir to @p child */
+#define AVL_SET_CHILD(node, dir, child) ((node)->next[dir] = (child))
+
+#endif /* AVL_COMPACT || AVL_RELATIVE */
+
+
+#ifdef AVL_COMPACT
+
+#define AVL_BALANCE(node) \
+    ((int)((((node)->link[0] & 3) | (((node)->link[1] & 1) << 2)) ^ 4) - 4)
+
+#define AVL_SET_BALANCE(node, bal) avl_compact_set_balance((node), (bal))
+
+static inline void avl_compact_set_balance(struct avl *node, int bal)
+{
+    node->link[0] = (node->link[0] & ~(uintptr_t)3) | ((uintptr_t)bal & 3);
+    node->link[1] = (node->link[1] & ~(uintptr_t)1) | ((uintptr_t)bal >> 2 & 1);
+}
+
+#else
+
+/** @brief Get the balance (right height minus left height) of @p node */
+#define AVL_BALANCE(node) ((node)->balance)
+
+/** @brief Set the balance of @p node to @p bal */
+#define AVL_SET_BALANCE(node, bal) ((node)->balance = (bal))
+
+#endif /* AVL_COMPACT */
+
+
+#ifdef AVL_PARENT
+
+#ifdef AVL_RELATIVE
+#define AVL_PARENT_OF(node) avl_link_get(&(node)->parent)
+#define AVL_SET_PARENT_OF(node, up) avl_link_set(&(node)->parent, (up))
+#else
+/** @brief Get the parent of @p node, or NULL at the root */
+#define AVL_PARENT_OF(node) ((node)->parent)
+
+/** @brief Set the parent of @p node to @p up */
+#define AVL_SET_PARENT_OF(node, up) ((node)->parent = (up))
+#endif
+
+#endif /* AVL_PARENT */
+
+
+#ifdef AVL_PREFIX
+
+/** @brief Pack the first eight bytes of a key big-endian, stopping at a NUL
+ *      and padding with zeros. Prefixes made this way order as memcmp(3) and
+ *      strcmp(3) order the keys, except that some distinct keys tie
+ *  @note Whatever the prefix is, it must never order two nodes against their
+ *      comparison function: if cmpfn(a, b) < 0, then a->prefix <= b->prefix.
+ *      Every node and every query must carry one. A tree whose prefixes are
+ *      all zero behaves as it would without AVL_PREFIX
+ *  @param key
+ *      Key bytes
+ *  @param len
+ *      Length of the key. For a string this may be any bound on its length
+ */
+static inline uint64_t avl_prefix_bytes(const void *key, size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *)key;
+    uint64_t res = 0;
+    size_t i;
+
+    for (i = 0; i < 8 && i < len && bytes[i]; i++) {
+        res |= (uint64_t)bytes[i] << (56 - 8 * i);
+    }
+    return res;
+}
+
+/** @brief Order @p n1 and @p n2 by their prefixes alone
+ *  @returns Negative or positive if the prefixes decide the order, or zero if
+ *      they tie and the comparison function must
+ */
+static inline int avl_prefix_cmp(const struct avl *n1, const struct avl *n2)
+{
+    return (n1->prefix > n2->prefix) - (n1->prefix < n2->prefix);
+}
+
+#endif /* AVL_PREFIX */
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** @brief Maximum height of any AVL tree that fits in the address space. The
+ *      height of an AVL tree with n nodes is bounded by about 1.44 log2(n), and
+ *      n cannot exceed the number of addressable bytes
+ */
+#define AVL_MAX_HEIGHT (sizeof (void *) * CHAR_BIT * 3 / 2)
+
+
 /** @brief Compare two AVL nodes
  *  @param n1
  *      Left operand
@@ -27,7 +220,8 @@ typedef int avl_cmpfn_t(const struct avl *n1, const struct avl *n2);
  *  @param node
  *      Double-pointer to the node in the tree that compares equal to @p join.
  *      You can safely overwrite the pointer to @p node with @p join if you want
- *      to, but be sure to free(3) *node afterwards if you need to. If you do
+ *      to, but be sure to free(3) *node afterwards if you need to. The tree is
+ *      relinked to the new node once this function returns. If you do
  *      move @p join into @p node's place, remember to copy its topological
  *      information over to @p join first, i.e.
  *      @code
@@ -66,6 +260,29 @@ int avl_insert(struct avl **root,  struct avl   *node,
                avl_cmpfn_t *cmpfn, avl_joinfn_t *joinfn);
 
 
+/** @brief Recompute the user's augmented data (subtree sums, maxima, ...) for
+ *      @p node from its own data and its children's. The augmenting functions
+ *      call this on exactly the nodes whose subtrees changed, from the bottom
+ *      up, so any aggregate that can be combined from two children stays
+ *      correct with O(log n) calls per operation
+ *  @param node
+ *      The node to update. Its children, found with AVL_CHILD, are already up
+ *      to date
+ */
+typedef void avl_updatefn_t(struct avl *node);
+
+
+/** @brief avl_insert, maintaining augmented data with @p update
+ *  @param update
+ *      Update function. This is also called on the existing node, and on its
+ *      ancestors, after @p joinfn runs
+ *  @see avl_insert for the other parameters and the return value
+ */
+int avl_insert_aug(struct avl    **root,  struct avl     *node,
+                   avl_cmpfn_t    *cmpfn, avl_joinfn_t   *joinfn,
+                   avl_updatefn_t *update);
+
+
 /** @brief Callback invoked on a node before it is deleted. This is intended to
  *      facilitate implementation of multisets
  *  @param node
@@ -99,6 +316,502 @@ struct avl *avl_delete(struct avl **root,  struct avl  *node,
                        avl_cmpfn_t *cmpfn, avl_delfn_t *delfn);
 
 
+/** @brief avl_delete, maintaining augmented data with @p update
+ *  @param update
+ *      Update function. If @p delfn keeps the node, this is still called on it
+ *      and its ancestors in case the callback changed it
+ *  @see avl_delete for the other parameters and the return value
+ */
+struct avl *avl_delete_aug(struct avl    **root,  struct avl   *node,
+                           avl_cmpfn_t    *cmpfn, avl_delfn_t  *delfn,
+                           avl_updatefn_t *update);
+
+
+/** @brief The path from the root to a node, recorded during a descent. This
+ *      lets code that searches the tree itself, such as the specialized trees
+ *      generated by avl_gen.h, hand the rebalancing back to the library
+ */
+struct avl_path {
+    struct avl   *node[AVL_MAX_HEIGHT]; /* Ancestors, starting at the root */
+    unsigned char dir[AVL_MAX_HEIGHT];  /* Direction taken from each ancestor */
+    unsigned      len;                  /* Number of ancestors recorded */
+    avl_updatefn_t *update;             /* User update function, or NULL */
+};
+
+
+/** @brief Start an empty path for an operation that maintains augmented data
+ *      with @p update, which may be NULL
+ */
+static inline void avl_path_init(struct avl_path *path, avl_updatefn_t *update)
+{
+    path->len = 0;
+    path->update = update;
+}
+
+
+/** @brief Append @p node to @p path, noting that the descent went toward
+ *      @p dir (0 left, 1 right)
+ */
+static inline void avl_path_push(struct avl_path *path, struct avl *node, unsigned dir)
+{
+    assert(path->len < AVL_MAX_HEIGHT);
+    path->node[path->len] = node;
+    path->dir[path->len] = (unsigned char)dir;
+    path->len++;
+}
+
+
+/** @brief Link @p node into the empty slot at the end of @p path and rebalance
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param path
+ *      Path from the root to the parent of the empty slot, as recorded by an
+ *      unsuccessful search. This is consumed
+ *  @param node
+ *      Zeroed node to insert
+ */
+void avl_insert_at(struct avl **root, struct avl_path *path, struct avl *node);
+
+
+/** @brief Remove @p node, found at the end of @p path, and rebalance
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param path
+ *      Path from the root to the parent of @p node, as recorded by a
+ *      successful search. This is consumed
+ *  @param node
+ *      The node to remove
+ */
+void avl_delete_at(struct avl **root, struct avl_path *path, struct avl *node);
+
+
+#ifndef AVL_PARENT
+
+/** @brief Hooks for the copy-on-write updates avl_insert_cow and
+ *      avl_delete_cow. These never modify a node that is already in the tree.
+ *      Every node they would change is copied instead, so the new version
+ *      shares all untouched subtrees with the old one, which stays intact and
+ *      searchable. They are not available with AVL_PARENT, since a shared
+ *      subtree cannot point back to two parents
+ */
+struct avl_cow {
+    /** @brief Copy the whole element holding @p node, including the struct
+     *      avl, and return the copy's node, or NULL on failure
+     */
+    struct avl *(*copy)(struct avl_cow *cow, const struct avl *node);
+
+    /** @brief Called once an update has succeeded for each node that the new
+     *      version replaced with a copy. The node still belongs to the old
+     *      version
+     */
+    void (*retire)(struct avl_cow *cow, struct avl *node);
+
+    /** @brief Free a copy made by an update that then failed */
+    void (*discard)(struct avl_cow *cow, struct avl *node);
+};
+
+
+/** @brief Insert @p node into a new version of a tree, copying its path
+ *  @param root
+ *      Address of the root of the current version, which is replaced by the
+ *      root of the new version on success
+ *  @param node
+ *      Zeroed node to insert
+ *  @param cmpfn
+ *      Comparison function
+ *  @param cow
+ *      Copy hooks
+ *  @returns Zero if @p node was inserted, 1 if an equal node was already in
+ *      the tree, and -1 if a copy failed. Nothing is copied or changed unless
+ *      this returns zero
+ */
+int avl_insert_cow(struct avl **root,  struct avl     *node,
+                   avl_cmpfn_t *cmpfn, struct avl_cow *cow);
+
+
+/** @brief Remove the node comparing equal to @p query from a new version of a
+ *      tree, copying its path and whatever else rebalancing touches
+ *  @param root
+ *      Address of the root of the current version, which is replaced by the
+ *      root of the new version on success
+ *  @param query
+ *      Test node
+ *  @param cmpfn
+ *      Comparison function
+ *  @param cow
+ *      Copy hooks
+ *  @param removed
+ *      Set to the removed node, which still belongs to the old version
+ *  @returns Zero if a node was removed, 1 if there was none, and -1 if a copy
+ *      failed. Nothing is copied or changed unless this returns zero
+ */
+int avl_delete_cow(struct avl    **root,  struct avl     *query,
+                   avl_cmpfn_t    *cmpfn, struct avl_cow *cow,
+                   struct avl    **removed);
+
+#endif /* AVL_PARENT */
+
+
+#ifdef AVL_PARENT
+
+/** @brief Remove @p node from the tree without searching for it
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param node
+ *      A node currently in the tree. The comparison function is never called,
+ *      and the delete callback is not involved
+ */
+void avl_remove_node(struct avl **root, struct avl *node);
+
+
+/** @brief avl_remove_node, maintaining augmented data with @p update */
+void avl_remove_node_aug(struct avl **root, struct avl *node, avl_updatefn_t *update);
+
+
+/** @brief Find the in-order successor of @p node
+ *  @param node
+ *      A node currently in a tree
+ *  @returns The successor, or NULL if @p node is the greatest node
+ */
+struct avl *avl_next(struct avl *node);
+
+
+/** @brief Find the in-order predecessor of @p node
+ *  @param node
+ *      A node currently in a tree
+ *  @returns The predecessor, or NULL if @p node is the least node
+ */
+struct avl *avl_prev(struct avl *node);
+
+#endif /* AVL_PARENT */
+
+
+/** @brief Build a tree from nodes that are already in order. This runs in
+ *      linear time and never compares nodes
+ *  @param nodes
+ *      Array of @p n nodes sorted in strictly ascending order. Their avl parts
+ *      do not need to be initialized
+ *  @param n
+ *      Number of nodes
+ *  @returns The root of a perfectly balanced tree containing every node, or
+ *      NULL if @p n is zero
+ */
+struct avl *avl_build_sorted(struct avl **nodes, size_t n);
+
+
+/** @brief Produce the next node for avl_build_stream
+ *  @param data
+ *      Extra user data
+ *  @returns The next node in ascending order. This must not be NULL while the
+ *      build still expects nodes
+ */
+typedef struct avl *avl_nextfn_t(void *data);
+
+
+/** @brief Build a tree from a stream of nodes that are already in order, e.g.
+ *      while reading a sorted file. The result is the same tree that
+ *      avl_build_sorted would build from the same nodes
+ *  @param nextfn
+ *      Called exactly @p n times to produce the nodes in strictly ascending
+ *      order. Their avl parts do not need to be initialized
+ *  @param data
+ *      Data passed to @p nextfn
+ *  @param n
+ *      Number of nodes. This must be known up front
+ *  @returns The tree root, or NULL if @p n is zero
+ */
+struct avl *avl_build_stream(avl_nextfn_t *nextfn, void *data, size_t n);
+
+
+/** @brief Apply @p update to every node in postorder, e.g. to compute the
+ *      augmented data of a tree made by avl_build_sorted
+ *  @param root
+ *      Tree root
+ *  @param update
+ *      Update function
+ *  @note Join, split and the set operations do not maintain user augmented
+ *      data
+ */
+void avl_augment(struct avl *root, avl_updatefn_t *update);
+
+
+/** @brief Compute the height of a tree in O(log n) time using the balances
+ *  @param root
+ *      Tree root
+ *  @returns The number of nodes on the longest path from the root to a leaf
+ */
+unsigned avl_height(const struct avl *root);
+
+
+/** @brief Invariant violations found by avl_analyze */
+typedef enum {
+    AVL_SHAPE_OK,           /* Every invariant holds */
+    AVL_SHAPE_ORDER,        /* A node does not compare greater than its predecessor */
+    AVL_SHAPE_BALANCE,      /* A stored balance disagrees with the subtree heights */
+    AVL_SHAPE_UNBALANCED,   /* The subtrees of a node differ in height by more than one */
+    AVL_SHAPE_PARENT,       /* A parent link is wrong, with AVL_PARENT */
+    AVL_SHAPE_SIZE,         /* A subtree size is wrong, with AVL_SIZE */
+    AVL_SHAPE_DEPTH         /* The tree is deeper than AVL_MAX_HEIGHT, which means it
+                               is corrupt or cyclic. The analysis stopped there */
+} avl_shape_err_t;
+
+
+/** @brief The shape of a tree, as measured by avl_analyze */
+struct avl_shape {
+    size_t           nodes;         /* Number of nodes */
+    unsigned         height;        /* Height, as measured from the links */
+    unsigned         max_depth;     /* Greatest depth of any node, the root being 1 */
+    double           avg_depth;     /* Mean depth, i.e. comparisons per successful lookup */
+    size_t           balance[3];    /* Nodes with stored balance -1, 0 and +1 */
+    avl_shape_err_t  error;         /* The first violation found */
+    struct avl      *bad;           /* The node it was found at, or NULL */
+};
+
+
+/** @brief Measure the shape of a tree and validate it in a single pass, without
+ *      recursion. Heights are recomputed from the links and checked against
+ *      every stored balance, as are the parent links and subtree sizes when
+ *      the library keeps them. This costs one comparison per node, making it
+ *      cheap enough to run on large trees as a consistency check
+ *  @param root
+ *      Tree root
+ *  @param cmpfn
+ *      Comparison function used to check that the in-order sequence strictly
+ *      increases. This may be NULL to skip that check
+ *  @param shape
+ *      Results. The counts cover the whole tree even after a violation, except
+ *      for AVL_SHAPE_DEPTH
+ *  @returns shape->error
+ */
+avl_shape_err_t avl_analyze(struct avl       *root,
+                            avl_cmpfn_t      *cmpfn,
+                            struct avl_shape *shape);
+
+
+/** @brief Join two trees around a middle node in O(|height difference|) time
+ *  @param left
+ *      Tree whose nodes all compare less than @p node. This is consumed
+ *  @param node
+ *      Middle node. Its avl part does not need to be initialized
+ *  @param right
+ *      Tree whose nodes all compare greater than @p node. This is consumed
+ *  @returns The root of the joined tree
+ */
+struct avl *avl_join(struct avl *left, struct avl *node, struct avl *right);
+
+
+/** @brief Concatenate two trees in O(log n) time
+ *  @param left
+ *      Tree whose nodes all compare less than those in @p right. This is
+ *      consumed
+ *  @param right
+ *      The other tree. This is consumed
+ *  @returns The root of the combined tree
+ */
+struct avl *avl_concat(struct avl *left, struct avl *right);
+
+
+/** @brief Split a tree around @p key in O(log n) time
+ *  @param root
+ *      Tree to split. This is consumed
+ *  @param key
+ *      Test node to split around. This only needs to contain the information
+ *      required for @p cmpfn
+ *  @param cmpfn
+ *      Comparison function
+ *  @param left
+ *      The tree of all nodes comparing less than @p key is written here
+ *  @param right
+ *      The tree of all nodes comparing greater than @p key is written here
+ *  @returns The node comparing equal to @p key, which belongs to neither
+ *      output tree, or NULL if there was no such node
+ */
+struct avl *avl_split(struct avl  *root,  struct avl  *key, avl_cmpfn_t *cmpfn,
+                      struct avl **left,  struct avl **right);
+
+
+/** @brief Remove every node in the half-open range [@p lo, @p hi) from a tree
+ *      in O(log n) time
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param lo
+ *      Test node for the inclusive lower bound
+ *  @param hi
+ *      Test node for the exclusive upper bound
+ *  @param cmpfn
+ *      Comparison function
+ *  @returns A tree containing the removed nodes
+ */
+struct avl *avl_extract_range(struct avl **root,  struct avl  *lo,
+                              struct avl  *hi,    avl_cmpfn_t *cmpfn);
+
+
+/** @brief Callback receiving a node that a set operation has discarded
+ *  @param node
+ *      The node. It no longer belongs to any tree, so it is safe to free(3)
+ *  @param data
+ *      Extra user data
+ */
+typedef void avl_dropfn_t(struct avl *node, void *data);
+
+
+/** @brief Merge every node of @p other into the tree at @p root. This needs
+ *      O(m log(n/m + 1)) comparisons for trees of sizes m <= n
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param other
+ *      Tree to merge in. This is consumed
+ *  @param cmpfn
+ *      Comparison function
+ *  @param joinfn
+ *      Called as for avl_insert when a node of @p other compares equal to a
+ *      node already at @p root. If this is NULL, the node from @p other is left
+ *      out of the result
+ */
+void avl_union(struct avl  **root,  struct avl   *other,
+               avl_cmpfn_t  *cmpfn, avl_joinfn_t *joinfn);
+
+
+/** @brief Keep only the nodes of @p root that compare equal to some node of
+ *      @p other. This needs O(m log(n/m + 1)) comparisons
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param other
+ *      Second tree. This is consumed
+ *  @param cmpfn
+ *      Comparison function
+ *  @param joinfn
+ *      Called as for avl_insert on each matching pair. If this is NULL, the
+ *      node from @p other is passed to @p dropfn instead
+ *  @param dropfn
+ *      Receives every node of either tree that is left out of the result. This
+ *      may be NULL
+ *  @param data
+ *      Data passed to @p dropfn
+ */
+void avl_intersect(struct avl  **root,  struct avl   *other,
+                   avl_cmpfn_t  *cmpfn, avl_joinfn_t *joinfn,
+                   avl_dropfn_t *dropfn, void        *data);
+
+
+/** @brief Remove the nodes of @p root that compare equal to some node of
+ *      @p other. This needs O(m log(n/m + 1)) comparisons
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param other
+ *      Tree of nodes to remove. This is consumed
+ *  @param cmpfn
+ *      Comparison function
+ *  @param dropfn
+ *      Receives every node of @p other, as well as each node removed from
+ *      @p root. This may be NULL
+ *  @param data
+ *      Data passed to @p dropfn
+ */
+void avl_difference(struct avl  **root,   struct avl *other,
+                    avl_cmpfn_t  *cmpfn,
+                    avl_dropfn_t *dropfn, void       *data);
+
+
+/** @brief Insert a sorted batch of nodes. The batch is pushed down the tree as
+ *      a whole, split by binary search at each node it reaches, and each
+ *      affected subtree is rebuilt with one join on the way back up. This costs
+ *      O(m log(n / m + 1)) comparisons for m nodes into a tree of n, against
+ *      O(m log n) for repeated avl_insert
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param nodes
+ *      Array of zeroed nodes, sorted in strictly increasing order by
+ *      @p cmpfn. The array itself is not modified
+ *  @param n
+ *      Number of nodes
+ *  @param cmpfn
+ *      Comparison function
+ *  @param joinfn
+ *      Called as in avl_insert for each node that compares equal to a node
+ *      already in the tree. This may be NULL
+ *  @returns The number of nodes linked into the tree. The rest were joined
+ */
+size_t avl_insert_batch(struct avl  **root,  struct avl  **nodes,
+                        size_t        n,     avl_cmpfn_t  *cmpfn,
+                        avl_joinfn_t *joinfn);
+
+
+/** @brief Delete a sorted batch of keys, sharing the descent the same way as
+ *      avl_insert_batch
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param nodes
+ *      Array of test nodes, sorted in strictly increasing order by @p cmpfn
+ *  @param n
+ *      Number of test nodes
+ *  @param cmpfn
+ *      Comparison function
+ *  @param delfn
+ *      Called as in avl_delete on each matching node before it is removed.
+ *      This may be NULL
+ *  @param out
+ *      If not NULL, an array of @p n results receiving what avl_delete would
+ *      have returned for each test node
+ *  @returns The number of nodes removed from the tree
+ */
+size_t avl_delete_batch(struct avl        **root,  struct avl *const *nodes,
+                        size_t              n,     avl_cmpfn_t       *cmpfn,
+                        avl_delfn_t        *delfn, struct avl       **out);
+
+
+#ifdef AVL_SIZE
+
+/** @brief Count the nodes in a tree in O(1) time
+ *  @param root
+ *      Tree root
+ *  @returns The number of nodes in the tree
+ */
+size_t avl_size(const struct avl *root);
+
+
+/** @brief Count the nodes that compare less than @p query
+ *  @param root
+ *      Tree root
+ *  @param query
+ *      Test node. This only needs to contain the information required for
+ *      @p cmpfn
+ *  @param cmpfn
+ *      Comparison function
+ *  @returns The number of nodes less than @p query. If a node compares equal to
+ *      @p query, this is its zero-based position in the tree
+ */
+size_t avl_rank(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn);
+
+
+/** @brief Find the node at a given position
+ *  @param root
+ *      Tree root
+ *  @param index
+ *      Zero-based position of the node in order
+ *  @returns The node at @p index, or NULL if the tree has no more than
+ *      @p index nodes
+ */
+struct avl *avl_select(struct avl *root, size_t index);
+
+
+/** @brief Count the nodes in the half-open range [@p lo, @p hi)
+ *  @param root
+ *      Tree root
+ *  @param lo
+ *      Test node for the inclusive lower bound
+ *  @param hi
+ *      Test node for the exclusive upper bound
+ *  @param cmpfn
+ *      Comparison function
+ *  @returns The number of nodes within the range
+ */
+size_t avl_count_range(struct avl  *root, struct avl *lo,
+                       struct avl  *hi,   avl_cmpfn_t *cmpfn);
+
+#endif /* AVL_SIZE */
+
+
 /** @brief Look up a node comparing equal to @p query
  *  @param root
  *      Tree root
@@ -113,6 +826,63 @@ struct avl *avl_delete(struct avl **root,  struct avl  *node,
 struct avl *avl_lookup(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn);
 
 
+/** @brief Look up many queries at once. The searches advance in lockstep, a
+ *      group at a time, and each one's next node is prefetched while the
+ *      others take their step, so the cache misses of independent searches
+ *      overlap instead of being paid one after another. This pays off when the
+ *      tree is much larger than the cache
+ *  @param root
+ *      Tree root
+ *  @param queries
+ *      Array of @p n test nodes
+ *  @param n
+ *      Number of queries
+ *  @param cmpfn
+ *      Comparison function
+ *  @param out
+ *      Array of @p n results, receiving what avl_lookup would return for each
+ *      query. This may not overlap @p queries
+ */
+void avl_lookup_batch(struct avl  *root,  struct avl *const *queries,
+                      size_t       n,     avl_cmpfn_t       *cmpfn,
+                      struct avl **out);
+
+
+/** @brief Find the least node that does not compare less than @p query
+ *  @param root
+ *      Tree root
+ *  @param query
+ *      Test node. This only needs to contain the information required for
+ *      @p cmpfn
+ *  @param cmpfn
+ *      Comparison function
+ *  @returns The node found, or NULL if every node is less than @p query
+ */
+struct avl *avl_lower_bound(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn);
+
+
+/** @brief Find the least node that compares greater than @p query
+ *  @returns The node found, or NULL if no node is greater than @p query
+ *  @see avl_lower_bound for the parameters
+ */
+struct avl *avl_upper_bound(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn);
+
+
+/** @brief Find the greatest node that does not compare greater than @p query
+ *  @returns The node found, or NULL if every node is greater than @p query
+ *  @see avl_lower_bound for the parameters
+ */
+struct avl *avl_floor(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn);
+
+
+/** @brief Find the least node that does not compare less than @p query. Since
+ *      the tree holds no duplicates, this is the same as avl_lower_bound
+ *  @returns The node found, or NULL if every node is less than @p query
+ *  @see avl_lower_bound for the parameters
+ */
+struct avl *avl_ceil(struct avl *root, struct avl *query, avl_cmpfn_t *cmpfn);
+
+
 /** @brief Iterator function signature
  *  @param node
  *      The node, i.e. current iterator value
@@ -133,7 +903,8 @@ typedef enum {
 } avl_iterdir_t;
 
 
-/** @brief Iterate over the tree
+/** @brief Iterate over the tree, without recursion. Callbacks may free the node
+ *      they are given, but must not change the tree otherwise
  *  @param root
  *      Tree root
  *  @param dir
@@ -152,4 +923,260 @@ int avl_foreach(struct avl   *root,
                 void         *data);
 
 
+/** @brief Number of nodes avl_foreach_batch delivers per callback, and that
+ *      avl_foreach collects ahead of its callbacks
+ */
+#define AVL_VISIT_BATCH 64
+
+
+/** @brief Visit a batch of consecutive nodes
+ *  @param nodes
+ *      The nodes, in iteration order
+ *  @param n
+ *      Number of nodes, AVL_VISIT_BATCH except perhaps for the last batch
+ *  @param data
+ *      Callback data
+ *  @returns Nonzero to stop iterating
+ */
+typedef int avl_batchfn_t(struct avl *const *nodes, size_t n, void *data);
+
+
+/** @brief avl_foreach, delivering the nodes in arrays of AVL_VISIT_BATCH so
+ *      that the cost of each call is shared by many nodes. The traversal is
+ *      iterative and prefetches the subtrees it will enter next. Callbacks
+ *      may free the nodes they are given, but not change the tree otherwise
+ *  @param fn
+ *      Batch callback
+ *  @see avl_foreach for the other parameters and the return value
+ */
+int avl_foreach_batch(struct avl    *root,
+                      avl_iterdir_t  dir,
+                      avl_batchfn_t *fn,
+                      void          *data);
+
+
+/** @brief Decide whether avl_delete_if removes @p node
+ *  @param node
+ *      Node under consideration. Its links must not be followed
+ *  @param data
+ *      User data
+ *  @returns Nonzero to remove the node
+ */
+typedef int avl_predfn_t(struct avl *node, void *data);
+
+
+/** @brief Remove every node matching @p pred in a single linear pass: the
+ *      nodes are filtered in order and the survivors rebuilt into a perfectly
+ *      balanced tree, as by avl_build_stream, without any rebalancing or
+ *      allocation. This costs O(n) however many nodes go, against O(k log n)
+ *      for k calls to avl_delete, which makes it the faster way once more than
+ *      about a tenth of a large tree goes
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param pred
+ *      Predicate, called once per node in order
+ *  @param dropfn
+ *      Called on each removed node, which it may free. This may be NULL
+ *  @param data
+ *      Data passed to @p pred and @p dropfn
+ *  @returns The number of nodes removed
+ *  @note User augmented data is not maintained, see avl_augment
+ */
+size_t avl_delete_if(struct avl  **root,   avl_predfn_t *pred,
+                     avl_dropfn_t *dropfn, void         *data);
+
+
+
+/** @brief An in-order position within a tree. A cursor records the path from
+ *      the root to its current node, so it allocates nothing and stepping costs
+ *      amortized O(1). Any insertion into or deletion from the tree invalidates
+ *      every cursor positioned within it
+ */
+struct avl_cursor {
+    struct avl *stack[AVL_MAX_HEIGHT];  /* Path from the root to the current node */
+    unsigned    depth;                  /* Path length. Zero past either end */
+};
+
+
+/** @brief Get the node at the cursor position
+ *  @param cur
+ *      Cursor
+ *  @returns The current node, or NULL if the cursor has run off either end of
+ *      the tree
+ */
+struct avl *avl_cursor_get(const struct avl_cursor *cur);
+
+
+/** @brief Position @p cur on the least node in the tree
+ *  @param cur
+ *      Cursor to initialize
+ *  @param root
+ *      Tree root
+ *  @returns The least node, or NULL if the tree is empty
+ */
+struct avl *avl_cursor_first(struct avl_cursor *cur, struct avl *root);
+
+
+/** @brief Position @p cur on the greatest node in the tree
+ *  @param cur
+ *      Cursor to initialize
+ *  @param root
+ *      Tree root
+ *  @returns The greatest node, or NULL if the tree is empty
+ */
+struct avl *avl_cursor_last(struct avl_cursor *cur, struct avl *root);
+
+
+/** @brief Advance @p cur to the in-order successor of its current node
+ *  @param cur
+ *      Cursor
+ *  @returns The new current node, or NULL if the cursor has run off the end.
+ *      Once this happens the cursor must be repositioned before it is used
+ *      again
+ */
+struct avl *avl_cursor_next(struct avl_cursor *cur);
+
+
+/** @brief Move @p cur to the in-order predecessor of its current node
+ *  @param cur
+ *      Cursor
+ *  @returns The new current node, or NULL if the cursor has run off the
+ *      beginning. Once this happens the cursor must be repositioned before it
+ *      is used again
+ */
+struct avl *avl_cursor_prev(struct avl_cursor *cur);
+
+
+/** @brief Position @p cur on the least node that does not compare less than
+ *      @p query
+ *  @param cur
+ *      Cursor to initialize
+ *  @param root
+ *      Tree root
+ *  @param query
+ *      Test node. This only needs to contain the information required for
+ *      @p cmpfn
+ *  @param cmpfn
+ *      Comparison function
+ *  @returns The node comparing equal to @p query if there is one, otherwise its
+ *      in-order successor, or NULL if every node compares less than @p query
+ */
+struct avl *avl_cursor_seek(struct avl_cursor *cur,   struct avl  *root,
+                            struct avl        *query, avl_cmpfn_t *cmpfn);
+
+
+/** @brief Reposition @p cur like avl_cursor_seek, but search outward from its
+ *      current position instead of down from the root (finger search). A
+ *      query next to the current node costs O(1) comparisons, and in general
+ *      the cost grows with the log of the distance
+ *  @param cur
+ *      Cursor on a node of this tree, or with depth zero to search from the
+ *      root. The tree must not have changed since the cursor was positioned
+ *  @param root
+ *      Tree root
+ *  @param query
+ *      Test node
+ *  @param cmpfn
+ *      Comparison function
+ *  @returns As for avl_cursor_seek
+ */
+struct avl *avl_cursor_finger(struct avl_cursor *cur,   struct avl  *root,
+                              struct avl        *query, avl_cmpfn_t *cmpfn);
+
+
+/** @brief avl_insert, starting the search from the node under @p hint instead
+ *      of the root. Inserting next to the hinted node costs O(1) comparisons,
+ *      so feeding each insertion the hint left by the last one makes sorted
+ *      and nearly-sorted input cheap
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param hint
+ *      Cursor on a node of this tree. With depth zero, for example before the
+ *      first insertion, the search starts from the greatest node, which suits
+ *      append-mostly input. On return it is positioned on @p node, or on the
+ *      node @p node was joined to
+ *  @see avl_insert for the other parameters and the return value
+ */
+int avl_insert_hint(struct avl  **root,  struct avl_cursor *hint,
+                    struct avl   *node,  avl_cmpfn_t       *cmpfn,
+                    avl_joinfn_t *joinfn);
+
+
+/** @brief Iterate in order over the nodes in the half-open range
+ *      [@p lo, @p hi). Only the subtrees overlapping the range are visited, so
+ *      this costs O(log n + k) for k nodes
+ *  @param root
+ *      Tree root
+ *  @param lo
+ *      Test node for the inclusive lower bound, or NULL to start at the least
+ *      node
+ *  @param hi
+ *      Test node for the exclusive upper bound, or NULL to continue to the end
+ *  @param cmpfn
+ *      Comparison function
+ *  @param fn
+ *      Iteration callback
+ *  @param data
+ *      Callback data
+ *  @returns The callback's return value if it was nonzero, otherwise zero
+ */
+int avl_range_foreach(struct avl   *root, struct avl  *lo,
+                      struct avl   *hi,   avl_cmpfn_t *cmpfn,
+                      avl_iterfn_t *fn,   void        *data);
+
+
+#ifdef AVL_STATS
+
+/** @brief Instrumentation counters, kept when the library is built with
+ *      AVL_STATS. Without it none of this exists and the operations count
+ *      nothing. Only the core operations in avl.c count: comparisons made by
+ *      the other modules are not included
+ */
+struct avl_stats {
+    unsigned long long compares;        /* Calls to a comparison function */
+    unsigned long long rotations;       /* Single rotations */
+    unsigned long long double_rotations; /* Double rotations */
+    unsigned long long descents;        /* Searches by insert, delete and lookup */
+    unsigned long long depth;           /* Nodes visited by those searches */
+    unsigned long long rebalances;      /* Rebalancing passes after an update */
+    unsigned long long retraced;        /* Ancestors those passes visited */
+    unsigned long long early_exits;     /* Passes that stopped below the root */
+};
+
+
+/** @brief Copy the counters of the calling thread
+ *  @param stats
+ *      Destination
+ */
+void avl_stats_snapshot(struct avl_stats *stats);
+
+
+/** @brief Zero the counters of the calling thread */
+void avl_stats_reset(void);
+
+
+/** @brief Also count every operation the calling thread performs into
+ *      @p tree, which is how counters are kept per tree: bind the tree's struct
+ *      before operating on it. The struct is updated without synchronization,
+ *      so threads sharing a tree under a shared lock should each bind their own
+ *      and sum them with avl_stats_add. A snapshot or reset of it is a plain
+ *      copy or memset
+ *  @param tree
+ *      Counters to add to, or NULL to stop
+ *  @returns The counters previously bound, or NULL
+ */
+struct avl_stats *avl_stats_bind(struct avl_stats *tree);
+
+
+/** @brief Add every counter of @p stats to @p sum */
+void avl_stats_add(struct avl_stats *sum, const struct avl_stats *stats);
+
+#endif /* AVL_STATS */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
 #endif /* AVL_H */
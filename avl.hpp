@@ -0,0 +1,609 @@
+#pragma once
+
+#ifndef AVL_HPP
+#define AVL_HPP
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include "avl.h"
+
+
+/** @brief Ordering on elements of type @p T by their member @p KeyField, for use
+ *      as the Compare parameter of avl_tree
+ *  @details This is transparent: it also compares a bare @p Key against an
+ *      element in either order, so avl_tree::find and friends can be called
+ *      with just a key
+ */
+template <class T, class Key, Key T::*KeyField, class Less = std::less<Key> >
+struct avl_key_less {
+    bool operator()(const T &a, const T &b) const
+    {
+        return Less()(a.*KeyField, b.*KeyField);
+    }
+
+    bool operator()(const Key &a, const T &b) const
+    {
+        return Less()(a, b.*KeyField);
+    }
+
+    bool operator()(const T &a, const Key &b) const
+    {
+        return Less()(a.*KeyField, b);
+    }
+};
+
+
+/** @brief An intrusive AVL tree of elements of type @p T, linked through their
+ *      member @p Hook
+ *  @details The tree never allocates. It links the elements it is given and
+ *      never frees them, so their lifetime is the caller's concern. It is
+ *      move-only, since two trees cannot share the same hooks.
+ *
+ *      The search loops are instantiated with @p Compare, so each comparison
+ *      compiles to inline code. Rebalancing is shared with the C library
+ *      through avl_insert_at and avl_delete_at, and root() is an ordinary tree
+ *      that every function in avl.h accepts.
+ *
+ *      When the library is built with AVL_PREFIX, every element must carry its
+ *      prefix in its hook before it is inserted or used as a query, as avl.h
+ *      requires. insert() keeps it, and the searches order elements by it
+ *      before calling @p Compare. A bare key has no prefix, so searches by key
+ *      use @p Compare alone, which orders the tree the same way.
+ *
+ *      When the library is built with AVL_PARENT, iterators are a single node
+ *      pointer and stay valid until their own element is erased. Otherwise an
+ *      iterator holds an avl_cursor and is invalidated by any change to the
+ *      tree. Moving the tree invalidates every iterator into it
+ *  @tparam T
+ *      Element type, which embeds a struct avl
+ *  @tparam Hook
+ *      The struct avl member of @p T
+ *  @tparam Compare
+ *      Stateless strict weak ordering on @p T. The member functions that take
+ *      a key accept any type that @p Compare can compare with a @p T in both
+ *      orders
+ */
+template <class T, struct avl T::*Hook, class Compare = std::less<T> >
+class avl_tree {
+    static_assert(std::is_empty<Compare>::value, "the comparator must be stateless");
+
+    template <class U>
+    class iter {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef typename std::remove_const<U>::type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef U *pointer;
+        typedef U &reference;
+
+        iter():
+            root_(nullptr)
+        {
+            clear();
+        }
+
+        /** @brief Convert a mutable iterator to a const one */
+        template <class V, class = typename std::enable_if<std::is_same<const V, U>::value>::type>
+        iter(const iter<V> &other):
+            root_(other.root_),
+#ifdef AVL_PARENT
+            node_(other.node_)
+#else
+            cur_(other.cur_)
+#endif
+        {
+        }
+
+        reference operator*() const
+        {
+            return *entry(node());
+        }
+
+        pointer operator->() const
+        {
+            return entry(node());
+        }
+
+        iter &operator++()
+        {
+#ifdef AVL_PARENT
+            node_ = avl_next(node_);
+#else
+            avl_cursor_next(&cur_);
+#endif
+            return *this;
+        }
+
+        iter operator++(int)
+        {
+            iter res = *this;
+
+            ++*this;
+            return res;
+        }
+
+        /** @brief Step back. Decrementing end() gives the greatest element */
+        iter &operator--()
+        {
+#ifdef AVL_PARENT
+            if (node_) {
+                node_ = avl_prev(node_);
+            } else {
+                node_ = *root_;
+                while (node_ && AVL_CHILD(node_, 1)) {
+                    node_ = AVL_CHILD(node_, 1);
+                }
+            }
+#else
+            if (cur_.depth) {
+                avl_cursor_prev(&cur_);
+            } else {
+                avl_cursor_last(&cur_, *root_);
+            }
+#endif
+            return *this;
+        }
+
+        iter operator--(int)
+        {
+            iter res = *this;
+
+            --*this;
+            return res;
+        }
+
+        template <class V>
+        bool operator==(const iter<V> &other) const
+        {
+            return node() == other.node();
+        }
+
+        template <class V>
+        bool operator!=(const iter<V> &other) const
+        {
+            return node() != other.node();
+        }
+
+    private:
+        friend class avl_tree;
+        template <class V> friend class iter;
+
+        explicit iter(struct avl *const *root):
+            root_(root)
+        {
+            clear();
+        }
+
+        /** @brief Get the current node, or NULL at the end */
+        struct avl *node() const
+        {
+#ifdef AVL_PARENT
+            return node_;
+#else
+            return avl_cursor_get(&cur_);
+#endif
+        }
+
+        /** @brief Move to the end */
+        void clear()
+        {
+#ifdef AVL_PARENT
+            node_ = nullptr;
+#else
+            cur_.depth = 0;
+#endif
+        }
+
+        struct avl *const *root_;   /* The tree's root link, for decrementing end() */
+#ifdef AVL_PARENT
+        struct avl       *node_;    /* The current node, or NULL at the end */
+#else
+        struct avl_cursor cur_;     /* Path to the current node */
+#endif
+    };
+
+public:
+    typedef T value_type;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef Compare key_compare;
+    typedef Compare value_compare;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef iter<T> iterator;
+    typedef iter<const T> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    avl_tree():
+        root_(nullptr)
+    {
+    }
+
+    avl_tree(const avl_tree &) = delete;
+    avl_tree &operator=(const avl_tree &) = delete;
+
+    avl_tree(avl_tree &&other) noexcept:
+        root_(other.root_)
+    {
+        other.root_ = nullptr;
+    }
+
+    /** @brief Take over the elements of @p other. The elements this tree held
+     *      are forgotten, as with clear()
+     */
+    avl_tree &operator=(avl_tree &&other) noexcept
+    {
+        if (this != &other) {
+            root_ = other.root_;
+            other.root_ = nullptr;
+        }
+        return *this;
+    }
+
+    /** @brief Get the element containing @p node, or nullptr if it is nullptr */
+    static T *entry(struct avl *node)
+    {
+        return node ? reinterpret_cast<T *>(reinterpret_cast<char *>(node) - offset()) : nullptr;
+    }
+
+    /** @brief Get the root of the underlying C tree */
+    struct avl *root() const
+    {
+        return root_;
+    }
+
+    /** @brief Get the root link of the underlying C tree, for the functions in
+     *      avl.h that modify it
+     */
+    struct avl **root_link()
+    {
+        return &root_;
+    }
+
+    iterator begin()
+    {
+        iterator res(&root_);
+
+        extreme(res, 0);
+        return res;
+    }
+
+    const_iterator begin() const
+    {
+        return const_cast<avl_tree *>(this)->begin();
+    }
+
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+
+    iterator end()
+    {
+        return iterator(&root_);
+    }
+
+    const_iterator end() const
+    {
+        return const_cast<avl_tree *>(this)->end();
+    }
+
+    const_iterator cend() const
+    {
+        return end();
+    }
+
+    reverse_iterator rbegin()
+    {
+        return reverse_iterator(end());
+    }
+
+    const_reverse_iterator rbegin() const
+    {
+        return const_reverse_iterator(end());
+    }
+
+    reverse_iterator rend()
+    {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rend() const
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    bool empty() const
+    {
+        return !root_;
+    }
+
+#ifdef AVL_SIZE
+    size_type size() const
+    {
+        return avl_size(root_);
+    }
+#endif
+
+    /** @brief Link @p item into the tree. Its hook need not be initialized,
+     *      apart from the prefix under AVL_PREFIX
+     *  @returns An iterator to @p item and true, or an iterator to the element
+     *      already in the tree that is equivalent to @p item and false, in
+     *      which case the tree is unchanged
+     */
+    std::pair<iterator, bool> insert(T &item)
+    {
+        struct avl_path path;
+        struct avl *cur = root_;
+        int c;
+#ifdef AVL_PREFIX
+        uint64_t prefix = (item.*Hook).prefix;
+#endif
+
+        avl_path_init(&path, nullptr);
+        while (cur) {
+            c = compare(item, cur);
+            if (!c) {
+                return std::make_pair(locate(*entry(cur)), false);
+            }
+            avl_path_push(&path, cur, c > 0);
+            cur = AVL_CHILD(cur, c > 0);
+        }
+        item.*Hook = avl();
+#ifdef AVL_PREFIX
+        (item.*Hook).prefix = prefix;
+#endif
+        avl_insert_at(&root_, &path, &(item.*Hook));
+        return std::make_pair(locate(item), true);
+    }
+
+    /** @brief Unlink the element at @p pos, which must be dereferenceable
+     *  @returns An iterator to the element that followed it
+     */
+    iterator erase(const_iterator pos)
+    {
+        iterator next(&root_);
+        struct avl *node = pos.node();
+#ifdef AVL_PARENT
+        next.node_ = avl_next(node);
+        avl_remove_node(&root_, node);
+#else
+        struct avl_path path;
+        const_iterator succ = pos;
+        unsigned i;
+
+        avl_path_init(&path, nullptr);
+        for (i = 0; i + 1 < pos.cur_.depth; i++) {
+            avl_path_push(&path, pos.cur_.stack[i],
+                          AVL_CHILD(pos.cur_.stack[i], 1) == pos.cur_.stack[i + 1]);
+        }
+        ++succ;
+        avl_delete_at(&root_, &path, node);
+        /* Rebalancing moved the path, so find the successor again */
+        if (succ.node()) {
+            next = locate(*entry(succ.node()));
+        }
+#endif
+        return next;
+    }
+
+    iterator erase(iterator pos)
+    {
+        return erase(const_iterator(pos));
+    }
+
+    /** @brief Unlink the element equivalent to @p key, if there is one
+     *  @returns The number of elements removed
+     */
+    template <class K>
+    size_type erase(const K &key)
+    {
+        struct avl_path path;
+        struct avl *cur = root_;
+        int c;
+
+        avl_path_init(&path, nullptr);
+        while (cur) {
+            c = compare(key, cur);
+            if (!c) {
+                avl_delete_at(&root_, &path, cur);
+                return 1;
+            }
+            avl_path_push(&path, cur, c > 0);
+            cur = AVL_CHILD(cur, c > 0);
+        }
+        return 0;
+    }
+
+    /** @brief Unlink every element. The elements themselves are untouched */
+    void clear()
+    {
+        root_ = nullptr;
+    }
+
+    void swap(avl_tree &other) noexcept
+    {
+        std::swap(root_, other.root_);
+    }
+
+    /** @brief Find the element equivalent to @p key
+     *  @returns An iterator to it, or end() if there is none
+     */
+    template <class K>
+    iterator find(const K &key)
+    {
+        iterator res = seek(key, false);
+
+        if (res.node() && Compare()(key, *entry(res.node()))) {
+            res.clear();
+        }
+        return res;
+    }
+
+    template <class K>
+    const_iterator find(const K &key) const
+    {
+        return const_cast<avl_tree *>(this)->find(key);
+    }
+
+    template <class K>
+    size_type count(const K &key) const
+    {
+        return find(key) != end();
+    }
+
+    /** @brief Find the first element that does not compare less than @p key */
+    template <class K>
+    iterator lower_bound(const K &key)
+    {
+        return seek(key, false);
+    }
+
+    template <class K>
+    const_iterator lower_bound(const K &key) const
+    {
+        return const_cast<avl_tree *>(this)->lower_bound(key);
+    }
+
+    /** @brief Find the first element that compares greater than @p key */
+    template <class K>
+    iterator upper_bound(const K &key)
+    {
+        return seek(key, true);
+    }
+
+    template <class K>
+    const_iterator upper_bound(const K &key) const
+    {
+        return const_cast<avl_tree *>(this)->upper_bound(key);
+    }
+
+private:
+    /** @brief Offset of @p Hook within @p T. This folds to a constant */
+    static std::ptrdiff_t offset()
+    {
+        alignas(T) unsigned char buf[sizeof (T)];
+        T *obj = reinterpret_cast<T *>(buf);
+
+        return reinterpret_cast<char *>(&(obj->*Hook)) - reinterpret_cast<char *>(obj);
+    }
+
+    /** @brief Three-way comparison of @p key against the element at @p node */
+    template <class K>
+    static int compare(const K &key, struct avl *node)
+    {
+        const T &other = *entry(node);
+
+        if (Compare()(key, other)) {
+            return -1;
+        }
+        return Compare()(other, key) ? 1 : 0;
+    }
+
+#ifdef AVL_PREFIX
+    /** @brief Compare the element @p item against the one at @p node, by their
+     *      prefixes first as the C library does
+     */
+    static int compare(const T &item, struct avl *node)
+    {
+        int c = avl_prefix_cmp(&(item.*Hook), node);
+
+        return c ? c : compare<T>(item, node);
+    }
+#endif
+
+    /** @brief Position @p it on the extreme node of the tree in direction
+     *      @p dir
+     */
+    void extreme(iterator &it, unsigned dir)
+    {
+#ifdef AVL_PARENT
+        struct avl *node = root_;
+
+        while (node && AVL_CHILD(node, dir)) {
+            node = AVL_CHILD(node, dir);
+        }
+        it.node_ = node;
+#else
+        if (dir) {
+            avl_cursor_last(&it.cur_, root_);
+        } else {
+            avl_cursor_first(&it.cur_, root_);
+        }
+#endif
+    }
+
+    /** @brief Find the first element not less than @p key, or greater than it
+     *      if @p strict is set
+     */
+    template <class K>
+    iterator seek(const K &key, bool strict)
+    {
+        iterator res(&root_);
+        struct avl *cur = root_;
+        int c;
+#ifdef AVL_PARENT
+        struct avl *best = nullptr;
+
+        while (cur) {
+            c = compare(key, cur);
+            if (!c && !strict) {
+                best = cur;
+                break;
+            } else if (c < 0) {
+                best = cur;
+            }
+            cur = AVL_CHILD(cur, c < 0 ? 0 : 1);
+        }
+        res.node_ = best;
+#else
+        unsigned keep = 0;
+
+        while (cur) {
+            res.cur_.stack[res.cur_.depth++] = cur;
+            c = compare(key, cur);
+            if (!c && !strict) {
+                keep = res.cur_.depth;
+                break;
+            } else if (c < 0) {
+                keep = res.cur_.depth;
+            }
+            cur = AVL_CHILD(cur, c < 0 ? 0 : 1);
+        }
+        /* The deepest node we went left from is the answer */
+        res.cur_.depth = keep;
+#endif
+        return res;
+    }
+
+    /** @brief Get an iterator to @p item, which is in the tree */
+    iterator locate(T &item)
+    {
+        iterator res(&root_);
+#ifdef AVL_PARENT
+        res.node_ = &(item.*Hook);
+#else
+        struct avl *cur = root_;
+        int c;
+
+        while (cur) {
+            res.cur_.stack[res.cur_.depth++] = cur;
+            if (cur == &(item.*Hook)) {
+                break;
+            }
+            c = compare(item, cur);
+            cur = AVL_CHILD(cur, c > 0);
+        }
+#endif
+        return res;
+    }
+
+    struct avl *root_;
+};
+
+
+#endif /* AVL_HPP */
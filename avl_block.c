@@ -0,0 +1,356 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl_block.h"
+
+#if defined(__GNUC__) && defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__GNUC__) && defined(__SSE4_2__)
+# include <nmmintrin.h>
+#endif
+
+
+#if AVL_BLOCK_KEYS % 4 || AVL_BLOCK_KEYS < 4
+# error "AVL_BLOCK_KEYS must be a positive multiple of four"
+#endif
+
+
+/** @brief Get the block containing @p node */
+static struct avl_block *avl_block_of(const struct avl *node)
+{
+    return (struct avl_block *)((char *)node - offsetof(struct avl_block, avl));
+}
+
+
+/** @brief Allocate an empty, zeroed block on a cache line boundary
+ *  @returns The block, or NULL
+ */
+static struct avl_block *avl_block_new(void)
+{
+    struct avl_block *b;
+    size_t size = (sizeof *b + 63) & ~(size_t)63;
+    unsigned i;
+
+    b = aligned_alloc(64, size);
+    if (b) {
+        memset(b, 0, sizeof *b);
+        for (i = 0; i < AVL_BLOCK_KEYS; i++) {
+            b->key[i] = LLONG_MAX;
+        }
+    }
+    return b;
+}
+
+
+/** @brief Count the keys of @p b that are less than @p key, which is also the
+ *      slot @p key belongs in. The padding never counts
+ */
+static unsigned avl_block_rank(const struct avl_block *b, long long key)
+{
+#if defined(__GNUC__) && defined(__AVX2__)
+    __m256i x = _mm256_set1_epi64x(key), lt;
+    unsigned i, mask = 0;
+
+    for (i = 0; i < AVL_BLOCK_KEYS; i += 4) {
+        lt = _mm256_cmpgt_epi64(x, _mm256_loadu_si256((const __m256i *)(b->key + i)));
+        mask |= (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(lt)) << i;
+    }
+    return (unsigned)__builtin_popcount(mask);
+#elif defined(__GNUC__) && defined(__SSE4_2__) && defined(__x86_64__)
+    __m128i x = _mm_set1_epi64x(key), sum = _mm_setzero_si128();
+    unsigned i;
+
+    /* Each lane of a comparison is -1 where the key is smaller */
+    for (i = 0; i < AVL_BLOCK_KEYS; i += 2) {
+        sum = _mm_add_epi64(sum, _mm_cmpgt_epi64(x, _mm_loadu_si128((const __m128i *)(b->key + i))));
+    }
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    return (unsigned)-_mm_cvtsi128_si64(sum);
+#else
+    unsigned i, res = 0;
+
+    for (i = 0; i < AVL_BLOCK_KEYS; i++) {
+        res += b->key[i] < key;
+    }
+    return res;
+#endif
+}
+
+
+/** @brief Open slot @p i of @p b, which must not be full, for a new key */
+static void avl_block_open(struct avl_block *b, unsigned i, long long key, void *value)
+{
+    memmove(b->key + i + 1, b->key + i, (b->count - i) * sizeof *b->key);
+    memmove(b->value + i + 1, b->value + i, (b->count - i) * sizeof *b->value);
+    b->key[i] = key;
+    b->value[i] = value;
+    b->count++;
+}
+
+
+/** @brief Close slot @p i of @p b, padding the end again */
+static void avl_block_close(struct avl_block *b, unsigned i)
+{
+    b->count--;
+    memmove(b->key + i, b->key + i + 1, (b->count - i) * sizeof *b->key);
+    memmove(b->value + i, b->value + i + 1, (b->count - i) * sizeof *b->value);
+    b->key[b->count] = LLONG_MAX;
+}
+
+
+/** @brief Move every key of @p from onto the end of @p to, which must have
+ *      room for them and precede @p from in order
+ */
+static void avl_block_append(struct avl_block *to, struct avl_block *from)
+{
+    unsigned i;
+
+    memcpy(to->key + to->count, from->key, from->count * sizeof *to->key);
+    memcpy(to->value + to->count, from->value, from->count * sizeof *to->value);
+    to->count += from->count;
+    for (i = 0; i < from->count; i++) {
+        from->key[i] = LLONG_MAX;
+    }
+    from->count = 0;
+}
+
+
+/** @brief Order blocks by their first keys. Their ranges never overlap */
+static int avl_block_cmp(const struct avl *n1, const struct avl *n2)
+{
+    long long k1 = avl_block_of(n1)->key[0], k2 = avl_block_of(n2)->key[0];
+
+    return (k1 > k2) - (k1 < k2);
+}
+
+
+/** @brief Descend toward @p key, recording the path
+ *  @param root
+ *      Tree root
+ *  @param key
+ *      Key
+ *  @param path
+ *      Initialized path. On return it leads to the parent of the result if
+ *      that covers @p key, or else to the empty slot where @p key fell out
+ *  @returns The block whose range covers @p key, or NULL
+ */
+static struct avl_block *avl_blocks_find(struct avl *root, long long key, struct avl_path *path)
+{
+    struct avl_block *b;
+    unsigned dir;
+
+    while (root) {
+        b = avl_block_of(root);
+        if (key < b->key[0]) {
+            dir = 0;
+        } else if (key > b->key[b->count - 1]) {
+            dir = 1;
+        } else {
+            return b;
+        }
+        if (path) {
+            avl_path_push(path, root, dir);
+        }
+        root = AVL_CHILD(root, dir);
+    }
+    return NULL;
+}
+
+
+void avl_blocks_init(struct avl_blocks *tree)
+{
+    tree->root = NULL;
+    tree->count = 0;
+    tree->blocks = 0;
+}
+
+
+/** @brief Free one block, for avl_blocks_destroy */
+static int avl_blocks_free(struct avl *node, void *data)
+{
+    (void)data;
+    free(avl_block_of(node));
+    return 0;
+}
+
+
+void avl_blocks_destroy(struct avl_blocks *tree)
+{
+    /* A postorder walk is done with each node before visiting it */
+    avl_foreach(tree->root, AVL_POSTORDER, avl_blocks_free, NULL);
+    avl_blocks_init(tree);
+}
+
+
+int avl_blocks_insert(struct avl_blocks   *tree,  long long key, void *value,
+                      avl_blocks_joinfn_t *joinfn)
+{
+    struct avl_path path;
+    struct avl_block *b, *fresh;
+    struct avl *node;
+    unsigned rank, half = AVL_BLOCK_KEYS / 2;
+
+    avl_path_init(&path, NULL);
+    b = avl_blocks_find(tree->root, key, &path);
+    if (!b && path.len) {
+        /* The key falls in the gap next to the last block visited. Taking it
+        back off the path leaves the path to its parent */
+        b = avl_block_of(path.node[--path.len]);
+    }
+    if (b) {
+        rank = avl_block_rank(b, key);
+        if (rank < b->count && b->key[rank] == key) {
+            if (joinfn) {
+                joinfn(&b->value[rank], value, key);
+            }
+            return 1;
+        }
+        if (b->count < AVL_BLOCK_KEYS) {
+            avl_block_open(b, rank, key, value);
+            tree->count++;
+            return 0;
+        }
+    }
+    fresh = avl_block_new();
+    if (!fresh) {
+        return -1;
+    }
+    if (b) {
+        /* Split the upper half off into a block linked in as the successor */
+        memcpy(fresh->key, b->key + half, half * sizeof *b->key);
+        memcpy(fresh->value, b->value + half, half * sizeof *b->value);
+        fresh->count = half;
+        b->count = half;
+        for (rank = half; rank < AVL_BLOCK_KEYS; rank++) {
+            b->key[rank] = LLONG_MAX;
+        }
+        if (key < fresh->key[0]) {
+            avl_block_open(b, avl_block_rank(b, key), key, value);
+        } else {
+            avl_block_open(fresh, avl_block_rank(fresh, key), key, value);
+        }
+        avl_path_push(&path, &b->avl, 1);
+        for (node = AVL_CHILD(&b->avl, 1); node; node = AVL_CHILD(node, 0)) {
+            avl_path_push(&path, node, 0);
+        }
+    } else {
+        avl_block_open(fresh, 0, key, value);
+    }
+    avl_insert_at(&tree->root, &path, &fresh->avl);
+    tree->count++;
+    tree->blocks++;
+    return 0;
+}
+
+
+/** @brief Merge @p from into @p to, its predecessor, and free it. The block
+ *      is unlinked by its first key, so this must come before the move
+ */
+static void avl_blocks_merge(struct avl_blocks *tree, struct avl_block *to, struct avl_block *from)
+{
+    avl_delete(&tree->root, &from->avl, avl_block_cmp, NULL);
+    avl_block_append(to, from);
+    free(from);
+    tree->blocks--;
+}
+
+
+int avl_blocks_delete(struct avl_blocks *tree, long long key, void **value)
+{
+    struct avl_path path;
+    struct avl_block *b, *next = NULL, *prev = NULL;
+    struct avl *node;
+    unsigned rank, i;
+
+    avl_path_init(&path, NULL);
+    b = avl_blocks_find(tree->root, key, &path);
+    if (!b) {
+        return 0;
+    }
+    rank = avl_block_rank(b, key);
+    if (b->key[rank] != key) {
+        return 0;
+    }
+    if (value) {
+        *value = b->value[rank];
+    }
+    tree->count--;
+    if (b->count == 1) {
+        avl_delete_at(&tree->root, &path, &b->avl);
+        free(b);
+        tree->blocks--;
+        return 1;
+    }
+    avl_block_close(b, rank);
+    if (b->count >= AVL_BLOCK_KEYS / 4) {
+        return 1;
+    }
+    /* Find the neighbors: the extremes of the subtrees, or else the nearest
+    ancestors the path turned away from */
+    if ((node = AVL_CHILD(&b->avl, 1))) {
+        while (AVL_CHILD(node, 0)) {
+            node = AVL_CHILD(node, 0);
+        }
+        next = avl_block_of(node);
+    }
+    if ((node = AVL_CHILD(&b->avl, 0))) {
+        while (AVL_CHILD(node, 1)) {
+            node = AVL_CHILD(node, 1);
+        }
+        prev = avl_block_of(node);
+    }
+    for (i = path.len; i-- > 0 && (!next || !prev); ) {
+        if (!next && path.dir[i] == 0) {
+            next = avl_block_of(path.node[i]);
+        } else if (!prev && path.dir[i] == 1) {
+            prev = avl_block_of(path.node[i]);
+        }
+    }
+    if (next && b->count + next->count <= AVL_BLOCK_KEYS) {
+        avl_blocks_merge(tree, b, next);
+    } else if (prev && prev->count + b->count <= AVL_BLOCK_KEYS) {
+        avl_blocks_merge(tree, prev, b);
+    }
+    return 1;
+}
+
+
+int avl_blocks_lookup(const struct avl_blocks *tree, long long key, void **value)
+{
+    struct avl_block *b;
+    unsigned rank;
+
+    b = avl_blocks_find(tree->root, key, NULL);
+    if (!b) {
+        return 0;
+    }
+    rank = avl_block_rank(b, key);
+    if (b->key[rank] != key) {
+        return 0;
+    }
+    if (value) {
+        *value = b->value[rank];
+    }
+    return 1;
+}
+
+
+int avl_blocks_foreach(const struct avl_blocks *tree, avl_blocks_iterfn_t *fn, void *data)
+{
+    struct avl_cursor cur;
+    struct avl_block *b;
+    struct avl *node;
+    unsigned i;
+    int res;
+
+    for (node = avl_cursor_first(&cur, tree->root); node; node = avl_cursor_next(&cur)) {
+        b = avl_block_of(node);
+        for (i = 0; i < b->count; i++) {
+            res = fn(b->key[i], b->value[i], data);
+            if (res) {
+                return res;
+            }
+        }
+    }
+    return 0;
+}
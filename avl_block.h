@@ -0,0 +1,131 @@
+#pragma once
+
+#ifndef AVL_BLOCK_H
+#define AVL_BLOCK_H
+
+#include <stddef.h>
+#include "avl.h"
+
+
+#ifndef AVL_BLOCK_KEYS
+/** @brief Capacity of each block. The keys of a full block span two cache
+ *      lines, and a search compares against all of them at once. This must be
+ *      a multiple of four
+ */
+# define AVL_BLOCK_KEYS 16
+#endif
+
+
+/** @brief A node of a blocked tree: a sorted run of integer keys with their
+ *      values. Unused key slots hold LLONG_MAX, so that a SIMD rank over the
+ *      whole array needs no mask
+ */
+struct avl_block {
+    struct avl  avl;                    /* Tree links */
+    unsigned    count;                  /* Number of keys, never zero in a tree */
+    long long   key[AVL_BLOCK_KEYS];    /* Keys in increasing order */
+    void       *value[AVL_BLOCK_KEYS];  /* Value of each key */
+};
+
+
+/** @brief An ordered map from integer keys to pointers, stored as an AVL tree
+ *      of blocks. Every key in a block's left subtree is less than its first
+ *      key, and every key in its right subtree greater than its last. A
+ *      search takes two comparisons per block to steer and one SIMD rank in
+ *      the block it ends at, and the tree is about AVL_BLOCK_KEYS / 2 to
+ *      AVL_BLOCK_KEYS times shorter than one of single keys. Blocks split when
+ *      an insertion overflows them and merge with a neighbor once they fall
+ *      below a quarter full. New and removed blocks are linked and unlinked
+ *      with avl_insert_at and avl_delete_at, so the balancing is that of every
+ *      other tree
+ */
+struct avl_blocks {
+    struct avl *root;       /* Tree of struct avl_block */
+    size_t      count;      /* Number of keys */
+    size_t      blocks;     /* Number of blocks */
+};
+
+
+/** @brief Merge a duplicate into the value of an existing key, as avl_joinfn_t
+ *      does for nodes
+ *  @param value
+ *      The value of the key already present, which may be overwritten
+ *  @param join
+ *      The value being inserted
+ *  @param key
+ *      The key
+ */
+typedef void avl_blocks_joinfn_t(void **value, void *join, long long key);
+
+
+/** @brief Visit one key of a blocked tree
+ *  @returns Nonzero to stop iterating
+ */
+typedef int avl_blocks_iterfn_t(long long key, void *value, void *data);
+
+
+/** @brief Initialize an empty blocked tree. This does not allocate */
+void avl_blocks_init(struct avl_blocks *tree);
+
+
+/** @brief Free every block. The values are not touched, so release them with
+ *      avl_blocks_foreach first if they are owned by the tree
+ */
+void avl_blocks_destroy(struct avl_blocks *tree);
+
+
+/** @brief Insert @p key with @p value
+ *  @param tree
+ *      Tree
+ *  @param key
+ *      Key to insert
+ *  @param value
+ *      Its value
+ *  @param joinfn
+ *      Called if @p key is already present. This may be NULL, in which case
+ *      the existing value is kept
+ *  @returns Zero if @p key was inserted, 1 if it was already present, or -1
+ *      if a block needed splitting and could not be allocated, in which case
+ *      the tree is unchanged
+ */
+int avl_blocks_insert(struct avl_blocks   *tree,  long long key, void *value,
+                      avl_blocks_joinfn_t *joinfn);
+
+
+/** @brief Remove @p key
+ *  @param tree
+ *      Tree
+ *  @param key
+ *      Key to remove
+ *  @param value
+ *      Receives the value of the removed key. This may be NULL
+ *  @returns Nonzero if @p key was found and removed
+ */
+int avl_blocks_delete(struct avl_blocks *tree, long long key, void **value);
+
+
+/** @brief Find @p key
+ *  @param tree
+ *      Tree
+ *  @param key
+ *      Key to look up
+ *  @param value
+ *      Receives its value if it is found. This may be NULL
+ *  @returns Nonzero if @p key is present
+ */
+int avl_blocks_lookup(const struct avl_blocks *tree, long long key, void **value);
+
+
+/** @brief Visit every key in increasing order
+ *  @param tree
+ *      Tree, which must not be modified by @p fn
+ *  @param fn
+ *      Callback
+ *  @param data
+ *      Callback data
+ *  @returns The callback's return value if it was nonzero, otherwise zero
+ */
+int avl_blocks_foreach(const struct avl_blocks *tree, avl_blocks_iterfn_t *fn, void *data);
+
+
+#endif /* AVL_BLOCK_H */
@@ -0,0 +1,893 @@
+#include <sched.h>
+#include <stddef.h>
+#include "avl_conc.h"
+
+
+/* Version bits. A node's version is exactly AVL_CONC_UNLINKED once the node is
+no longer in the tree */
+#define AVL_CONC_UNLINKED   1ul
+#define AVL_CONC_SHRINKING  2ul
+#define AVL_CONC_STEP       4ul
+
+/* Results of avl_conc_condition that are not a corrected height */
+#define AVL_CONC_UNLINK     (-1)
+#define AVL_CONC_REBALANCE  (-2)
+#define AVL_CONC_NOTHING    (-3)
+
+/* Results of the recursive steps */
+#define AVL_CONC_DONE       0
+#define AVL_CONC_ABSENT     1
+#define AVL_CONC_RETRY      2
+
+/* Busy-wait iterations before yielding */
+#define AVL_CONC_SPINS      100
+
+/* Damaged nodes an operation remembers while it repairs deeper ones */
+#define AVL_CONC_PENDING    8
+
+
+/** @brief State of one operation */
+struct avl_conc_op {
+    struct avl_conc         *tree;      /* Tree */
+    struct avl_epoch_thread *thread;    /* Retires unlinked nodes */
+    struct avl_cnode        *pending[AVL_CONC_PENDING]; /* Ancestors whose
+                                           repair waits for a deeper one */
+    unsigned                 npending;  /* Number of nodes in @p pending */
+    int                      overflow;  /* An ancestor did not fit in
+                                           @p pending */
+};
+
+
+static int avl_conc_height(struct avl_cnode *node)
+{
+    return node ? atomic_load(&node->height) : 0;
+}
+
+
+static int avl_conc_present(struct avl_cnode *node)
+{
+    return atomic_load(&node->present);
+}
+
+
+static struct avl_cnode *avl_conc_child(struct avl_cnode *node, unsigned dir)
+{
+    return atomic_load(&node->child[dir]);
+}
+
+
+static void avl_conc_set_child(struct avl_cnode *node, unsigned dir, struct avl_cnode *child)
+{
+    atomic_store(&node->child[dir], child);
+    if (child) {
+        atomic_store(&child->parent, node);
+    }
+}
+
+
+static void avl_conc_lock(struct avl_cnode *node)
+{
+    unsigned spins = 0;
+
+    while (atomic_exchange_explicit(&node->lock, 1, memory_order_acquire)) {
+        while (atomic_load_explicit(&node->lock, memory_order_relaxed)) {
+            if (++spins > AVL_CONC_SPINS) {
+                sched_yield();
+            }
+        }
+    }
+}
+
+
+static void avl_conc_unlock(struct avl_cnode *node)
+{
+    atomic_store_explicit(&node->lock, 0, memory_order_release);
+}
+
+
+/** @brief Wait until a rotation that was shrinking @p node, whose version was
+ *      @p version, has finished. The rotation holds the node's lock, so if
+ *      spinning is not enough, taking the lock is
+ */
+static void avl_conc_wait(struct avl_cnode *node, unsigned long version)
+{
+    unsigned spins;
+
+    if (!(version & AVL_CONC_SHRINKING)) {
+        return;
+    }
+    for (spins = 0; spins < AVL_CONC_SPINS; spins++) {
+        if (atomic_load(&node->version) != version) {
+            return;
+        }
+    }
+    avl_conc_lock(node);
+    avl_conc_unlock(node);
+}
+
+
+/** @brief Begin a rotation that shrinks the subtree at @p node
+ *  @returns The version to pass to avl_conc_end_shrink
+ */
+static unsigned long avl_conc_begin_shrink(struct avl_cnode *node)
+{
+    unsigned long version;
+
+    version = atomic_load(&node->version);
+    atomic_store(&node->version, version | AVL_CONC_SHRINKING);
+    return version;
+}
+
+
+static void avl_conc_end_shrink(struct avl_cnode *node, unsigned long version)
+{
+    atomic_store(&node->version, version + AVL_CONC_STEP);
+}
+
+
+/** @brief Determine what @p node needs, from a snapshot of its children
+ *  @returns AVL_CONC_UNLINK for a routing node with a missing child,
+ *      AVL_CONC_REBALANCE if the children's heights differ by more than one,
+ *      its correct height if only that is stale, or AVL_CONC_NOTHING
+ */
+static int avl_conc_condition(struct avl_cnode *node)
+{
+    struct avl_cnode *left, *right;
+    int hl, hr, height;
+
+    left = avl_conc_child(node, 0);
+    right = avl_conc_child(node, 1);
+    if ((!left || !right) && !avl_conc_present(node)) {
+        return AVL_CONC_UNLINK;
+    }
+    hl = avl_conc_height(left);
+    hr = avl_conc_height(right);
+    if (hl - hr < -1 || hl - hr > 1) {
+        return AVL_CONC_REBALANCE;
+    }
+    height = 1 + (hl > hr ? hl : hr);
+    return height != atomic_load(&node->height) ? height : AVL_CONC_NOTHING;
+}
+
+
+/** @brief Repair the height of @p node, which must be locked
+ *  @returns The next node needing repair: @p node itself if it needs more than
+ *      a height change, its parent if its height changed, or NULL
+ */
+static struct avl_cnode *avl_conc_fix_height_nl(struct avl_cnode *node)
+{
+    int cond;
+
+    cond = avl_conc_condition(node);
+    switch (cond) {
+    case AVL_CONC_UNLINK:
+    case AVL_CONC_REBALANCE:
+        return node;
+    case AVL_CONC_NOTHING:
+        return NULL;
+    default:
+        atomic_store(&node->height, cond);
+        return atomic_load(&node->parent);
+    }
+}
+
+
+/** @brief Splice out @p node, which has at most one child, and retire it. Both
+ *      it and @p parent must be locked
+ *  @returns Nonzero on success, or zero if the nodes no longer allow it
+ */
+static int avl_conc_unlink_nl(struct avl_conc_op *op,
+                              struct avl_cnode   *parent,
+                              struct avl_cnode   *node)
+{
+    struct avl_cnode *left, *right;
+    unsigned dir;
+
+    if (avl_conc_child(parent, 0) == node) {
+        dir = 0;
+    } else if (avl_conc_child(parent, 1) == node) {
+        dir = 1;
+    } else {
+        return 0;
+    }
+    left = avl_conc_child(node, 0);
+    right = avl_conc_child(node, 1);
+    if (left && right) {
+        return 0;
+    }
+    avl_conc_set_child(parent, dir, left ? left : right);
+    atomic_store(&node->version, AVL_CONC_UNLINKED);
+    atomic_store(&node->present, 0);
+    avl_epoch_retire(op->thread, node);
+    return 1;
+}
+
+
+/** @brief Point @p parent's link to @p node at @p with instead. @p parent must
+ *      be locked
+ */
+static void avl_conc_replace(struct avl_cnode *parent,
+                             struct avl_cnode *node,
+                             struct avl_cnode *with)
+{
+    avl_conc_set_child(parent, avl_conc_child(parent, 1) == node, with);
+}
+
+
+/** @brief Remember that @p parent, which a rotation changed, must be repaired
+ *      once the deeper @p damaged is. If there is no room left for it,
+ *      avl_conc_repair finishes by checking every node up to the root instead
+ *  @returns @p damaged
+ */
+static struct avl_cnode *avl_conc_defer(struct avl_conc_op *op,
+                                        struct avl_cnode   *parent,
+                                        struct avl_cnode   *damaged)
+{
+    if (op->npending < AVL_CONC_PENDING) {
+        op->pending[op->npending++] = parent;
+    } else {
+        op->overflow = 1;
+    }
+    return damaged;
+}
+
+
+/** @brief Rotate @p heavy, the child of @p node in direction @p dir, into its
+ *      place. @p parent, @p node and @p heavy must be locked. The heights are
+ *      snapshots taken under those locks
+ *  @param parent
+ *      Parent of @p node
+ *  @param node
+ *      Node to rotate down
+ *  @param dir
+ *      Side of the taller child, @p heavy
+ *  @param heavy
+ *      The taller child
+ *  @param hlight
+ *      Height of the other child of @p node
+ *  @param houter
+ *      Height of the child of @p heavy in direction @p dir
+ *  @param inner
+ *      The child of @p heavy in the other direction, which moves to @p node
+ *  @param hinner
+ *      Its height
+ *  @returns The next node needing repair, or NULL
+ */
+static struct avl_cnode *avl_conc_rotate_nl(struct avl_conc_op *op,
+                                            struct avl_cnode   *parent,
+                                            struct avl_cnode   *node,
+                                            unsigned            dir,
+                                            struct avl_cnode   *heavy,
+                                            int                 hlight,
+                                            int                 houter,
+                                            struct avl_cnode   *inner,
+                                            int                 hinner)
+{
+    unsigned long version;
+    int hnode, bal;
+
+    version = avl_conc_begin_shrink(node);
+    avl_conc_set_child(node, dir, inner);
+    avl_conc_set_child(heavy, !dir, node);
+    avl_conc_replace(parent, node, heavy);
+    hnode = 1 + (hinner > hlight ? hinner : hlight);
+    atomic_store(&node->height, hnode);
+    atomic_store(&heavy->height, 1 + (houter > hnode ? houter : hnode));
+    avl_conc_end_shrink(node, version);
+    /* Fix whatever the locks held allow, deepest first. If something deeper
+    needs another step, @p parent's height waits for it */
+    bal = hinner - hlight;
+    if (bal < -1 || bal > 1) {
+        return avl_conc_defer(op, parent, node);
+    }
+    if ((!inner || !hlight) && !avl_conc_present(node)) {
+        return avl_conc_defer(op, parent, node);
+    }
+    bal = houter - hnode;
+    if (bal < -1 || bal > 1) {
+        return avl_conc_defer(op, parent, heavy);
+    }
+    if (!houter && !avl_conc_present(heavy)) {
+        return avl_conc_defer(op, parent, heavy);
+    }
+    return avl_conc_fix_height_nl(parent);
+}
+
+
+/** @brief Double rotation: rotate @p inner, the child of @p heavy opposite
+ *      @p dir, into the place of @p node. @p parent, @p node, @p heavy and
+ *      @p inner must be locked
+ *  @param hinout
+ *      Height of the child of @p inner in direction @p dir
+ *  @see avl_conc_rotate_nl for the other parameters
+ *  @returns The next node needing repair, or NULL
+ */
+static struct avl_cnode *avl_conc_rotate_double_nl(struct avl_conc_op *op,
+                                                   struct avl_cnode   *parent,
+                                                   struct avl_cnode   *node,
+                                                   unsigned            dir,
+                                                   struct avl_cnode   *heavy,
+                                                   int                 hlight,
+                                                   int                 houter,
+                                                   struct avl_cnode   *inner,
+                                                   int                 hinout)
+{
+    struct avl_cnode *inout, *inin;
+    unsigned long vnode, vheavy;
+    int hinin, hnode, hheavy, bal;
+
+    inout = avl_conc_child(inner, dir);
+    inin = avl_conc_child(inner, !dir);
+    hinin = avl_conc_height(inin);
+    vnode = avl_conc_begin_shrink(node);
+    vheavy = avl_conc_begin_shrink(heavy);
+    avl_conc_set_child(node, dir, inin);
+    avl_conc_set_child(heavy, !dir, inout);
+    avl_conc_set_child(inner, dir, heavy);
+    avl_conc_set_child(inner, !dir, node);
+    avl_conc_replace(parent, node, inner);
+    hnode = 1 + (hinin > hlight ? hinin : hlight);
+    hheavy = 1 + (houter > hinout ? houter : hinout);
+    atomic_store(&node->height, hnode);
+    atomic_store(&heavy->height, hheavy);
+    atomic_store(&inner->height, 1 + (hheavy > hnode ? hheavy : hnode));
+    avl_conc_end_shrink(node, vnode);
+    avl_conc_end_shrink(heavy, vheavy);
+    bal = hinin - hlight;
+    if (bal < -1 || bal > 1) {
+        return avl_conc_defer(op, parent, node);
+    }
+    if ((!inin || !hlight) && !avl_conc_present(node)) {
+        return avl_conc_defer(op, parent, node);
+    }
+    if ((!houter || !hinout) && !avl_conc_present(heavy)) {
+        return avl_conc_defer(op, parent, heavy);
+    }
+    bal = hheavy - hnode;
+    if (bal < -1 || bal > 1) {
+        return avl_conc_defer(op, parent, inner);
+    }
+    return avl_conc_fix_height_nl(parent);
+}
+
+
+/** @brief Rebalance @p node, whose child @p heavy in direction @p dir is too
+ *      tall. @p parent and @p node must be locked
+ *  @param hlight
+ *      Height of the other child of @p node
+ *  @returns The next node needing repair, or NULL
+ */
+static struct avl_cnode *avl_conc_rebalance_to_nl(struct avl_conc_op *op,
+                                                  struct avl_cnode   *parent,
+                                                  struct avl_cnode   *node,
+                                                  unsigned            dir,
+                                                  struct avl_cnode   *heavy,
+                                                  int                 hlight)
+{
+    struct avl_cnode *inner, *res;
+    int houter, hinner, hinout, bal;
+
+    avl_conc_lock(heavy);
+    if (atomic_load(&heavy->height) - hlight <= 1) {
+        avl_conc_unlock(heavy);
+        return node;
+    }
+    inner = avl_conc_child(heavy, !dir);
+    houter = avl_conc_height(avl_conc_child(heavy, dir));
+    hinner = avl_conc_height(inner);
+    if (houter >= hinner) {
+        res = avl_conc_rotate_nl(op, parent, node, dir, heavy, hlight, houter, inner, hinner);
+        avl_conc_unlock(heavy);
+        return res;
+    }
+    avl_conc_lock(inner);
+    /* The inner height may have changed since the snapshot */
+    hinner = atomic_load(&inner->height);
+    if (houter >= hinner) {
+        res = avl_conc_rotate_nl(op, parent, node, dir, heavy, hlight, houter, inner, hinner);
+        avl_conc_unlock(inner);
+        avl_conc_unlock(heavy);
+        return res;
+    }
+    hinout = avl_conc_height(avl_conc_child(inner, dir));
+    bal = houter - hinout;
+    if (bal >= -1 && bal <= 1) {
+        /* If @p heavy is a routing node left with one child, it is spliced
+        out next */
+        res = avl_conc_rotate_double_nl(op, parent, node, dir, heavy, hlight, houter, inner, hinout);
+        avl_conc_unlock(inner);
+        avl_conc_unlock(heavy);
+        return res;
+    }
+    avl_conc_unlock(inner);
+    /* A double rotation would leave @p heavy damaged, so rotate it on its own
+    first. @p node is rebalanced later if it still needs it */
+    res = avl_conc_rebalance_to_nl(op, node, heavy, !dir, inner, houter);
+    avl_conc_unlock(heavy);
+    return res;
+}
+
+
+/** @brief Unlink or rebalance @p node, or fix its height. It and @p parent
+ *      must be locked
+ *  @returns The next node needing repair, or NULL
+ */
+static struct avl_cnode *avl_conc_rebalance_nl(struct avl_conc_op *op,
+                                               struct avl_cnode   *parent,
+                                               struct avl_cnode   *node)
+{
+    struct avl_cnode *left, *right;
+    int hl, hr, height;
+
+    left = avl_conc_child(node, 0);
+    right = avl_conc_child(node, 1);
+    if ((!left || !right) && !avl_conc_present(node)) {
+        return avl_conc_unlink_nl(op, parent, node) ? avl_conc_fix_height_nl(parent) : node;
+    }
+    hl = avl_conc_height(left);
+    hr = avl_conc_height(right);
+    if (hl - hr > 1) {
+        return avl_conc_rebalance_to_nl(op, parent, node, 0, left, hr);
+    }
+    if (hr - hl > 1) {
+        return avl_conc_rebalance_to_nl(op, parent, node, 1, right, hl);
+    }
+    height = 1 + (hl > hr ? hl : hr);
+    if (height != atomic_load(&node->height)) {
+        atomic_store(&node->height, height);
+        return avl_conc_fix_height_nl(parent);
+    }
+    return NULL;
+}
+
+
+/** @brief Repair heights, balance and routing nodes from @p node up, until
+ *      nothing is left to fix, then do the same for each deferred ancestor.
+ *      If an ancestor could not be deferred, the last node repaired and every
+ *      node above it are checked as well. The holder's height is never
+ *      repaired
+ */
+static void avl_conc_repair(struct avl_conc_op *op, struct avl_cnode *node)
+{
+    struct avl_cnode *parent, *next, *last = NULL;
+    int cond;
+
+    for (;;) {
+        if (node) {
+            last = node;
+        }
+        if (!node || !atomic_load(&node->parent)
+         || atomic_load(&node->version) & AVL_CONC_UNLINKED) {
+            cond = AVL_CONC_NOTHING;
+        } else {
+            cond = avl_conc_condition(node);
+        }
+        if (cond == AVL_CONC_NOTHING) {
+            if (op->npending) {
+                node = op->pending[--op->npending];
+                continue;
+            }
+            /* An unlinked node keeps its parent pointer, so the climb always
+            reaches the holder */
+            node = op->overflow && last ? atomic_load(&last->parent) : NULL;
+            if (!node) {
+                op->overflow = 0;
+                return;
+            }
+            continue;
+        }
+        if (cond != AVL_CONC_UNLINK && cond != AVL_CONC_REBALANCE) {
+            avl_conc_lock(node);
+            next = avl_conc_fix_height_nl(node);
+            avl_conc_unlock(node);
+            node = next;
+            continue;
+        }
+        parent = atomic_load(&node->parent);
+        avl_conc_lock(parent);
+        if (!(atomic_load(&parent->version) & AVL_CONC_UNLINKED)
+         && atomic_load(&node->parent) == parent) {
+            /* An unlinked node keeps its parent pointer */
+            avl_conc_lock(node);
+            if (atomic_load(&node->version) & AVL_CONC_UNLINKED) {
+                next = NULL;
+            } else {
+                next = avl_conc_rebalance_nl(op, parent, node);
+            }
+            avl_conc_unlock(node);
+            node = next;
+        }
+        avl_conc_unlock(parent);
+    }
+}
+
+
+/** @brief Search below @p node for @p query
+ *  @param tree
+ *      Tree
+ *  @param node
+ *      Node already known to bound the query
+ *  @param dir
+ *      Direction to descend from @p node
+ *  @param version
+ *      Version of @p node when it was reached. The search fails if it changes
+ *  @param query
+ *      Test node
+ *  @param found
+ *      Set to the node found, or NULL
+ *  @returns AVL_CONC_DONE, or AVL_CONC_RETRY if the caller must retry its step
+ */
+static int avl_conc_get(struct avl_conc         *tree,
+                        struct avl_cnode        *node,
+                        unsigned                 dir,
+                        unsigned long            version,
+                        const struct avl_cnode  *query,
+                        struct avl_cnode       **found)
+{
+    struct avl_cnode *child;
+    unsigned long cver;
+    int cmp;
+
+    for (;;) {
+        child = avl_conc_child(node, dir);
+        if (atomic_load(&node->version) != version) {
+            return AVL_CONC_RETRY;
+        }
+        if (!child) {
+            *found = NULL;
+            return AVL_CONC_DONE;
+        }
+        cmp = tree->cmpfn(query, child);
+        if (!cmp) {
+            *found = avl_conc_present(child) ? child : NULL;
+            return AVL_CONC_DONE;
+        }
+        cver = atomic_load(&child->version);
+        if (cver & (AVL_CONC_SHRINKING | AVL_CONC_UNLINKED)) {
+            avl_conc_wait(child, cver);
+        } else if (child == avl_conc_child(node, dir)) {
+            if (atomic_load(&node->version) != version) {
+                return AVL_CONC_RETRY;
+            }
+            if (avl_conc_get(tree, child, cmp > 0, cver, query, found) == AVL_CONC_DONE) {
+                return AVL_CONC_DONE;
+            }
+        }
+    }
+}
+
+
+struct avl_cnode *avl_conc_lookup(struct avl_conc *tree, const struct avl_cnode *query)
+{
+    struct avl_cnode *found;
+
+    /* The holder's version never changes, so this cannot fail */
+    avl_conc_get(tree, &tree->holder, 1, atomic_load(&tree->holder.version), query, &found);
+    return found;
+}
+
+
+/** @brief Prepare @p node to be linked below @p parent */
+static void avl_conc_init_node(struct avl_cnode *node, struct avl_cnode *parent, int locked)
+{
+    atomic_init(&node->child[0], NULL);
+    atomic_init(&node->child[1], NULL);
+    atomic_init(&node->parent, parent);
+    atomic_init(&node->version, 0);
+    atomic_init(&node->height, 1);
+    atomic_init(&node->present, 1);
+    atomic_init(&node->lock, locked);
+}
+
+
+/** @brief Insert @p node in place of the routing node @p old, which compares
+ *      equal to it
+ *  @returns AVL_CONC_DONE, AVL_CONC_ABSENT if @p old is present after all, or
+ *      AVL_CONC_RETRY
+ */
+static int avl_conc_revive(struct avl_conc_op *op,
+                           struct avl_cnode   *parent,
+                           struct avl_cnode   *old,
+                           struct avl_cnode   *node)
+{
+    int res = AVL_CONC_RETRY;
+
+    if (avl_conc_present(old)) {
+        return AVL_CONC_ABSENT;
+    }
+    avl_conc_lock(parent);
+    if (!(atomic_load(&parent->version) & AVL_CONC_UNLINKED)
+     && atomic_load(&old->parent) == parent) {
+        avl_conc_lock(old);
+        if (avl_conc_present(old)) {
+            res = AVL_CONC_ABSENT;
+        } else if (atomic_load(&old->version) != AVL_CONC_UNLINKED) {
+            /* The new node is locked until its links are all in place */
+            avl_conc_init_node(node, parent, 1);
+            atomic_store(&node->height, atomic_load(&old->height));
+            avl_conc_set_child(node, 0, avl_conc_child(old, 0));
+            avl_conc_set_child(node, 1, avl_conc_child(old, 1));
+            avl_conc_replace(parent, old, node);
+            atomic_store(&old->version, AVL_CONC_UNLINKED);
+            avl_conc_unlock(node);
+            avl_epoch_retire(op->thread, old);
+            res = AVL_CONC_DONE;
+        }
+        avl_conc_unlock(old);
+    }
+    avl_conc_unlock(parent);
+    return res;
+}
+
+
+/** @brief Insert @p node into the subtree at @p cur, the child of @p parent
+ *  @param version
+ *      Version of @p cur when it was reached
+ *  @returns AVL_CONC_DONE, AVL_CONC_ABSENT if an equal node is present, or
+ *      AVL_CONC_RETRY
+ */
+static int avl_conc_put(struct avl_conc_op *op,
+                        struct avl_cnode   *parent,
+                        struct avl_cnode   *cur,
+                        unsigned long       version,
+                        struct avl_cnode   *node)
+{
+    struct avl_cnode *child, *damaged;
+    unsigned long cver;
+    unsigned dir;
+    int cmp, res;
+
+    cmp = op->tree->cmpfn(node, cur);
+    if (!cmp) {
+        return avl_conc_revive(op, parent, cur, node);
+    }
+    dir = cmp > 0;
+    for (;;) {
+        child = avl_conc_child(cur, dir);
+        if (atomic_load(&cur->version) != version) {
+            return AVL_CONC_RETRY;
+        }
+        if (!child) {
+            avl_conc_lock(cur);
+            if (atomic_load(&cur->version) != version) {
+                avl_conc_unlock(cur);
+                return AVL_CONC_RETRY;
+            }
+            if (avl_conc_child(cur, dir)) {
+                avl_conc_unlock(cur);
+                continue;
+            }
+            avl_conc_init_node(node, cur, 0);
+            atomic_store(&cur->child[dir], node);
+            damaged = avl_conc_fix_height_nl(cur);
+            avl_conc_unlock(cur);
+            avl_conc_repair(op, damaged);
+            return AVL_CONC_DONE;
+        }
+        cver = atomic_load(&child->version);
+        if (cver & (AVL_CONC_SHRINKING | AVL_CONC_UNLINKED)) {
+            avl_conc_wait(child, cver);
+        } else if (child == avl_conc_child(cur, dir)) {
+            if (atomic_load(&cur->version) != version) {
+                return AVL_CONC_RETRY;
+            }
+            res = avl_conc_put(op, cur, child, cver, node);
+            if (res != AVL_CONC_RETRY) {
+                return res;
+            }
+        }
+    }
+}
+
+
+/** @brief Drive a recursive step from the holder, retrying until it succeeds
+ *  @param step
+ *      avl_conc_put or avl_conc_del, with @p arg as its last argument
+ *  @param empty
+ *      What to do when the tree is empty: link @p arg as the root if nonzero,
+ *      or report it absent
+ */
+static int avl_conc_top(struct avl_conc_op *op,
+                        int               (*step)(struct avl_conc_op *, struct avl_cnode *,
+                                                  struct avl_cnode *, unsigned long,
+                                                  struct avl_cnode *),
+                        struct avl_cnode   *arg,
+                        int                 empty)
+{
+    struct avl_cnode *holder = &op->tree->holder, *root;
+    unsigned long version;
+    int res;
+
+    for (;;) {
+        root = avl_conc_child(holder, 1);
+        if (!root) {
+            if (!empty) {
+                return AVL_CONC_ABSENT;
+            }
+            avl_conc_lock(holder);
+            if (!avl_conc_child(holder, 1)) {
+                avl_conc_init_node(arg, holder, 0);
+                atomic_store(&holder->child[1], arg);
+                avl_conc_unlock(holder);
+                return AVL_CONC_DONE;
+            }
+            avl_conc_unlock(holder);
+            continue;
+        }
+        version = atomic_load(&root->version);
+        if (version & (AVL_CONC_SHRINKING | AVL_CONC_UNLINKED)) {
+            avl_conc_wait(root, version);
+        } else if (root == avl_conc_child(holder, 1)) {
+            res = step(op, holder, root, version, arg);
+            if (res != AVL_CONC_RETRY) {
+                return res;
+            }
+        }
+    }
+}
+
+
+int avl_conc_insert(struct avl_conc *tree, struct avl_epoch_thread *thread, struct avl_cnode *node)
+{
+    struct avl_conc_op op;
+    int res;
+
+    op.tree = tree;
+    op.thread = thread;
+    op.npending = 0;
+    op.overflow = 0;
+    avl_epoch_enter(thread);
+    res = avl_conc_top(&op, avl_conc_put, node, 1);
+    avl_epoch_exit(thread);
+    return res != AVL_CONC_DONE;
+}
+
+
+/** @brief Remove @p node, which was found below @p parent. A node with two
+ *      children only becomes a routing node
+ *  @returns AVL_CONC_DONE, AVL_CONC_ABSENT, or AVL_CONC_RETRY
+ */
+static int avl_conc_del_node(struct avl_conc_op *op,
+                             struct avl_cnode   *parent,
+                             struct avl_cnode   *node)
+{
+    struct avl_cnode *damaged = NULL;
+    int res = AVL_CONC_RETRY;
+
+    if (!avl_conc_present(node)) {
+        return AVL_CONC_ABSENT;
+    }
+    if (!avl_conc_child(node, 0) || !avl_conc_child(node, 1)) {
+        avl_conc_lock(parent);
+        if (!(atomic_load(&parent->version) & AVL_CONC_UNLINKED)
+         && atomic_load(&node->parent) == parent) {
+            avl_conc_lock(node);
+            if (!avl_conc_present(node)) {
+                res = AVL_CONC_ABSENT;
+            } else if (avl_conc_unlink_nl(op, parent, node)) {
+                res = AVL_CONC_DONE;
+            }
+            avl_conc_unlock(node);
+            if (res == AVL_CONC_DONE) {
+                damaged = avl_conc_fix_height_nl(parent);
+            }
+        }
+        avl_conc_unlock(parent);
+        avl_conc_repair(op, damaged);
+        return res;
+    }
+    avl_conc_lock(node);
+    if (atomic_load(&node->version) == AVL_CONC_UNLINKED) {
+        res = AVL_CONC_RETRY;
+    } else if (!avl_conc_present(node)) {
+        res = AVL_CONC_ABSENT;
+    } else if (avl_conc_child(node, 0) && avl_conc_child(node, 1)) {
+        atomic_store(&node->present, 0);
+        res = AVL_CONC_DONE;
+    }
+    avl_conc_unlock(node);
+    return res;
+}
+
+
+/** @brief Remove the node equal to @p query from the subtree at @p cur
+ *  @see avl_conc_put for the parameters
+ */
+static int avl_conc_del(struct avl_conc_op *op,
+                        struct avl_cnode   *parent,
+                        struct avl_cnode   *cur,
+                        unsigned long       version,
+                        struct avl_cnode   *query)
+{
+    struct avl_cnode *child;
+    unsigned long cver;
+    unsigned dir;
+    int cmp, res;
+
+    cmp = op->tree->cmpfn(query, cur);
+    if (!cmp) {
+        return avl_conc_del_node(op, parent, cur);
+    }
+    dir = cmp > 0;
+    for (;;) {
+        child = avl_conc_child(cur, dir);
+        if (atomic_load(&cur->version) != version) {
+            return AVL_CONC_RETRY;
+        }
+        if (!child) {
+            return AVL_CONC_ABSENT;
+        }
+        cver = atomic_load(&child->version);
+        if (cver & (AVL_CONC_SHRINKING | AVL_CONC_UNLINKED)) {
+            avl_conc_wait(child, cver);
+        } else if (child == avl_conc_child(cur, dir)) {
+            if (atomic_load(&cur->version) != version) {
+                return AVL_CONC_RETRY;
+            }
+            res = avl_conc_del(op, cur, child, cver, query);
+            if (res != AVL_CONC_RETRY) {
+                return res;
+            }
+        }
+    }
+}
+
+
+int avl_conc_remove(struct avl_conc *tree, struct avl_epoch_thread *thread, const struct avl_cnode *query)
+{
+    struct avl_conc_op op;
+    int res;
+
+    op.tree = tree;
+    op.thread = thread;
+    op.npending = 0;
+    op.overflow = 0;
+    avl_epoch_enter(thread);
+    /* The query is only ever compared */
+    res = avl_conc_top(&op, avl_conc_del, (struct avl_cnode *)query, 0);
+    avl_epoch_exit(thread);
+    return res != AVL_CONC_DONE;
+}
+
+
+/** @brief Free the epoch domain's retired nodes */
+static void avl_conc_free(void *ptr, void *data)
+{
+    struct avl_conc *tree = data;
+
+    tree->freefn(ptr, tree->data);
+}
+
+
+int avl_conc_init(struct avl_conc   *tree,   avl_conc_cmpfn_t *cmpfn,
+                  avl_conc_freefn_t *freefn, void             *data)
+{
+    avl_conc_init_node(&tree->holder, NULL, 0);
+    atomic_store(&tree->holder.height, 0);
+    tree->cmpfn = cmpfn;
+    tree->freefn = freefn;
+    tree->data = data;
+    return avl_epoch_init(&tree->epoch, avl_conc_free, tree);
+}
+
+
+/** @brief Free the subtree at @p node */
+static void avl_conc_free_tree(struct avl_conc *tree, struct avl_cnode *node)
+{
+    struct avl_cnode *right;
+
+    while (node) {
+        avl_conc_free_tree(tree, avl_conc_child(node, 0));
+        right = avl_conc_child(node, 1);
+        tree->freefn(node, tree->data);
+        node = right;
+    }
+}
+
+
+void avl_conc_destroy(struct avl_conc *tree)
+{
+    avl_conc_free_tree(tree, avl_conc_child(&tree->holder, 1));
+    atomic_store(&tree->holder.child[1], NULL);
+    avl_epoch_destroy(&tree->epoch);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#ifndef AVL_CONC_H
+#define AVL_CONC_H
+
+#include <stdatomic.h>
+#include "avl_epoch.h"
+
+
+/** @brief A node of a concurrent tree. Like struct avl, embed it in your own
+ *      structure. All of its fields belong to the tree
+ */
+struct avl_cnode {
+    struct avl_cnode *_Atomic child[2];     /* The child pointers */
+    struct avl_cnode *_Atomic parent;       /* The parent node */
+    atomic_ulong              version;      /* Changes whenever a rotation
+                                               shrinks this subtree */
+    atomic_int                height;       /* Height, which may lag behind
+                                               while repairs are pending */
+    atomic_int                present;      /* Zero once removed but still
+                                               routing searches */
+    atomic_int                lock;         /* Held by writers changing it */
+};
+
+
+/** @brief Compare two concurrent tree nodes, with the contract of avl_cmpfn_t.
+ *      The keys must never change while a node is in the tree, since this is
+ *      called without any lock held
+ */
+typedef int avl_conc_cmpfn_t(const struct avl_cnode *n1, const struct avl_cnode *n2);
+
+
+/** @brief Free the element holding @p node, once no thread can reach it */
+typedef void avl_conc_freefn_t(struct avl_cnode *node, void *data);
+
+
+/** @brief A concurrent AVL tree after Bronson, Casper, Chafi and Olukotun, "A
+ *      Practical Concurrent Binary Search Tree". Searches take no locks: they
+ *      descend hand over hand, validating each node's version after reading
+ *      its child, and retry a step if a rotation shrank the subtree under
+ *      them. Writers lock only the nodes they change. Rebalancing is relaxed:
+ *      heights are repaired bottom up after each change, and a removed node
+ *      with two children stays behind as a routing node until it can be
+ *      spliced out. Once the tree is quiescent it is a strict AVL tree, apart
+ *      from those routing nodes.
+ *
+ *      Every thread registers with the domain, with
+ *      avl_epoch_register(&tree->epoch, &thread). Lookups must be made between
+ *      avl_epoch_enter and avl_epoch_exit, and the nodes they find stay valid
+ *      until the exit. Removed nodes are never handed back: the tree frees
+ *      them through its free function once it no longer needs them
+ */
+struct avl_conc {
+    struct avl_cnode   holder;  /* Sentinel whose right child is the root */
+    avl_conc_cmpfn_t  *cmpfn;   /* Comparison function */
+    avl_conc_freefn_t *freefn;  /* Frees removed nodes */
+    void              *data;    /* User data for @p freefn */
+    struct avl_epoch   epoch;   /* Reclaims removed nodes */
+};
+
+
+/** @brief Initialize an empty tree
+ *  @param tree
+ *      Tree to initialize
+ *  @param cmpfn
+ *      Comparison function
+ *  @param freefn
+ *      Frees removed nodes. This may be called from any registered thread
+ *  @param data
+ *      User data for @p freefn
+ *  @returns Zero on success, or an error number from pthread_mutex_init(3)
+ */
+int avl_conc_init(struct avl_conc   *tree,   avl_conc_cmpfn_t *cmpfn,
+                  avl_conc_freefn_t *freefn, void             *data);
+
+
+/** @brief Destroy a tree once every thread has been unregistered, freeing
+ *      every node still in it with the free function
+ */
+void avl_conc_destroy(struct avl_conc *tree);
+
+
+/** @brief Find the node comparing equal to @p query. Call this inside a
+ *      critical section. It never blocks, except briefly behind a rotation
+ *      of a node on its path
+ *  @param tree
+ *      Tree
+ *  @param query
+ *      Test node
+ *  @returns The node, or NULL
+ */
+struct avl_cnode *avl_conc_lookup(struct avl_conc *tree, const struct avl_cnode *query);
+
+
+/** @brief Insert @p node
+ *  @param tree
+ *      Tree
+ *  @param thread
+ *      The calling thread's epoch state
+ *  @param node
+ *      Node to insert. Its fields need no initialization
+ *  @returns Zero if @p node was inserted, or nonzero if an equal node was
+ *      already present, in which case @p node is untouched
+ */
+int avl_conc_insert(struct avl_conc *tree, struct avl_epoch_thread *thread, struct avl_cnode *node);
+
+
+/** @brief Remove the node comparing equal to @p query
+ *  @returns Zero if a node was removed, or nonzero if there was none
+ *  @see avl_conc_insert for the other parameters
+ */
+int avl_conc_remove(struct avl_conc *tree, struct avl_epoch_thread *thread, const struct avl_cnode *query);
+
+
+#endif /* AVL_CONC_H */
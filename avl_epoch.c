@@ -0,0 +1,165 @@
+#include <sched.h>
+#include <stdlib.h>
+#include "avl_epoch.h"
+
+
+int avl_epoch_init(struct avl_epoch *domain, avl_epoch_freefn_t *freefn, void *data)
+{
+    atomic_init(&domain->epoch, 1);
+    domain->threads = NULL;
+    domain->freefn = freefn;
+    domain->data = data;
+    return pthread_mutex_init(&domain->lock, NULL);
+}
+
+
+void avl_epoch_destroy(struct avl_epoch *domain)
+{
+    pthread_mutex_destroy(&domain->lock);
+}
+
+
+void avl_epoch_register(struct avl_epoch *domain, struct avl_epoch_thread *thread)
+{
+    atomic_init(&thread->active, 0);
+    thread->depth = 0;
+    thread->domain = domain;
+    thread->limbo = NULL;
+    thread->len = 0;
+    thread->cap = 0;
+    pthread_mutex_lock(&domain->lock);
+    thread->next = domain->threads;
+    domain->threads = thread;
+    pthread_mutex_unlock(&domain->lock);
+}
+
+
+/** @brief Free every object retired by @p thread whose grace period is over:
+ *      the global epoch has moved on twice since it was retired, so every
+ *      section that could have seen it has ended
+ */
+static void avl_epoch_collect(struct avl_epoch_thread *thread)
+{
+    struct avl_epoch *domain = thread->domain;
+    unsigned long epoch;
+    size_t i, kept = 0;
+
+    epoch = atomic_load(&domain->epoch);
+    for (i = 0; i < thread->len; i++) {
+        if (thread->limbo[i].epoch + 2 <= epoch) {
+            domain->freefn(thread->limbo[i].ptr, domain->data);
+        } else {
+            thread->limbo[kept++] = thread->limbo[i];
+        }
+    }
+    thread->len = kept;
+}
+
+
+/** @brief Advance the global epoch if every active thread has observed it
+ *  @returns Nonzero if the epoch moved, whether by this call or another
+ */
+static int avl_epoch_advance(struct avl_epoch *domain)
+{
+    struct avl_epoch_thread *thread;
+    unsigned long epoch, active;
+    int ok = 1;
+
+    epoch = atomic_load(&domain->epoch);
+    pthread_mutex_lock(&domain->lock);
+    for (thread = domain->threads; thread && ok; thread = thread->next) {
+        active = atomic_load(&thread->active);
+        ok = !active || active >> 1 == epoch;
+    }
+    pthread_mutex_unlock(&domain->lock);
+    if (ok) {
+        atomic_compare_exchange_strong(&domain->epoch, &epoch, epoch + 1);
+    }
+    return ok;
+}
+
+
+void avl_epoch_synchronize(struct avl_epoch_thread *thread)
+{
+    struct avl_epoch *domain = thread->domain;
+    unsigned long target;
+
+    target = atomic_load(&domain->epoch) + 2;
+    while (atomic_load(&domain->epoch) < target) {
+        if (!avl_epoch_advance(domain)) {
+            sched_yield();
+        }
+    }
+}
+
+
+void avl_epoch_unregister(struct avl_epoch_thread *thread)
+{
+    struct avl_epoch *domain = thread->domain;
+    struct avl_epoch_thread **link;
+
+    avl_epoch_synchronize(thread);
+    avl_epoch_collect(thread);
+    free(thread->limbo);
+    thread->limbo = NULL;
+    thread->cap = 0;
+    pthread_mutex_lock(&domain->lock);
+    for (link = &domain->threads; *link != thread; link = &(*link)->next);
+    *link = thread->next;
+    pthread_mutex_unlock(&domain->lock);
+}
+
+
+void avl_epoch_enter(struct avl_epoch_thread *thread)
+{
+    unsigned long epoch;
+
+    if (thread->depth++) {
+        return;
+    }
+    /* If the epoch moved before the announcement was visible, announce the
+    new one. Afterwards it cannot move more than once before this exits */
+    do {
+        epoch = atomic_load(&thread->domain->epoch);
+        atomic_store(&thread->active, 2 * epoch + 1);
+    } while (atomic_load(&thread->domain->epoch) != epoch);
+}
+
+
+void avl_epoch_exit(struct avl_epoch_thread *thread)
+{
+    if (!--thread->depth) {
+        atomic_store_explicit(&thread->active, 0, memory_order_release);
+    }
+}
+
+
+void avl_epoch_retire(struct avl_epoch_thread *thread, void *ptr)
+{
+    struct avl_epoch *domain = thread->domain;
+    struct avl_epoch_limbo *limbo;
+    size_t cap;
+
+    if (thread->len == thread->cap) {
+        cap = thread->cap ? 2 * thread->cap : 2 * AVL_EPOCH_BATCH;
+        limbo = realloc(thread->limbo, cap * sizeof *limbo);
+        if (!limbo) {
+            /* Outside of a section the grace period can be waited out right
+            here. Inside one it never ends, so the object is leaked */
+            if (!thread->depth) {
+                avl_epoch_synchronize(thread);
+                domain->freefn(ptr, domain->data);
+            }
+            return;
+        }
+        thread->limbo = limbo;
+        thread->cap = cap;
+    }
+    thread->limbo[thread->len].ptr = ptr;
+    thread->limbo[thread->len].epoch = atomic_load(&domain->epoch);
+    thread->len++;
+    if (thread->len % AVL_EPOCH_BATCH == 0) {
+        avl_epoch_advance(domain);
+        avl_epoch_collect(thread);
+    }
+}
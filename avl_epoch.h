@@ -0,0 +1,125 @@
+#pragma once
+
+#ifndef AVL_EPOCH_H
+#define AVL_EPOCH_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+
+/** @brief Free one retired object
+ *  @param ptr
+ *      The object
+ *  @param data
+ *      User data of the domain
+ */
+typedef void avl_epoch_freefn_t(void *ptr, void *data);
+
+
+/** @brief A retired object awaiting its grace period */
+struct avl_epoch_limbo {
+    void         *ptr;      /* The object */
+    unsigned long epoch;    /* Global epoch when it was retired */
+};
+
+
+/** @brief Per-thread state. Every thread that reads or writes a structure
+ *      guarded by a domain registers one of these and passes it to each call.
+ *      It must only ever be used by its own thread
+ */
+struct avl_epoch_thread {
+    atomic_ulong             active;    /* Twice the epoch, plus one, while in
+                                           a critical section, or zero */
+    unsigned                 depth;     /* Nesting depth of critical sections */
+    struct avl_epoch        *domain;    /* The domain */
+    struct avl_epoch_thread *next;      /* Next registered thread */
+    struct avl_epoch_limbo  *limbo;     /* Objects retired by this thread */
+    size_t                   len;       /* Number of objects in @p limbo */
+    size_t                   cap;       /* Allocated length of @p limbo */
+};
+
+
+/** @brief An epoch-based reclamation domain. An object that has been unlinked
+ *      from a shared structure is retired instead of freed, and is only freed
+ *      once every thread that was in a critical section at the time has left
+ *      it. Entering and leaving a critical section costs a couple of stores
+ *      to the thread's own cache line, and never blocks
+ */
+struct avl_epoch {
+    atomic_ulong             epoch;     /* Global epoch */
+    pthread_mutex_t          lock;      /* Guards the thread list */
+    struct avl_epoch_thread *threads;   /* Registered threads */
+    avl_epoch_freefn_t      *freefn;    /* Frees retired objects */
+    void                    *data;      /* User data for @p freefn */
+};
+
+
+/** @brief Number of retired objects a thread accumulates before it tries to
+ *      advance the epoch and free the ones whose grace period has passed
+ */
+#define AVL_EPOCH_BATCH 64
+
+
+/** @brief Initialize a domain
+ *  @param domain
+ *      Domain to initialize
+ *  @param freefn
+ *      Frees retired objects. This is called from whichever thread notices
+ *      that an object's grace period has passed
+ *  @param data
+ *      User data for @p freefn
+ *  @returns Zero on success, or an error number from pthread_mutex_init(3)
+ */
+int avl_epoch_init(struct avl_epoch *domain, avl_epoch_freefn_t *freefn, void *data);
+
+
+/** @brief Destroy a domain. Every thread must have been unregistered */
+void avl_epoch_destroy(struct avl_epoch *domain);
+
+
+/** @brief Register the calling thread with a domain
+ *  @param domain
+ *      Domain
+ *  @param thread
+ *      State for the calling thread
+ */
+void avl_epoch_register(struct avl_epoch *domain, struct avl_epoch_thread *thread);
+
+
+/** @brief Unregister a thread, outside of any critical section. This waits for
+ *      the grace period of everything it retired and frees it
+ */
+void avl_epoch_unregister(struct avl_epoch_thread *thread);
+
+
+/** @brief Enter a critical section. Objects that are reachable from now on
+ *      are not freed until the matching avl_epoch_exit. Sections nest
+ */
+void avl_epoch_enter(struct avl_epoch_thread *thread);
+
+
+/** @brief Leave a critical section */
+void avl_epoch_exit(struct avl_epoch_thread *thread);
+
+
+/** @brief Retire an object that no new critical section can reach any more. It
+ *      is freed once its grace period has passed. This may be called inside or
+ *      outside a critical section. Should the retire list fail to grow, the
+ *      object is freed after waiting out its grace period right away when
+ *      outside a section, and leaked when inside one
+ *  @param thread
+ *      State for the calling thread
+ *  @param ptr
+ *      The object
+ */
+void avl_epoch_retire(struct avl_epoch_thread *thread, void *ptr);
+
+
+/** @brief Wait until every critical section that is active now has ended. This
+ *      must not be called inside a critical section
+ */
+void avl_epoch_synchronize(struct avl_epoch_thread *thread);
+
+
+#endif /* AVL_EPOCH_H */
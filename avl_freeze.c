@@ -0,0 +1,308 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "avl_freeze.h"
+
+#if defined(__GNUC__) && defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__GNUC__) && defined(__SSE4_2__)
+# include <nmmintrin.h>
+#endif
+
+
+#if defined(__GNUC__)
+# define AVL_FROZEN_PREFETCH(addr) __builtin_prefetch((addr), 0, 3)
+#else
+# define AVL_FROZEN_PREFETCH(addr) ((void)(addr))
+#endif
+
+
+/** @brief Count the trailing one bits of @p k */
+static unsigned avl_trailing_ones(size_t k)
+{
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctzll(~(unsigned long long)k);
+#else
+    unsigned res = 0;
+
+    while (k & 1) {
+        k >>= 1;
+        res++;
+    }
+    return res;
+#endif
+}
+
+
+/** @brief Count the nodes of a tree */
+static size_t avl_frozen_size(struct avl *root)
+{
+#ifdef AVL_SIZE
+    return avl_size(root);
+#else
+    struct avl_cursor cur;
+    struct avl *node;
+    size_t n = 0;
+
+    for (node = avl_cursor_first(&cur, root); node; node = avl_cursor_next(&cur)) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+
+void avl_frozen_init(struct avl_frozen *frozen)
+{
+    frozen->node = NULL;
+    frozen->count = 0;
+    frozen->cap = 0;
+}
+
+
+void avl_frozen_destroy(struct avl_frozen *frozen)
+{
+    free(frozen->node);
+    avl_frozen_init(frozen);
+}
+
+
+/** @brief Fill the Eytzinger subtree at index @p k from an in-order cursor */
+static void avl_frozen_fill(struct avl **out, size_t n, size_t k, struct avl_cursor *cur)
+{
+    if (k > n) {
+        return;
+    }
+    avl_frozen_fill(out, n, 2 * k, cur);
+    out[k] = avl_cursor_get(cur);
+    avl_cursor_next(cur);
+    avl_frozen_fill(out, n, 2 * k + 1, cur);
+}
+
+
+int avl_freeze(struct avl_frozen *frozen, struct avl *root)
+{
+    struct avl_cursor cur;
+    struct avl **node;
+    size_t n;
+
+    n = avl_frozen_size(root);
+    if (n + 1 > frozen->cap) {
+        node = realloc(frozen->node, (n + 1) * sizeof *node);
+        if (!node) {
+            return -1;
+        }
+        frozen->node = node;
+        frozen->cap = n + 1;
+    }
+    frozen->count = n;
+    avl_cursor_first(&cur, root);
+    avl_frozen_fill(frozen->node, n, 1, &cur);
+    return 0;
+}
+
+
+struct avl *avl_frozen_lower_bound(const struct avl_frozen *frozen,
+                                   struct avl              *query,
+                                   avl_cmpfn_t             *cmpfn)
+{
+    struct avl *const *node = frozen->node;
+    size_t k = 1, n = frozen->count;
+
+    while (k <= n) {
+        /* The pointers four levels down share two cache lines. The elements
+        two levels down are prefetched too, since every comparison has to load
+        one of them and they are anywhere in memory */
+        if (16 * k <= n) {
+            AVL_FROZEN_PREFETCH(node + 16 * k);
+        }
+        if (4 * k + 3 <= n) {
+            AVL_FROZEN_PREFETCH(node[4 * k]);
+            AVL_FROZEN_PREFETCH(node[4 * k + 1]);
+            AVL_FROZEN_PREFETCH(node[4 * k + 2]);
+            AVL_FROZEN_PREFETCH(node[4 * k + 3]);
+        }
+        k = 2 * k + (cmpfn(node[k], query) < 0);
+    }
+    /* Undo the right turns taken after the last left turn */
+    k >>= avl_trailing_ones(k) + 1;
+    return k ? node[k] : NULL;
+}
+
+
+struct avl *avl_frozen_lookup(const struct avl_frozen *frozen,
+                              struct avl              *query,
+                              avl_cmpfn_t             *cmpfn)
+{
+    struct avl *res;
+
+    res = avl_frozen_lower_bound(frozen, query, cmpfn);
+    return res && !cmpfn(query, res) ? res : NULL;
+}
+
+
+void avl_frozen_int_init(struct avl_frozen_int *frozen)
+{
+    frozen->key = NULL;
+    frozen->index = NULL;
+    frozen->node = NULL;
+    frozen->count = 0;
+    frozen->blocks = 0;
+    frozen->mem = NULL;
+}
+
+
+void avl_frozen_int_destroy(struct avl_frozen_int *frozen)
+{
+    free(frozen->mem);
+    free(frozen->index);
+    free(frozen->node);
+    avl_frozen_int_init(frozen);
+}
+
+
+/** @brief Get the index of child @p i of block @p b */
+static size_t avl_frozen_child(size_t b, unsigned i)
+{
+    return b * (AVL_FROZEN_BLOCK + 1) + i + 1;
+}
+
+
+/** @brief Fill the implicit B-tree rooted at block @p b in order
+ *  @param frozen
+ *      Snapshot, whose node array is already filled and in order
+ *  @param b
+ *      Block index
+ *  @param keyfn
+ *      Key extraction function
+ *  @param next
+ *      In-order index of the next slot to fill
+ */
+static void avl_frozen_int_fill(struct avl_frozen_int *frozen,
+                                size_t                 b,
+                                avl_keyfn_t           *keyfn,
+                                size_t                *next)
+{
+    size_t slot;
+    unsigned i;
+
+    if (b >= frozen->blocks) {
+        return;
+    }
+    for (i = 0; i < AVL_FROZEN_BLOCK; i++) {
+        avl_frozen_int_fill(frozen, avl_frozen_child(b, i), keyfn, next);
+        slot = b * AVL_FROZEN_BLOCK + i;
+        if (*next < frozen->count) {
+            frozen->key[slot] = keyfn(frozen->node[*next]);
+            frozen->index[slot] = (*next)++;
+        } else {
+            frozen->key[slot] = LLONG_MAX;
+            frozen->index[slot] = frozen->count;
+        }
+    }
+    avl_frozen_int_fill(frozen, avl_frozen_child(b, AVL_FROZEN_BLOCK), keyfn, next);
+}
+
+
+int avl_freeze_int(struct avl_frozen_int *frozen, struct avl *root, avl_keyfn_t *keyfn)
+{
+    struct avl_frozen_int next;
+    struct avl_cursor cur;
+    struct avl *node;
+    size_t n, slots, i = 0;
+
+    n = avl_frozen_size(root);
+    next.count = n;
+    next.blocks = (n + AVL_FROZEN_BLOCK - 1) / AVL_FROZEN_BLOCK;
+    slots = next.blocks * AVL_FROZEN_BLOCK;
+    next.mem = malloc(slots * sizeof *next.key + 63);
+    next.index = malloc(slots * sizeof *next.index + 1);
+    next.node = malloc(n * sizeof *next.node + 1);
+    if (!next.mem || !next.index || !next.node) {
+        avl_frozen_int_destroy(&next);
+        return -1;
+    }
+    /* Blocks must not straddle cache lines */
+    next.key = (long long *)(((uintptr_t)next.mem + 63) & ~(uintptr_t)63);
+    for (node = avl_cursor_first(&cur, root); node; node = avl_cursor_next(&cur)) {
+        next.node[i++] = node;
+    }
+    i = 0;
+    avl_frozen_int_fill(&next, 0, keyfn, &i);
+    avl_frozen_int_destroy(frozen);
+    *frozen = next;
+    return 0;
+}
+
+
+/** @brief Count the keys in a block that are less than @p key */
+static unsigned avl_frozen_rank(const long long *block, long long key)
+{
+#if defined(__GNUC__) && defined(__AVX2__) && AVL_FROZEN_BLOCK == 8
+    __m256i x = _mm256_set1_epi64x(key), lo, hi;
+    unsigned mask;
+
+    lo = _mm256_cmpgt_epi64(x, _mm256_load_si256((const __m256i *)block));
+    hi = _mm256_cmpgt_epi64(x, _mm256_load_si256((const __m256i *)block + 1));
+    mask = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(lo))
+         | (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4;
+    return (unsigned)__builtin_popcount(mask);
+#elif defined(__GNUC__) && defined(__SSE4_2__) && defined(__x86_64__) && AVL_FROZEN_BLOCK == 8
+    __m128i x = _mm_set1_epi64x(key), sum;
+    const __m128i *v = (const __m128i *)block;
+
+    /* Each lane of a comparison is -1 where the key is smaller */
+    sum = _mm_add_epi64(_mm_add_epi64(_mm_cmpgt_epi64(x, _mm_load_si128(v)),
+                                      _mm_cmpgt_epi64(x, _mm_load_si128(v + 1))),
+                        _mm_add_epi64(_mm_cmpgt_epi64(x, _mm_load_si128(v + 2)),
+                                      _mm_cmpgt_epi64(x, _mm_load_si128(v + 3))));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    return (unsigned)-_mm_cvtsi128_si64(sum);
+#else
+    unsigned i, res = 0;
+
+    for (i = 0; i < AVL_FROZEN_BLOCK; i++) {
+        res += block[i] < key;
+    }
+    return res;
+#endif
+}
+
+
+/** @brief Find the slot of the least key not less than @p key
+ *  @returns The slot, or SIZE_MAX if there is none
+ */
+static size_t avl_frozen_int_slot(const struct avl_frozen_int *frozen, long long key)
+{
+    size_t b = 0, best = SIZE_MAX, slot;
+    unsigned rank;
+
+    while (b < frozen->blocks) {
+        rank = avl_frozen_rank(frozen->key + b * AVL_FROZEN_BLOCK, key);
+        slot = b * AVL_FROZEN_BLOCK + rank;
+        best = rank < AVL_FROZEN_BLOCK ? slot : best;
+        b = avl_frozen_child(b, rank);
+    }
+    return best;
+}
+
+
+size_t avl_frozen_int_lower_bound(const struct avl_frozen_int *frozen, long long key)
+{
+    size_t slot;
+
+    slot = avl_frozen_int_slot(frozen, key);
+    return slot == SIZE_MAX ? frozen->count : frozen->index[slot];
+}
+
+
+struct avl *avl_frozen_int_lookup(const struct avl_frozen_int *frozen, long long key)
+{
+    size_t slot;
+
+    slot = avl_frozen_int_slot(frozen, key);
+    if (slot == SIZE_MAX || frozen->key[slot] != key || frozen->index[slot] == frozen->count) {
+        return NULL;
+    }
+    return frozen->node[frozen->index[slot]];
+}
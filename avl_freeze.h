@@ -0,0 +1,139 @@
+#pragma once
+
+#ifndef AVL_FREEZE_H
+#define AVL_FREEZE_H
+
+#include <stddef.h>
+#include "avl.h"
+
+
+/** @brief Number of keys in each block of an integer snapshot. A block of
+ *      64-bit keys fills one 64-byte cache line
+ */
+#define AVL_FROZEN_BLOCK 8
+
+
+/** @brief A read-only snapshot of a tree stored as an implicit Eytzinger
+ *      array: the root at index 1 and the children of index k at 2k and
+ *      2k + 1. Searching it touches no child links and prefetches ahead, at the
+ *      price of any further modification. The nodes themselves are shared
+ *      with the live tree, which must not be modified while the snapshot is
+ *      in use; freeze it again afterwards to rebuild
+ */
+struct avl_frozen {
+    struct avl **node;      /* Nodes in Eytzinger order, from index 1 */
+    size_t       count;     /* Number of nodes */
+    size_t       cap;       /* Allocated length of @p node */
+};
+
+
+/** @brief Extract the integer key of @p node for avl_freeze_int. This must
+ *      order nodes the same way as the tree's comparison function
+ */
+typedef long long avl_keyfn_t(const struct avl *node);
+
+
+/** @brief A read-only snapshot of a tree keyed by integers, stored as an
+ *      implicit B-tree. Each block holds AVL_FROZEN_BLOCK sorted keys in one
+ *      cache line, and block b has its children at b * (AVL_FROZEN_BLOCK + 1)
+ *      + 1 through b * (AVL_FROZEN_BLOCK + 1) + AVL_FROZEN_BLOCK + 1. A
+ *      search compares the query with a whole block at a time, using SIMD
+ *      when the compiler targets AVX2 or SSE4.2, and has no data-dependent
+ *      branches within a block
+ */
+struct avl_frozen_int {
+    long long   *key;       /* Keys in block order, padded with LLONG_MAX */
+    size_t      *index;     /* In-order index of each key, or count for padding */
+    struct avl **node;      /* Nodes in order, so index i is node[i] */
+    size_t       count;     /* Number of nodes */
+    size_t       blocks;    /* Number of blocks */
+    void        *mem;       /* Allocation holding @p key */
+};
+
+
+/** @brief Initialize an empty snapshot */
+void avl_frozen_init(struct avl_frozen *frozen);
+
+
+/** @brief Free the memory of a snapshot. The nodes are untouched */
+void avl_frozen_destroy(struct avl_frozen *frozen);
+
+
+/** @brief Rebuild @p frozen from the tree at @p root, with one in-order walk
+ *  @param frozen
+ *      Initialized snapshot. Its previous contents are replaced, reusing its
+ *      memory when possible
+ *  @param root
+ *      Tree root
+ *  @returns Zero on success, or -1 if allocation failed, in which case the
+ *      snapshot is left unchanged
+ */
+int avl_freeze(struct avl_frozen *frozen, struct avl *root);
+
+
+/** @brief avl_lookup on a snapshot, with the same comparison function contract
+ *  @param frozen
+ *      Snapshot
+ *  @param query
+ *      Test node
+ *  @param cmpfn
+ *      Comparison function
+ *  @returns The node comparing equal to @p query, or NULL
+ */
+struct avl *avl_frozen_lookup(const struct avl_frozen *frozen,
+                              struct avl              *query,
+                              avl_cmpfn_t             *cmpfn);
+
+
+/** @brief avl_lower_bound on a snapshot
+ *  @see avl_frozen_lookup for the parameters
+ *  @returns The least node not less than @p query, or NULL
+ */
+struct avl *avl_frozen_lower_bound(const struct avl_frozen *frozen,
+                                   struct avl              *query,
+                                   avl_cmpfn_t             *cmpfn);
+
+
+/** @brief Initialize an empty integer snapshot */
+void avl_frozen_int_init(struct avl_frozen_int *frozen);
+
+
+/** @brief Free the memory of an integer snapshot. The nodes are untouched */
+void avl_frozen_int_destroy(struct avl_frozen_int *frozen);
+
+
+/** @brief Rebuild @p frozen from the tree at @p root, with one in-order walk
+ *  @param frozen
+ *      Initialized snapshot. Its previous contents are replaced
+ *  @param root
+ *      Tree root
+ *  @param keyfn
+ *      Key extraction function
+ *  @returns Zero on success, or -1 if allocation failed, in which case the
+ *      snapshot is left unchanged
+ */
+int avl_freeze_int(struct avl_frozen_int *frozen, struct avl *root, avl_keyfn_t *keyfn);
+
+
+/** @brief Find the in-order index of the least key not less than @p key
+ *  @param frozen
+ *      Snapshot
+ *  @param key
+ *      Query key
+ *  @returns The index, which selects frozen->node, or frozen->count if every
+ *      key is less than @p key
+ */
+size_t avl_frozen_int_lower_bound(const struct avl_frozen_int *frozen, long long key);
+
+
+/** @brief Find the node whose key equals @p key
+ *  @param frozen
+ *      Snapshot
+ *  @param key
+ *      Query key
+ *  @returns The node, or NULL if there is none
+ */
+struct avl *avl_frozen_int_lookup(const struct avl_frozen_int *frozen, long long key);
+
+
+#endif /* AVL_FREEZE_H */
@@ -0,0 +1,140 @@
+#pragma once
+
+#ifndef AVL_GEN_H
+#define AVL_GEN_H
+
+#include <stddef.h>
+#include "avl.h"
+
+
+/** @brief Three-way comparison of two numeric keys, for use as the @p cmp
+ *      argument of AVL_DEFINE
+ */
+#define AVL_CMP_NUM(a, b) (((a) > (b)) - ((a) < (b)))
+
+
+#ifdef AVL_PREFIX
+/* With AVL_PREFIX the generated searches order by the node prefixes first, as
+the library's do, and compare the keys themselves only on a tie */
+# define AVL_GEN_CMP(cmp, n1, n2, k1, k2) \
+    (avl_prefix_cmp((n1), (n2)) ? avl_prefix_cmp((n1), (n2)) : cmp((k1), (k2)))
+#else
+# define AVL_GEN_CMP(cmp, n1, n2, k1, k2) cmp((k1), (k2))
+#endif
+
+
+/** @brief Generate a tree specialized for one element type and ordering
+ *  @details The generated functions search the tree inline, so the comparison
+ *      and the key offset are visible to the compiler and there is no indirect
+ *      call per level. Only the rebalancing goes through the library, via
+ *      avl_insert_at and avl_delete_at. The trees produced are ordinary
+ *      struct avl trees, so every other function in avl.h still works on them
+ *      given an equivalent avl_cmpfn_t.
+ *
+ *      For a prefix @p name, this defines the static inline functions
+ *      @code
+ *          type *name_entry(struct avl *node);
+ *          type *name_find(struct avl *root, const type *query);
+ *          type *name_lower_bound(struct avl *root, const type *query);
+ *          type *name_insert(struct avl **root, type *item);
+ *          type *name_remove(struct avl **root, const type *query);
+ *      @endcode
+ *      name_insert returns NULL on success, or the element already in the tree
+ *      that compares equal to @p item, in which case the tree is unchanged.
+ *      name_remove returns the element removed, or NULL if there was none. As
+ *      with avl_insert, the avl member of @p item must be zeroed
+ *  @param name
+ *      Prefix for the generated functions
+ *  @param type
+ *      Element type, which embeds a struct avl
+ *  @param member
+ *      Name of the struct avl member of @p type
+ *  @param key
+ *      Name of the key member of @p type
+ *  @param cmp
+ *      Function or macro comparing two keys, as in cmp(a, b), and returning
+ *      negative, zero or positive like strcmp(3). AVL_CMP_NUM suits numeric
+ *      keys and strcmp suits string keys. With AVL_PREFIX it is only called
+ *      when the node prefixes tie, so every item and query needs its prefix
+ */
+#define AVL_DEFINE(name, type, member, key, cmp)                                \
+static inline type *name##_entry(struct avl *node)                              \
+{                                                                               \
+    return node ? (type *)((char *)node - offsetof(type, member)) : NULL;       \
+}                                                                               \
+                                                                                \
+static inline type *name##_find(struct avl *root, const type *query)            \
+{                                                                               \
+    int c;                                                                      \
+                                                                                \
+    while (root) {                                                              \
+        c = AVL_GEN_CMP(cmp, &query->member, root,                              \
+                        query->key, name##_entry(root)->key);                   \
+        if (!c) {                                                               \
+            break;                                                              \
+        }                                                                       \
+        root = AVL_CHILD(root, c > 0);                                          \
+    }                                                                           \
+    return name##_entry(root);                                                  \
+}                                                                               \
+                                                                                \
+static inline type *name##_lower_bound(struct avl *root, const type *query)     \
+{                                                                               \
+    struct avl *best = NULL;                                                    \
+    int c;                                                                      \
+                                                                                \
+    while (root) {                                                              \
+        c = AVL_GEN_CMP(cmp, &query->member, root,                              \
+                        query->key, name##_entry(root)->key);                   \
+        if (!c) {                                                               \
+            return name##_entry(root);                                          \
+        } else if (c < 0) {                                                     \
+            best = root;                                                        \
+        }                                                                       \
+        root = AVL_CHILD(root, c > 0);                                          \
+    }                                                                           \
+    return name##_entry(best);                                                  \
+}                                                                               \
+                                                                                \
+static inline type *name##_insert(struct avl **root, type *item)                \
+{                                                                               \
+    struct avl_path path;                                                       \
+    struct avl *cur = *root;                                                    \
+    int c;                                                                      \
+                                                                                \
+    avl_path_init(&path, NULL);                                                 \
+    while (cur) {                                                               \
+        c = AVL_GEN_CMP(cmp, &item->member, cur,                                \
+                        item->key, name##_entry(cur)->key);                     \
+        if (!c) {                                                               \
+            return name##_entry(cur);                                           \
+        }                                                                       \
+        avl_path_push(&path, cur, c > 0);                                       \
+        cur = AVL_CHILD(cur, c > 0);                                            \
+    }                                                                           \
+    avl_insert_at(root, &path, &item->member);                                  \
+    return NULL;                                                                \
+}                                                                               \
+                                                                                \
+static inline type *name##_remove(struct avl **root, const type *query)         \
+{                                                                               \
+    struct avl_path path;                                                       \
+    struct avl *cur = *root;                                                    \
+    int c;                                                                      \
+                                                                                \
+    avl_path_init(&path, NULL);                                                 \
+    while (cur) {                                                               \
+        c = AVL_GEN_CMP(cmp, &query->member, cur,                               \
+                        query->key, name##_entry(cur)->key);                    \
+        if (!c) {                                                               \
+            avl_delete_at(root, &path, cur);                                    \
+            break;                                                              \
+        }                                                                       \
+        avl_path_push(&path, cur, c > 0);                                       \
+        cur = AVL_CHILD(cur, c > 0);                                            \
+    }                                                                           \
+    return name##_entry(cur);                                                   \
+}
+
+
+#endif /* AVL_GEN_H */
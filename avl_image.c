@@ -0,0 +1,235 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "avl_image.h"
+
+
+#define AVL_IMAGE_MAGIC "avlimage"
+
+/* Also catches images written on a machine of the other byte order */
+#define AVL_IMAGE_VERSION ((uint32_t)1)
+
+/* Build options that change the node layout */
+#define AVL_IMAGE_PARENT    1u
+#define AVL_IMAGE_SIZE      2u
+#define AVL_IMAGE_COMPACT   4u
+
+
+/** @brief The first bytes of an image file. The elements follow it, at a
+ *      64-byte aligned offset since the mapping itself is page aligned
+ */
+struct avl_image_header {
+    char     magic[8];  /* AVL_IMAGE_MAGIC, without the terminator */
+    uint32_t version;   /* AVL_IMAGE_VERSION */
+    uint32_t flags;     /* AVL_IMAGE_* build options */
+    uint64_t node;      /* sizeof (struct avl) */
+    uint64_t size;      /* Element size */
+    uint64_t offset;    /* Offset of the struct avl within each element */
+    uint64_t count;     /* Number of elements */
+    uint64_t root;      /* File offset of the root's struct avl, or zero */
+    uint64_t reserved;  /* Zero */
+};
+
+
+#ifdef AVL_RELATIVE
+
+/** @brief Get the AVL_IMAGE_* flags of this build */
+static uint32_t avl_image_flags(void)
+{
+    uint32_t flags = 0;
+
+#ifdef AVL_PARENT
+    flags |= AVL_IMAGE_PARENT;
+#endif
+#ifdef AVL_SIZE
+    flags |= AVL_IMAGE_SIZE;
+#endif
+#ifdef AVL_COMPACT
+    flags |= AVL_IMAGE_COMPACT;
+#endif
+    return flags;
+}
+
+
+/** @brief Count the nodes of a tree */
+static size_t avl_image_size(struct avl *root)
+{
+#ifdef AVL_SIZE
+    return avl_size(root);
+#else
+    struct avl_cursor cur;
+    struct avl *node;
+    size_t n = 0;
+
+    for (node = avl_cursor_first(&cur, root); node; node = avl_cursor_next(&cur)) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+
+int avl_image_write(const char *path,   struct avl *root,
+                    avl_layout_t layout, size_t     size,
+                    size_t       offset)
+{
+    struct avl_image_header hdr;
+    char *buf = NULL;
+    FILE *fp;
+    size_t n;
+    int err;
+
+    n = avl_image_size(root);
+    if (n && !(buf = malloc(n * size))) {
+        return -1;
+    }
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, AVL_IMAGE_MAGIC, sizeof hdr.magic);
+    hdr.version = AVL_IMAGE_VERSION;
+    hdr.flags = avl_image_flags();
+    hdr.node = sizeof (struct avl);
+    hdr.size = size;
+    hdr.offset = offset;
+    hdr.count = n;
+    hdr.root = n ? sizeof hdr + offset : 0;
+    /* The copy is position independent, so it is written out exactly as it
+    sits in memory. Its root is the first element */
+    avl_relayout(root, layout, buf, size, offset, NULL, NULL);
+    fp = fopen(path, "wb");
+    if (!fp) {
+        free(buf);
+        return -1;
+    }
+    err = fwrite(&hdr, sizeof hdr, 1, fp) != 1 || (n && fwrite(buf, size, n, fp) != n);
+    free(buf);
+    if (fclose(fp) || err) {
+        return -1;
+    }
+    return 0;
+}
+
+
+/** @brief Check the header of a mapped file of @p len bytes */
+static int avl_image_check(const struct avl_image_header *hdr, size_t len)
+{
+    uint64_t data;
+
+    if (len < sizeof *hdr
+     || memcmp(hdr->magic, AVL_IMAGE_MAGIC, sizeof hdr->magic)
+     || hdr->version != AVL_IMAGE_VERSION
+     || hdr->flags != avl_image_flags()
+     || hdr->node != sizeof (struct avl)
+     || hdr->size < sizeof (struct avl)
+     || hdr->offset > hdr->size - sizeof (struct avl)) {
+        return -1;
+    }
+    data = len - sizeof *hdr;
+    if (hdr->count > data / hdr->size) {
+        return -1;
+    }
+    if (!hdr->count) {
+        return hdr->root ? -1 : 0;
+    }
+    /* The root is the first element */
+    return hdr->root == sizeof *hdr + hdr->offset ? 0 : -1;
+}
+
+
+int avl_image_open(struct avl_image *image, const char *path, avl_image_mode_t mode)
+{
+    const struct avl_image_header *hdr;
+    struct stat st;
+    void *map;
+    int fd, err;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st)) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof *hdr) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    map = mmap(NULL, (size_t)st.st_size,
+               mode == AVL_IMAGE_COW ? PROT_READ | PROT_WRITE : PROT_READ,
+               MAP_PRIVATE, fd, 0);
+    err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = err;
+        return -1;
+    }
+    hdr = map;
+    if (avl_image_check(hdr, (size_t)st.st_size)) {
+        munmap(map, (size_t)st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    image->map = map;
+    image->len = (size_t)st.st_size;
+    image->root = hdr->count ? (struct avl *)((char *)map + hdr->root) : NULL;
+    image->count = hdr->count;
+    image->size = hdr->size;
+    image->offset = hdr->offset;
+    return 0;
+}
+
+#else
+
+int avl_image_write(const char *path,   struct avl *root,
+                    avl_layout_t layout, size_t     size,
+                    size_t       offset)
+{
+    (void)path;
+    (void)root;
+    (void)layout;
+    (void)size;
+    (void)offset;
+    errno = ENOTSUP;
+    return -1;
+}
+
+
+int avl_image_open(struct avl_image *image, const char *path, avl_image_mode_t mode)
+{
+    (void)image;
+    (void)path;
+    (void)mode;
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif /* AVL_RELATIVE */
+
+
+void avl_image_close(struct avl_image *image)
+{
+    if (image->map) {
+        munmap(image->map, image->len);
+    }
+    image->map = NULL;
+    image->len = 0;
+    image->root = NULL;
+    image->count = 0;
+}
+
+
+int avl_image_contains(const struct avl_image *image, const struct avl *node)
+{
+    uintptr_t base = (uintptr_t)image->map, addr = (uintptr_t)node;
+
+    return image->map && addr >= base && addr - base < image->len;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#ifndef AVL_IMAGE_H
+#define AVL_IMAGE_H
+
+#include <stddef.h>
+#include "avl.h"
+#include "avl_layout.h"
+
+
+/** @brief How avl_image_open maps an image */
+typedef enum {
+    AVL_IMAGE_READ,     /* Read only. Any write to the tree faults */
+    AVL_IMAGE_COW       /* Private and writable: pages are copied on first
+                           write, and the file itself never changes */
+} avl_image_mode_t;
+
+
+/** @brief A tree image mapped from a file. An image is a header followed by
+ *      every element of the tree laid out contiguously, and it is only usable
+ *      when the library is built with AVL_RELATIVE, whose self-relative links
+ *      stay valid wherever the file is mapped. Opening one costs a single
+ *      mmap(2): nothing is deserialized, and pages are read in lazily as
+ *      searches touch them.
+ *
+ *      The element payload is copied byte for byte, so it must not hold
+ *      pointers of its own. The image records the build options and node
+ *      size it was written with and refuses to open under different ones, but
+ *      it does not otherwise validate the tree, so only open files you trust.
+ *
+ *      A copy-on-write image may be modified like any other tree. Inserted
+ *      nodes may come from anywhere in memory, since a relative link reaches
+ *      any address; nodes that live in the mapping must never be freed on
+ *      their own, so use avl_image_contains to tell them apart. Write the tree
+ *      out again with avl_image_write to persist the changes
+ */
+struct avl_image {
+    void       *map;        /* The mapping, or NULL */
+    size_t      len;        /* Length of the mapping */
+    struct avl *root;       /* Tree root, which may be modified */
+    size_t      count;      /* Number of elements in the image */
+    size_t      size;       /* Element size */
+    size_t      offset;     /* Offset of the struct avl within each element */
+};
+
+
+/** @brief Write the tree at @p root to a file as an image. The tree itself is
+ *      not modified
+ *  @param path
+ *      File to create or truncate. Write to a temporary name and rename(2) it
+ *      into place if readers may open it concurrently
+ *  @param root
+ *      Tree root
+ *  @param layout
+ *      Memory order of the elements in the image (see avl_relayout). The van
+ *      Emde Boas order also keeps the pages a search faults in few
+ *  @param size
+ *      Element size
+ *  @param offset
+ *      Offset of the struct avl within each element
+ *  @returns Zero on success, or -1 with errno set. errno is ENOTSUP if the
+ *      library was built without AVL_RELATIVE
+ */
+int avl_image_write(const char *path,   struct avl *root,
+                    avl_layout_t layout, size_t     size,
+                    size_t       offset);
+
+
+/** @brief Map an image written by avl_image_write
+ *  @param image
+ *      Filled in on success
+ *  @param path
+ *      Image file
+ *  @param mode
+ *      Read-only or copy-on-write
+ *  @returns Zero on success, or -1 with errno set. errno is EINVAL if the
+ *      file is not an image written with the same build options, and ENOTSUP
+ *      if the library was built without AVL_RELATIVE
+ */
+int avl_image_open(struct avl_image *image, const char *path, avl_image_mode_t mode);
+
+
+/** @brief Unmap an image. Nodes inserted into it are not freed, and no node of
+ *      the image may be used afterwards
+ */
+void avl_image_close(struct avl_image *image);
+
+
+/** @brief Determine if @p node lives in the mapping of @p image rather than
+ *      elsewhere in memory
+ *  @returns Nonzero if it does
+ */
+int avl_image_contains(const struct avl_image *image, const struct avl *node);
+
+
+#endif /* AVL_IMAGE_H */
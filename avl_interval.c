@@ -0,0 +1,84 @@
+#include <stddef.h>
+#include "avl_interval.h"
+
+
+/** @brief Get the interval containing @p node */
+#define AVL_INTERVAL(node) \
+    ((struct avl_interval *)((char *)(node) - offsetof(struct avl_interval, avl)))
+
+
+/** @brief Order intervals by start, end, and finally address */
+static int avl_interval_cmp(const struct avl *n1, const struct avl *n2)
+{
+    const struct avl_interval *i1 = AVL_INTERVAL(n1), *i2 = AVL_INTERVAL(n2);
+
+    if (i1->lo != i2->lo) {
+        return i1->lo < i2->lo ? -1 : 1;
+    } else if (i1->hi != i2->hi) {
+        return i1->hi < i2->hi ? -1 : 1;
+    } else if (i1 != i2) {
+        return i1 < i2 ? -1 : 1;
+    }
+    return 0;
+}
+
+
+void avl_interval_update(struct avl *node)
+{
+    struct avl_interval *iv = AVL_INTERVAL(node), *child;
+    unsigned dir;
+
+    iv->max = iv->hi;
+    for (dir = 0; dir < 2; dir++) {
+        if (AVL_CHILD(node, dir)) {
+            child = AVL_INTERVAL(AVL_CHILD(node, dir));
+            if (child->max > iv->max) {
+                iv->max = child->max;
+            }
+        }
+    }
+}
+
+
+int avl_interval_insert(struct avl **root, struct avl_interval *iv)
+{
+    return avl_insert_aug(root, &iv->avl, avl_interval_cmp, NULL, avl_interval_update);
+}
+
+
+int avl_interval_remove(struct avl **root, struct avl_interval *iv)
+{
+    return avl_delete_aug(root, &iv->avl, avl_interval_cmp, NULL, avl_interval_update) != NULL;
+}
+
+
+int avl_interval_overlap(struct avl        *root, long long lo, long long hi,
+                         avl_interval_fn_t *fn,   void     *data)
+{
+    struct avl_interval *iv;
+    int res;
+
+    while (root) {
+        iv = AVL_INTERVAL(root);
+        if (iv->max <= lo) {
+            /* Everything here ends too early */
+            break;
+        }
+        res = avl_interval_overlap(AVL_CHILD(root, 0), lo, hi, fn, data);
+        if (res) {
+            return res;
+        }
+        if (iv->lo >= hi) {
+            /* This and everything to the right starts too late */
+            break;
+        }
+        if (iv->hi > lo) {
+            res = fn(iv, data);
+            if (res) {
+                return res;
+            }
+        }
+        root = AVL_CHILD(root, 1);
+    }
+    return 0;
+}
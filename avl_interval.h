@@ -0,0 +1,77 @@
+#pragma once
+
+#ifndef AVL_INTERVAL_H
+#define AVL_INTERVAL_H
+
+#include "avl.h"
+
+
+/** @brief An interval tree node. Embed this in your own object as you would
+ *      struct avl. Intervals are ordered by start, then end, then address, so
+ *      identical intervals may be stored more than once
+ */
+struct avl_interval {
+    struct avl avl;     /* Tree linkage */
+    long long  lo;      /* Inclusive start of the interval */
+    long long  hi;      /* Exclusive end of the interval */
+    long long  max;     /* Greatest end in this subtree. Maintained by the tree */
+};
+
+
+/** @brief Callback receiving each interval that overlaps a query
+ *  @param iv
+ *      The overlapping interval
+ *  @param data
+ *      Extra user data
+ *  @return Nonzero to immediately terminate the search
+ */
+typedef int avl_interval_fn_t(struct avl_interval *iv, void *data);
+
+
+/** @brief Update function maintaining the max field. Pass this to avl_augment
+ *      after building an interval tree by other means
+ */
+void avl_interval_update(struct avl *node);
+
+
+/** @brief Insert an interval
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param iv
+ *      Interval to insert. Set lo and hi first, and zero the avl part
+ *  @returns Nonzero if @p iv was already in the tree
+ */
+int avl_interval_insert(struct avl **root, struct avl_interval *iv);
+
+
+/** @brief Remove an interval
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param iv
+ *      Interval to remove
+ *  @returns Nonzero if @p iv was found and removed
+ */
+int avl_interval_remove(struct avl **root, struct avl_interval *iv);
+
+
+/** @brief Visit, in order, every interval overlapping [@p lo, @p hi). Subtrees
+ *      whose intervals all end before @p lo or start after @p hi are never
+ *      entered, so this costs O(k log n) for k results at worst
+ *  @param root
+ *      Tree root
+ *  @param lo
+ *      Inclusive start of the query
+ *  @param hi
+ *      Exclusive end of the query
+ *  @param fn
+ *      Callback
+ *  @param data
+ *      Callback data
+ *  @returns The nonzero value returned by the callback if it stopped the
+ *      search, otherwise zero
+ */
+int avl_interval_overlap(struct avl        *root, long long lo, long long hi,
+                         avl_interval_fn_t *fn,   void     *data);
+
+
+#endif /* AVL_INTERVAL_H */
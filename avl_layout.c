@@ -0,0 +1,206 @@
+#include <string.h>
+#include "avl_layout.h"
+
+
+/** @brief State of a relayout pass */
+struct avl_relayout {
+    char              *buf;     /* Destination buffer */
+    size_t             used;    /* Elements written so far */
+    size_t             size;    /* Element size */
+    size_t             offset;  /* Offset of the node in each element */
+    avl_relayout_fn_t *movefn;  /* User move function, or NULL */
+    void              *data;    /* User data */
+    struct avl        *root;    /* The relocated root */
+};
+
+
+/** @brief Move @p node into the next free slot and link the copy to its
+ *      parent. The copy's own child links still lead to the old children,
+ *      and are set again explicitly since copying an encoded link is not
+ *      enough under AVL_RELATIVE
+ *  @param ctx
+ *      Relayout state
+ *  @param parent
+ *      The parent's copy, or NULL for the root
+ *  @param dir
+ *      Which child of @p parent the node is
+ *  @param node
+ *      Node to move
+ *  @returns The copy
+ */
+static struct avl *avl_relayout_move(struct avl_relayout *ctx,
+                                     struct avl          *parent,
+                                     unsigned             dir,
+                                     struct avl          *node)
+{
+    char *from = (char *)node - ctx->offset, *to;
+    struct avl *copy, *left, *right;
+
+    left = AVL_CHILD(node, 0);
+    right = AVL_CHILD(node, 1);
+    to = ctx->buf + ctx->used++ * ctx->size;
+    if (ctx->movefn) {
+        ctx->movefn(from, to, ctx->data);
+    } else {
+        memcpy(to, from, ctx->size);
+    }
+    copy = (struct avl *)(to + ctx->offset);
+    AVL_SET_CHILD(copy, 0, left);
+    AVL_SET_CHILD(copy, 1, right);
+#ifdef AVL_PARENT
+    AVL_SET_PARENT_OF(copy, parent);
+#endif
+    if (parent) {
+        AVL_SET_CHILD(parent, dir, copy);
+    } else {
+        ctx->root = copy;
+    }
+    return copy;
+}
+
+
+/** @brief Lay out the tree breadth first, using the destination buffer itself
+ *      as the queue
+ */
+static void avl_relayout_bfs(struct avl_relayout *ctx, struct avl *root)
+{
+    struct avl *node, *child;
+    size_t head;
+    unsigned dir;
+
+    avl_relayout_move(ctx, NULL, 0, root);
+    for (head = 0; head < ctx->used; head++) {
+        node = (struct avl *)(ctx->buf + head * ctx->size + ctx->offset);
+        for (dir = 0; dir < 2; dir++) {
+            child = AVL_CHILD(node, dir);
+            if (child) {
+                avl_relayout_move(ctx, node, dir, child);
+            }
+        }
+    }
+}
+
+
+/** @brief Height of a child, given its parent's height and balance */
+static unsigned avl_relayout_child_height(const struct avl *node,
+                                          unsigned          height,
+                                          unsigned          dir)
+{
+    return height - 1 - (AVL_BALANCE(node) > 0 ? !dir : AVL_BALANCE(node) < 0 ? dir : 0);
+}
+
+
+static void avl_relayout_veb(struct avl_relayout *ctx,
+                             struct avl          *parent,
+                             unsigned             dir,
+                             struct avl          *node,
+                             unsigned             height,
+                             unsigned             levels);
+
+
+/** @brief Lay out, in van Emde Boas order and left to right, every subtree
+ *      hanging below the first @p depth levels of the already relocated
+ *      subtree at @p copy
+ *  @param ctx
+ *      Relayout state
+ *  @param copy
+ *      Relocated node
+ *  @param height
+ *      Height of the subtree at @p copy
+ *  @param depth
+ *      Number of relocated levels left below and including @p copy
+ *  @param levels
+ *      Number of levels of each hanging subtree to lay out
+ */
+static void avl_relayout_hang(struct avl_relayout *ctx,
+                              struct avl          *copy,
+                              unsigned             height,
+                              unsigned             depth,
+                              unsigned             levels)
+{
+    struct avl *child;
+    unsigned dir, hchild;
+
+    for (dir = 0; dir < 2; dir++) {
+        child = AVL_CHILD(copy, dir);
+        if (!child) {
+            continue;
+        }
+        hchild = avl_relayout_child_height(copy, height, dir);
+        if (depth > 1) {
+            avl_relayout_hang(ctx, child, hchild, depth - 1, levels);
+        } else {
+            avl_relayout_veb(ctx, copy, dir, child, hchild, levels);
+        }
+    }
+}
+
+
+/** @brief Lay out the first @p levels levels of the subtree at @p node in van
+ *      Emde Boas order: recursively, the top half of those levels, then each
+ *      subtree below them
+ *  @param ctx
+ *      Relayout state
+ *  @param parent
+ *      The parent's copy, or NULL for the root
+ *  @param dir
+ *      Which child of @p parent the node is
+ *  @param node
+ *      Subtree root, not yet relocated
+ *  @param height
+ *      Height of the subtree
+ *  @param levels
+ *      Number of levels to lay out, which is at least one
+ */
+static void avl_relayout_veb(struct avl_relayout *ctx,
+                             struct avl          *parent,
+                             unsigned             dir,
+                             struct avl          *node,
+                             unsigned             height,
+                             unsigned             levels)
+{
+    unsigned top;
+
+    if (levels > height) {
+        levels = height;
+    }
+    if (levels == 1) {
+        avl_relayout_move(ctx, parent, dir, node);
+        return;
+    }
+    top = levels / 2;
+    avl_relayout_veb(ctx, parent, dir, node, height, top);
+    node = parent ? AVL_CHILD(parent, dir) : ctx->root;
+    avl_relayout_hang(ctx, node, height, top, levels - top);
+}
+
+
+struct avl *avl_relayout(struct avl        *root,   avl_layout_t  layout,
+                         void              *buf,    size_t        size,
+                         size_t             offset,
+                         avl_relayout_fn_t *movefn, void         *data)
+{
+    struct avl_relayout ctx;
+    unsigned height;
+
+    if (!root) {
+        return NULL;
+    }
+    ctx.buf = buf;
+    ctx.used = 0;
+    ctx.size = size;
+    ctx.offset = offset;
+    ctx.movefn = movefn;
+    ctx.data = data;
+    ctx.root = NULL;
+    switch (layout) {
+    case AVL_LAYOUT_BFS:
+        avl_relayout_bfs(&ctx, root);
+        break;
+    case AVL_LAYOUT_VEB:
+        height = avl_height(root);
+        avl_relayout_veb(&ctx, NULL, 0, root, height, height);
+        break;
+    }
+    return ctx.root;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#ifndef AVL_LAYOUT_H
+#define AVL_LAYOUT_H
+
+#include <stddef.h>
+#include "avl.h"
+
+
+/** @brief Memory orders for avl_relayout */
+typedef enum {
+    AVL_LAYOUT_BFS,     /* Level by level, each level left to right */
+    AVL_LAYOUT_VEB      /* van Emde Boas: recursively, the top half of the
+                           levels, then every bottom subtree in turn */
+} avl_layout_t;
+
+
+/** @brief Move one element of a tree into the relayout buffer
+ *  @param from
+ *      The element, which is not used again by avl_relayout once this returns.
+ *      You may free(3) it here if it was allocated individually
+ *  @param to
+ *      Its new location. The whole element must be copied, including the
+ *      struct avl, whose child links avl_relayout then fixes up
+ *  @param data
+ *      User data
+ */
+typedef void avl_relayout_fn_t(void *from, void *to, void *data);
+
+
+/** @brief Copy every element of a tree into a contiguous buffer, in an order
+ *      chosen so that searches touch few cache lines. Breadth-first order packs
+ *      the top levels, which every search visits, densely. van Emde Boas order
+ *      keeps every subtree of height h within O(2^h) consecutive elements, so
+ *      any root-to-leaf path crosses O(log_B n) blocks for every block size B.
+ *      This is meant to be run while the tree is quiescent
+ *  @param root
+ *      Tree root
+ *  @param layout
+ *      Memory order
+ *  @param buf
+ *      Destination, with room for one element per node. Its alignment must
+ *      suit the elements
+ *  @param size
+ *      Element size, which is also the stride within @p buf
+ *  @param offset
+ *      Offset of the struct avl within each element
+ *  @param movefn
+ *      Called to move each element. If this is NULL, elements are copied with
+ *      memcpy(3)
+ *  @param data
+ *      User data for @p movefn
+ *  @returns The root of the relocated tree, which is also the first element of
+ *      @p buf
+ */
+struct avl *avl_relayout(struct avl        *root,   avl_layout_t  layout,
+                         void              *buf,    size_t        size,
+                         size_t             offset,
+                         avl_relayout_fn_t *movefn, void         *data);
+
+
+#endif /* AVL_LAYOUT_H */
@@ -0,0 +1,552 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl_par.h"
+
+
+/** @brief Pop the most recently queued task. The lock must be held */
+static struct avl_task *avl_workers_pop(struct avl_workers *workers)
+{
+    struct avl_task *task = workers->queue;
+
+    if (task) {
+        workers->queue = task->next;
+    }
+    return task;
+}
+
+
+/** @brief Run @p task and mark it complete. The lock must be held, and is
+ *      released while the task runs
+ */
+static void avl_workers_run(struct avl_workers *workers, struct avl_task *task)
+{
+    pthread_mutex_unlock(&workers->lock);
+    task->fn(task->arg);
+    pthread_mutex_lock(&workers->lock);
+    task->done = 1;
+    pthread_cond_broadcast(&workers->cond);
+}
+
+
+static void avl_workers_spawn(struct avl_exec *exec, struct avl_task *task)
+{
+    struct avl_workers *workers = (struct avl_workers *)exec;
+
+    pthread_mutex_lock(&workers->lock);
+    task->done = 0;
+    task->next = workers->queue;
+    workers->queue = task;
+    pthread_cond_broadcast(&workers->cond);
+    pthread_mutex_unlock(&workers->lock);
+}
+
+
+static void avl_workers_sync(struct avl_exec *exec, struct avl_task *task)
+{
+    struct avl_workers *workers = (struct avl_workers *)exec;
+    struct avl_task *other;
+
+    pthread_mutex_lock(&workers->lock);
+    while (!task->done) {
+        other = avl_workers_pop(workers);
+        if (other) {
+            avl_workers_run(workers, other);
+        } else {
+            pthread_cond_wait(&workers->cond, &workers->lock);
+        }
+    }
+    pthread_mutex_unlock(&workers->lock);
+}
+
+
+/** @brief Worker thread main loop */
+static void *avl_workers_main(void *arg)
+{
+    struct avl_workers *workers = arg;
+    struct avl_task *task;
+
+    pthread_mutex_lock(&workers->lock);
+    while (!workers->stop) {
+        task = avl_workers_pop(workers);
+        if (task) {
+            avl_workers_run(workers, task);
+        } else {
+            pthread_cond_wait(&workers->cond, &workers->lock);
+        }
+    }
+    pthread_mutex_unlock(&workers->lock);
+    return NULL;
+}
+
+
+int avl_workers_init(struct avl_workers *workers, unsigned nthreads)
+{
+    int res;
+
+    workers->exec.spawn = avl_workers_spawn;
+    workers->exec.sync = avl_workers_sync;
+    workers->queue = NULL;
+    workers->nthreads = 0;
+    workers->stop = 0;
+    workers->threads = malloc((nthreads ? nthreads : 1) * sizeof *workers->threads);
+    if (!workers->threads) {
+        return -1;
+    }
+    pthread_mutex_init(&workers->lock, NULL);
+    pthread_cond_init(&workers->cond, NULL);
+    for (; workers->nthreads < nthreads; workers->nthreads++) {
+        res = pthread_create(&workers->threads[workers->nthreads], NULL,
+                             avl_workers_main, workers);
+        if (res) {
+            avl_workers_destroy(workers);
+            return res;
+        }
+    }
+    return 0;
+}
+
+
+void avl_workers_destroy(struct avl_workers *workers)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&workers->lock);
+    workers->stop = 1;
+    pthread_cond_broadcast(&workers->cond);
+    pthread_mutex_unlock(&workers->lock);
+    for (i = 0; i < workers->nthreads; i++) {
+        pthread_join(workers->threads[i], NULL);
+    }
+    pthread_cond_destroy(&workers->cond);
+    pthread_mutex_destroy(&workers->lock);
+    free(workers->threads);
+    workers->threads = NULL;
+    workers->nthreads = 0;
+}
+
+
+typedef enum {
+    AVL_PAR_UNION,
+    AVL_PAR_INTERSECT,
+    AVL_PAR_DIFFERENCE
+} avl_setop_t;
+
+
+/** @brief Arguments and result of one parallel set operation subproblem */
+struct avl_setop {
+    avl_setop_t      op;        /* Operation */
+    struct avl      *t1;        /* Tree being modified; the result goes here */
+    struct avl      *t2;        /* Other tree */
+    avl_cmpfn_t     *cmpfn;     /* Comparison function */
+    avl_joinfn_t    *joinfn;    /* Join function */
+    avl_dropfn_t    *dropfn;    /* Drop function */
+    void            *data;      /* Drop function data */
+    struct avl_exec *exec;      /* Executor */
+    size_t           grain;     /* Sequential cutoff */
+};
+
+
+/** @brief Determine if trees of heights @p h1 and @p h2 are small enough that
+ *      an operation on them should run sequentially
+ */
+static int avl_par_small(unsigned h1, unsigned h2, size_t grain)
+{
+    unsigned h = h1 > h2 ? h1 : h2;
+
+    return h < sizeof (size_t) * CHAR_BIT && ((size_t)1 << h) - 1 <= grain;
+}
+
+
+/** @brief Run the sequential version of a set operation */
+static void avl_setop_seq(struct avl_setop *s)
+{
+    switch (s->op) {
+    case AVL_PAR_UNION:
+        avl_union(&s->t1, s->t2, s->cmpfn, s->joinfn);
+        break;
+    case AVL_PAR_INTERSECT:
+        avl_intersect(&s->t1, s->t2, s->cmpfn, s->joinfn, s->dropfn, s->data);
+        break;
+    case AVL_PAR_DIFFERENCE:
+        avl_difference(&s->t1, s->t2, s->cmpfn, s->dropfn, s->data);
+        break;
+    }
+}
+
+
+/** @brief Solve a set operation subproblem, splitting it in two and spawning
+ *      one half while it is large enough. This mirrors the recursion in avl.c
+ *      step for step, so the resulting tree is the same
+ */
+static void avl_setop_run(void *arg)
+{
+    struct avl_setop *s = arg, sub[2];
+    struct avl_task task;
+    struct avl *pivot, *dup, *l, *r;
+
+    if (!s->t1 || !s->t2 || !s->exec
+     || avl_par_small(avl_height(s->t1), avl_height(s->t2), s->grain)) {
+        avl_setop_seq(s);
+        return;
+    }
+    sub[0] = sub[1] = *s;
+    /* Union and intersection split the second tree by the root of the first,
+    and difference does the opposite */
+    if (s->op == AVL_PAR_DIFFERENCE) {
+        pivot = s->t2;
+        dup = avl_split(s->t1, pivot, s->cmpfn, &sub[0].t1, &sub[1].t1);
+        sub[0].t2 = AVL_CHILD(pivot, 0);
+        sub[1].t2 = AVL_CHILD(pivot, 1);
+    } else {
+        pivot = s->t1;
+        dup = avl_split(s->t2, pivot, s->cmpfn, &sub[0].t2, &sub[1].t2);
+        sub[0].t1 = AVL_CHILD(pivot, 0);
+        sub[1].t1 = AVL_CHILD(pivot, 1);
+    }
+    task.fn = avl_setop_run;
+    task.arg = &sub[0];
+    s->exec->spawn(s->exec, &task);
+    avl_setop_run(&sub[1]);
+    s->exec->sync(s->exec, &task);
+    l = sub[0].t1;
+    r = sub[1].t1;
+    switch (s->op) {
+    case AVL_PAR_UNION:
+        if (dup && s->joinfn) {
+            s->joinfn(&pivot, dup);
+        }
+        s->t1 = avl_join(l, pivot, r);
+        break;
+    case AVL_PAR_INTERSECT:
+        if (!dup) {
+            if (s->dropfn) {
+                s->dropfn(pivot, s->data);
+            }
+            s->t1 = avl_concat(l, r);
+            break;
+        }
+        if (s->joinfn) {
+            s->joinfn(&pivot, dup);
+        } else if (s->dropfn) {
+            s->dropfn(dup, s->data);
+        }
+        s->t1 = avl_join(l, pivot, r);
+        break;
+    case AVL_PAR_DIFFERENCE:
+        if (s->dropfn) {
+            s->dropfn(pivot, s->data);
+            if (dup) {
+                s->dropfn(dup, s->data);
+            }
+        }
+        s->t1 = avl_concat(l, r);
+        break;
+    }
+}
+
+
+/** @brief Set up and run a parallel set operation */
+static void avl_setop(avl_setop_t      op,
+                      struct avl     **root,  struct avl   *other,
+                      avl_cmpfn_t     *cmpfn, avl_joinfn_t *joinfn,
+                      avl_dropfn_t    *dropfn, void        *data,
+                      struct avl_exec *exec,  size_t        grain)
+{
+    struct avl_setop s;
+
+    s.op = op;
+    s.t1 = *root;
+    s.t2 = other;
+    s.cmpfn = cmpfn;
+    s.joinfn = joinfn;
+    s.dropfn = dropfn;
+    s.data = data;
+    s.exec = exec;
+    s.grain = grain ? grain : AVL_PAR_GRAIN;
+    avl_setop_run(&s);
+    *root = s.t1;
+}
+
+
+void avl_par_union(struct avl      **root,  struct avl   *other,
+                   avl_cmpfn_t      *cmpfn, avl_joinfn_t *joinfn,
+                   struct avl_exec  *exec,  size_t        grain)
+{
+    avl_setop(AVL_PAR_UNION, root, other, cmpfn, joinfn, NULL, NULL, exec, grain);
+}
+
+
+void avl_par_intersect(struct avl      **root,   struct avl   *other,
+                       avl_cmpfn_t      *cmpfn,  avl_joinfn_t *joinfn,
+                       avl_dropfn_t     *dropfn, void         *data,
+                       struct avl_exec  *exec,   size_t        grain)
+{
+    avl_setop(AVL_PAR_INTERSECT, root, other, cmpfn, joinfn, dropfn, data,
+              exec, grain);
+}
+
+
+void avl_par_difference(struct avl      **root,   struct avl *other,
+                        avl_cmpfn_t      *cmpfn,
+                        avl_dropfn_t     *dropfn, void       *data,
+                        struct avl_exec  *exec,   size_t      grain)
+{
+    avl_setop(AVL_PAR_DIFFERENCE, root, other, cmpfn, NULL, dropfn, data,
+              exec, grain);
+}
+
+
+/** @brief Arguments and result of one parallel build subproblem */
+struct avl_buildop {
+    struct avl     **nodes;     /* Sorted nodes */
+    size_t           n;         /* Number of nodes */
+    struct avl_exec *exec;      /* Executor */
+    size_t           grain;     /* Sequential cutoff */
+    struct avl      *root;      /* Result */
+};
+
+
+/** @brief Build a subtree, splitting at the same midpoint avl_build_sorted
+ *      uses so that the shape is identical
+ */
+static void avl_buildop_run(void *arg)
+{
+    struct avl_buildop *b = arg, sub[2];
+    struct avl_task task;
+    size_t mid;
+
+    if (!b->exec || b->n <= b->grain) {
+        b->root = avl_build_sorted(b->nodes, b->n);
+        return;
+    }
+    mid = (b->n - 1) / 2;
+    sub[0] = sub[1] = *b;
+    sub[0].n = mid;
+    sub[1].nodes = b->nodes + mid + 1;
+    sub[1].n = b->n - mid - 1;
+    task.fn = avl_buildop_run;
+    task.arg = &sub[0];
+    b->exec->spawn(b->exec, &task);
+    avl_buildop_run(&sub[1]);
+    b->exec->sync(b->exec, &task);
+    b->root = avl_join(sub[0].root, b->nodes[mid], sub[1].root);
+}
+
+
+struct avl *avl_par_build_sorted(struct avl     **nodes, size_t n,
+                                 struct avl_exec *exec,  size_t grain)
+{
+    struct avl_buildop b;
+
+    b.nodes = nodes;
+    b.n = n;
+    b.exec = exec;
+    b.grain = grain ? grain : AVL_PAR_GRAIN;
+    avl_buildop_run(&b);
+    return b.root;
+}
+
+
+/** @brief Determine if the subtree at @p node, of height @p h, should be
+ *      traversed sequentially
+ */
+static int avl_par_leaf(const struct avl *node, unsigned h, size_t grain)
+{
+#ifdef AVL_SIZE
+    (void)h;
+    return node->size <= grain;
+#else
+    (void)node;
+    return avl_par_small(h, 0, grain);
+#endif
+}
+
+
+/** @brief Shared state of a parallel traversal */
+struct avl_walkctx {
+    avl_iterfn_t    *fn;        /* Callback */
+    void            *data;      /* Callback data */
+    atomic_int       res;       /* First nonzero callback result */
+    struct avl_exec *exec;      /* Executor */
+    size_t           grain;     /* Sequential cutoff */
+};
+
+
+/** @brief One parallel traversal subproblem */
+struct avl_walkop {
+    struct avl_walkctx *ctx;    /* Shared state */
+    struct avl         *node;   /* Subtree root */
+    unsigned            height; /* Its height */
+};
+
+
+/** @brief Sequential traversal callback, which also stops once any other
+ *      subproblem has stopped
+ */
+static int avl_walkop_visit(struct avl *node, void *arg)
+{
+    struct avl_walkctx *ctx = arg;
+    int res, zero = 0;
+
+    res = atomic_load_explicit(&ctx->res, memory_order_relaxed);
+    if (res) {
+        return res;
+    }
+    res = ctx->fn(node, ctx->data);
+    if (res) {
+        atomic_compare_exchange_strong(&ctx->res, &zero, res);
+    }
+    return res;
+}
+
+
+/** @brief Traverse a subtree, spawning its right half while it is large */
+static void avl_walkop_run(void *arg)
+{
+    struct avl_walkop *w = arg, sub;
+    struct avl_walkctx *ctx = w->ctx;
+    struct avl_task task;
+    struct avl *node = w->node;
+
+    if (!node) {
+        return;
+    }
+    if (avl_par_leaf(node, w->height, ctx->grain)) {
+        avl_foreach(node, AVL_INORDER, avl_walkop_visit, ctx);
+        return;
+    }
+    sub.ctx = ctx;
+    sub.node = AVL_CHILD(node, 1);
+    sub.height = w->height - 1 - (AVL_BALANCE(node) < 0);
+    task.fn = avl_walkop_run;
+    task.arg = &sub;
+    ctx->exec->spawn(ctx->exec, &task);
+    avl_walkop_visit(node, ctx);
+    w->node = AVL_CHILD(node, 0);
+    w->height -= 1 + (AVL_BALANCE(node) > 0);
+    avl_walkop_run(w);
+    ctx->exec->sync(ctx->exec, &task);
+}
+
+
+int avl_par_foreach(struct avl      *root, avl_iterfn_t *fn,
+                    void            *data,
+                    struct avl_exec *exec, size_t        grain)
+{
+    struct avl_walkctx ctx;
+    struct avl_walkop w;
+
+    if (!exec) {
+        return avl_foreach(root, AVL_INORDER, fn, data);
+    }
+    ctx.fn = fn;
+    ctx.data = data;
+    atomic_init(&ctx.res, 0);
+    ctx.exec = exec;
+    ctx.grain = grain ? grain : AVL_PAR_GRAIN;
+    w.ctx = &ctx;
+    w.node = root;
+    w.height = avl_height(root);
+    avl_walkop_run(&w);
+    return atomic_load(&ctx.res);
+}
+
+
+/** @brief Shared state of a parallel reduction */
+struct avl_reducectx {
+    avl_mapfn_t     *mapfn;     /* Map function */
+    avl_combinefn_t *combinefn; /* Combine function */
+    const void      *identity;  /* Initial accumulator */
+    size_t           size;      /* Accumulator size */
+    void            *data;      /* User data */
+    struct avl_exec *exec;      /* Executor */
+    size_t           grain;     /* Sequential cutoff */
+};
+
+
+/** @brief One parallel reduction subproblem */
+struct avl_reduceop {
+    struct avl_reducectx *ctx;      /* Shared state */
+    struct avl           *node;     /* Subtree root */
+    unsigned              height;   /* Its height */
+    void                 *acc;      /* Accumulator to fold the subtree into */
+};
+
+
+/** @brief Sequential reduction callback */
+static int avl_reduceop_visit(struct avl *node, void *arg)
+{
+    struct avl_reduceop *r = arg;
+
+    r->ctx->mapfn(r->acc, node, r->ctx->data);
+    return 0;
+}
+
+
+/** @brief Fold a subtree into r->acc in order. The right half is spawned into a
+ *      fresh accumulator while this thread folds the left half and the root
+ *      straight into r->acc, and the two are combined after the sync
+ */
+static void avl_reduceop_run(void *arg)
+{
+    struct avl_reduceop *r = arg, sub;
+    struct avl_reducectx *ctx = r->ctx;
+    struct avl_task task;
+    struct avl *node = r->node;
+
+    if (!node) {
+        return;
+    }
+    sub.acc = NULL;
+    if (!avl_par_leaf(node, r->height, ctx->grain)) {
+        sub.acc = malloc(ctx->size);
+    }
+    if (!sub.acc) {
+        avl_foreach(node, AVL_INORDER, avl_reduceop_visit, r);
+        return;
+    }
+    memcpy(sub.acc, ctx->identity, ctx->size);
+    sub.ctx = ctx;
+    sub.node = AVL_CHILD(node, 1);
+    sub.height = r->height - 1 - (AVL_BALANCE(node) < 0);
+    task.fn = avl_reduceop_run;
+    task.arg = &sub;
+    ctx->exec->spawn(ctx->exec, &task);
+    r->node = AVL_CHILD(node, 0);
+    r->height -= 1 + (AVL_BALANCE(node) > 0);
+    avl_reduceop_run(r);
+    ctx->mapfn(r->acc, node, ctx->data);
+    ctx->exec->sync(ctx->exec, &task);
+    ctx->combinefn(r->acc, sub.acc, ctx->data);
+    free(sub.acc);
+}
+
+
+void avl_par_reduce(struct avl      *root,   avl_mapfn_t     *mapfn,
+                    avl_combinefn_t *combinefn,
+                    const void      *identity, void          *result,
+                    size_t           size,   void            *data,
+                    struct avl_exec *exec,   size_t           grain)
+{
+    struct avl_reducectx ctx;
+    struct avl_reduceop r;
+
+    ctx.mapfn = mapfn;
+    ctx.combinefn = combinefn;
+    ctx.identity = identity;
+    ctx.size = size;
+    ctx.data = data;
+    ctx.exec = exec;
+    ctx.grain = grain ? grain : AVL_PAR_GRAIN;
+    memcpy(result, identity, size);
+    r.ctx = &ctx;
+    r.node = root;
+    r.height = avl_height(root);
+    r.acc = result;
+    if (!exec) {
+        avl_foreach(root, AVL_INORDER, avl_reduceop_visit, &r);
+        return;
+    }
+    avl_reduceop_run(&r);
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#ifndef AVL_PAR_H
+#define AVL_PAR_H
+
+#include <pthread.h>
+#include "avl.h"
+
+
+/** @brief A unit of work handed to an executor */
+typedef void avl_taskfn_t(void *arg);
+
+
+/** @brief A task. This is always allocated by the caller of spawn, and stays
+ *      valid until the matching sync returns
+ */
+struct avl_task {
+    avl_taskfn_t    *fn;    /* Task function */
+    void            *arg;   /* Task argument */
+    struct avl_task *next;  /* Reserved for the executor */
+    int              done;  /* Reserved for the executor */
+};
+
+
+/** @brief Fork-join executor used by the parallel operations. Any scheduler can
+ *      be plugged in by filling in these hooks
+ */
+struct avl_exec {
+    /** @brief Start running @p task, possibly on another thread. Running it
+     *      synchronously right here is also acceptable
+     */
+    void (*spawn)(struct avl_exec *exec, struct avl_task *task);
+
+    /** @brief Return once @p task, which was passed to spawn, has finished */
+    void (*sync)(struct avl_exec *exec, struct avl_task *task);
+};
+
+
+/** @brief A fixed pool of worker threads sharing one task stack. A thread
+ *      waiting in sync runs queued tasks while it waits, so the caller's
+ *      thread works too
+ */
+struct avl_workers {
+    struct avl_exec  exec;      /* Executor interface. Pass &workers.exec */
+    pthread_mutex_t  lock;      /* Guards everything below */
+    pthread_cond_t   cond;      /* Signalled on new tasks and completions */
+    struct avl_task *queue;     /* Pending tasks, most recent first */
+    pthread_t       *threads;   /* Worker threads */
+    unsigned         nthreads;  /* Number of worker threads */
+    int              stop;      /* Set on shutdown */
+};
+
+
+/** @brief Default cutoff for the parallel operations. Subproblems that are
+ *      smaller than this many nodes are solved sequentially
+ */
+#define AVL_PAR_GRAIN 16384
+
+
+/** @brief Start a worker pool
+ *  @param workers
+ *      Pool to initialize
+ *  @param nthreads
+ *      Number of threads to start in addition to the caller's
+ *  @returns Zero on success, or an error number from pthread_create(3)
+ */
+int avl_workers_init(struct avl_workers *workers, unsigned nthreads);
+
+
+/** @brief Stop and join the worker threads. No task may still be running
+ *  @param workers
+ *      Pool to destroy
+ */
+void avl_workers_destroy(struct avl_workers *workers);
+
+
+/** @brief Parallel avl_union. The result is identical to the sequential one
+ *  @param root
+ *      Address of the tree root pointer
+ *  @param other
+ *      Tree to merge in. This is consumed
+ *  @param cmpfn
+ *      Comparison function
+ *  @param joinfn
+ *      Join function as for avl_union. It may be called from several threads
+ *      at once
+ *  @param exec
+ *      Executor. If this is NULL, the operation runs sequentially
+ *  @param grain
+ *      Subproblems smaller than this many nodes run sequentially. Zero selects
+ *      AVL_PAR_GRAIN
+ */
+void avl_par_union(struct avl      **root,  struct avl   *other,
+                   avl_cmpfn_t      *cmpfn, avl_joinfn_t *joinfn,
+                   struct avl_exec  *exec,  size_t        grain);
+
+
+/** @brief Parallel avl_intersect. The result is identical to the sequential
+ *      one. @p joinfn and @p dropfn may be called from several threads at once
+ *  @see avl_par_union for @p exec and @p grain
+ */
+void avl_par_intersect(struct avl      **root,   struct avl   *other,
+                       avl_cmpfn_t      *cmpfn,  avl_joinfn_t *joinfn,
+                       avl_dropfn_t     *dropfn, void         *data,
+                       struct avl_exec  *exec,   size_t        grain);
+
+
+/** @brief Parallel avl_difference. The result is identical to the sequential
+ *      one. @p dropfn may be called from several threads at once
+ *  @see avl_par_union for @p exec and @p grain
+ */
+void avl_par_difference(struct avl      **root,   struct avl *other,
+                        avl_cmpfn_t      *cmpfn,
+                        avl_dropfn_t     *dropfn, void       *data,
+                        struct avl_exec  *exec,   size_t      grain);
+
+
+/** @brief Parallel avl_build_sorted. The tree built is identical to the
+ *      sequential one
+ *  @see avl_par_union for @p exec and @p grain
+ */
+struct avl *avl_par_build_sorted(struct avl     **nodes, size_t n,
+                                 struct avl_exec *exec,  size_t grain);
+
+
+/** @brief Call @p fn on every node, splitting the tree at the subtrees near
+ *      the root and traversing them on the executor. Nodes are visited in no
+ *      particular order. With AVL_SIZE the split points come from the exact
+ *      subtree sizes, otherwise from bounds on them derived from the heights
+ *  @param root
+ *      Tree root
+ *  @param fn
+ *      Callback, which may be called from several threads at once. Returning
+ *      nonzero stops the traversal, although the nodes other threads are
+ *      visiting at the time still get called
+ *  @param data
+ *      Callback data
+ *  @param exec
+ *      Executor. If this is NULL, the tree is traversed sequentially
+ *  @param grain
+ *      Subtrees smaller than this many nodes are traversed sequentially. Zero
+ *      selects AVL_PAR_GRAIN
+ *  @returns A nonzero value returned by a callback, or zero
+ */
+int avl_par_foreach(struct avl      *root, avl_iterfn_t *fn,
+                    void            *data,
+                    struct avl_exec *exec, size_t        grain);
+
+
+/** @brief Fold @p node into the accumulator @p acc */
+typedef void avl_mapfn_t(void *acc, struct avl *node, void *data);
+
+
+/** @brief Fold the accumulator @p right into @p left. Every node folded into
+ *      @p left comes before every node folded into @p right in order
+ */
+typedef void avl_combinefn_t(void *left, const void *right, void *data);
+
+
+/** @brief Reduce the tree in parallel, in order: the result is the same as
+ *      folding every node into @p identity in order with @p mapfn, provided
+ *      that @p combinefn is associative and @p identity is neutral for it.
+ *      Neither needs to be commutative. Work is split as by avl_par_foreach,
+ *      and each split costs one accumulator and one call to @p combinefn
+ *  @param root
+ *      Tree root
+ *  @param mapfn
+ *      Function folding one node into an accumulator
+ *  @param combinefn
+ *      Function folding an accumulator into another
+ *  @param identity
+ *      Initial value of every accumulator
+ *  @param result
+ *      Receives the result. This is also the outermost accumulator
+ *  @param size
+ *      Size of an accumulator in bytes. They are copied with memcpy(3)
+ *  @param data
+ *      Data passed to @p mapfn and @p combinefn, which may be called from
+ *      several threads at once
+ *  @see avl_par_foreach for @p exec and @p grain. If an accumulator cannot be
+ *      allocated, that subtree is reduced sequentially instead
+ */
+void avl_par_reduce(struct avl      *root,   avl_mapfn_t     *mapfn,
+                    avl_combinefn_t *combinefn,
+                    const void      *identity, void          *result,
+                    size_t           size,   void            *data,
+                    struct avl_exec *exec,   size_t           grain);
+
+
+#endif /* AVL_PAR_H */
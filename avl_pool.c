@@ -0,0 +1,226 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl_pool.h"
+
+
+/** @brief A type with the strictest alignment any element might need */
+union avl_pool_align {
+    long double  ld;
+    long long    ll;
+    void        *ptr;
+    void       (*fn)(void);
+};
+
+
+/** @brief Header at the start of every chunk */
+struct avl_pool_chunk {
+    struct avl_pool_chunk *next;    /* The next older chunk */
+};
+
+
+void avl_pool_init(struct avl_pool *pool, size_t size, size_t count)
+{
+    const size_t unit = sizeof (union avl_pool_align);
+
+    if (size < sizeof (void *)) {
+        size = sizeof (void *);
+    }
+    pool->size = (size + unit - 1) / unit * unit;
+    pool->count = count ? count : 65536 / pool->size;
+    if (!pool->count) {
+        pool->count = 1;
+    }
+    pool->chunks = NULL;
+    pool->free = NULL;
+    pool->bump = NULL;
+    pool->end = NULL;
+    pool->live = 0;
+}
+
+
+void avl_pool_destroy(struct avl_pool *pool)
+{
+    struct avl_pool_chunk *chunk, *next;
+
+    for (chunk = pool->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    avl_pool_init(pool, pool->size, pool->count);
+}
+
+
+/** @brief Add a chunk to @p pool and start bump-allocating from it
+ *  @returns Zero on success, or -1 if malloc(3) failed
+ */
+static int avl_pool_grow(struct avl_pool *pool)
+{
+    struct avl_pool_chunk *chunk;
+    uintptr_t first;
+
+    chunk = malloc(sizeof *chunk + AVL_POOL_ALIGN - 1 + pool->size * pool->count);
+    if (!chunk) {
+        return -1;
+    }
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    first = (uintptr_t)(chunk + 1);
+    first = (first + AVL_POOL_ALIGN - 1) & ~(uintptr_t)(AVL_POOL_ALIGN - 1);
+    pool->bump = (char *)first;
+    pool->end = pool->bump + pool->size * pool->count;
+    return 0;
+}
+
+
+void *avl_pool_alloc(struct avl_pool *pool)
+{
+    void *elem;
+
+    if (pool->free) {
+        elem = pool->free;
+        memcpy(&pool->free, elem, sizeof pool->free);
+    } else {
+        if (pool->bump == pool->end && avl_pool_grow(pool)) {
+            return NULL;
+        }
+        elem = pool->bump;
+        pool->bump += pool->size;
+    }
+    pool->live++;
+    return memset(elem, 0, pool->size);
+}
+
+
+void avl_pool_free(struct avl_pool *pool, void *elem)
+{
+    if (elem) {
+        memcpy(elem, &pool->free, sizeof pool->free);
+        pool->free = elem;
+        pool->live--;
+    }
+}
+
+
+/** @brief State shared by the steps of a relocation */
+struct avl_pool_move {
+    struct avl_pool   *src;     /* Pool the tree is leaving */
+    void             **next;    /* Next preallocated destination element */
+    size_t             offset;  /* Offset of the node in each element */
+    avl_pool_movefn_t *movefn;  /* User callback, or NULL */
+    void              *data;    /* User data */
+};
+
+
+/** @brief Count the nodes of a tree */
+static int avl_pool_count(struct avl *node, void *data)
+{
+    (void)node;
+    ++*(size_t *)data;
+    return 0;
+}
+
+
+/** @brief Copy the subtree at @p node in preorder, freeing the originals
+ *  @param move
+ *      Relocation state
+ *  @param node
+ *      Subtree root, which may be NULL
+ *  @param parent
+ *      The copy's parent
+ *  @returns The root of the copied subtree
+ */
+static struct avl *avl_pool_copy(struct avl_pool_move *move,
+                                 struct avl           *node,
+                                 struct avl           *parent)
+{
+    char *from, *to;
+    struct avl *copy;
+
+    if (!node) {
+        return NULL;
+    }
+    from = (char *)node - move->offset;
+    to = *move->next++;
+    memcpy(to, from, move->src->size);
+    copy = (struct avl *)(to + move->offset);
+#ifdef AVL_PARENT
+    AVL_SET_PARENT_OF(copy, parent);
+#else
+    (void)parent;
+#endif
+    AVL_SET_CHILD(copy, 0, avl_pool_copy(move, AVL_CHILD(node, 0), copy));
+    AVL_SET_CHILD(copy, 1, avl_pool_copy(move, AVL_CHILD(node, 1), copy));
+    if (move->movefn) {
+        move->movefn(from, to, move->data);
+    }
+    avl_pool_free(move->src, from);
+    return copy;
+}
+
+
+int avl_pool_relocate(struct avl_pool   *dst,    struct avl_pool *src,
+                      struct avl       **root,   size_t           offset,
+                      avl_pool_movefn_t *movefn, void            *data)
+{
+    struct avl_pool_move move;
+    void **elems;
+    size_t n = 0, i;
+
+    avl_foreach(*root, AVL_PREORDER, avl_pool_count, &n);
+    if (!n) {
+        return 0;
+    }
+    /* Allocate everything first, so that failure leaves the tree alone */
+    elems = malloc(n * sizeof *elems);
+    if (!elems) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        elems[i] = avl_pool_alloc(dst);
+        if (!elems[i]) {
+            while (i--) {
+                avl_pool_free(dst, elems[i]);
+            }
+            free(elems);
+            return -1;
+        }
+    }
+    move.src = src;
+    move.next = elems;
+    move.offset = offset;
+    move.movefn = movefn;
+    move.data = data;
+    *root = avl_pool_copy(&move, *root, NULL);
+    free(elems);
+    return 0;
+}
+
+
+int avl_pool_compact(struct avl_pool   *pool,   struct avl **root,
+                     size_t             offset,
+                     avl_pool_movefn_t *movefn, void        *data)
+{
+    struct avl_pool fresh;
+    struct avl_pool_chunk *last;
+
+    avl_pool_init(&fresh, pool->size, pool->count);
+    if (avl_pool_relocate(&fresh, pool, root, offset, movefn, data)) {
+        avl_pool_destroy(&fresh);
+        return -1;
+    }
+    if (!pool->live) {
+        avl_pool_destroy(pool);
+    } else if (fresh.chunks) {
+        /* Other elements still live in the old chunks, so keep them, along
+        with their free slots, behind the new ones */
+        for (last = fresh.chunks; last->next; last = last->next);
+        last->next = pool->chunks;
+        fresh.free = pool->free;
+        fresh.live += pool->live;
+    } else {
+        return 0;
+    }
+    *pool = fresh;
+    return 0;
+}
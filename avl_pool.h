@@ -0,0 +1,119 @@
+#pragma once
+
+#ifndef AVL_POOL_H
+#define AVL_POOL_H
+
+#include <stddef.h>
+#include "avl.h"
+
+
+/** @brief Alignment of each chunk's first element, in bytes */
+#define AVL_POOL_ALIGN 64
+
+
+/** @brief A slab allocator of fixed-size elements, such as tree nodes with
+ *      their payload. Elements are carved from large cache-line-aligned chunks
+ *      and recycled through a free list, so nodes allocated together sit
+ *      together in memory, and the whole pool is released in O(chunks)
+ *      without walking any tree.
+ *
+ *      A pool is not synchronized. Give each producer thread its own pool; the
+ *      pools share nothing, and a tree may freely mix nodes from several
+ *      pools, as long as each is freed back to the pool it came from
+ */
+struct avl_pool {
+    size_t  size;       /* Element size, rounded up for alignment */
+    size_t  count;      /* Elements per chunk */
+    void   *chunks;     /* Chunks, most recent first */
+    void   *free;       /* Freed elements, most recent first */
+    char   *bump;       /* Next never-used element of the newest chunk */
+    char   *end;        /* End of the newest chunk */
+    size_t  live;       /* Elements currently allocated */
+};
+
+
+/** @brief Called for each element relocated by avl_pool_relocate
+ *  @param from
+ *      The old element. Its payload is still intact, but its children have
+ *      already moved. It is freed after this returns
+ *  @param to
+ *      Its copy
+ *  @param data
+ *      User data
+ */
+typedef void avl_pool_movefn_t(void *from, void *to, void *data);
+
+
+/** @brief Initialize an empty pool. This does not allocate
+ *  @param pool
+ *      Pool to initialize
+ *  @param size
+ *      Element size, which must be nonzero
+ *  @param count
+ *      Number of elements in each chunk, or zero for a chunk of roughly 64 KiB
+ */
+void avl_pool_init(struct avl_pool *pool, size_t size, size_t count);
+
+
+/** @brief Release every chunk of @p pool at once. All of its elements become
+ *      invalid, and the pool is left empty and ready for reuse
+ *  @param pool
+ *      Pool to clear
+ */
+void avl_pool_destroy(struct avl_pool *pool);
+
+
+/** @brief Allocate a zeroed element, ready to be inserted as a node
+ *  @param pool
+ *      Pool to allocate from
+ *  @returns The element, or NULL if a new chunk was needed and malloc(3)
+ *      failed
+ */
+void *avl_pool_alloc(struct avl_pool *pool);
+
+
+/** @brief Return @p elem to @p pool for reuse
+ *  @param pool
+ *      The pool @p elem was allocated from
+ *  @param elem
+ *      Element to free, which may be NULL
+ */
+void avl_pool_free(struct avl_pool *pool, void *elem);
+
+
+/** @brief Copy every element of a tree into @p dst, in preorder so that each
+ *      node lands right next to its left child, and free the originals back to
+ *      @p src. This restores locality to a tree whose nodes have been scattered
+ *      by churn
+ *  @param dst
+ *      Pool to copy into. This must have the same element size as @p src
+ *  @param src
+ *      Pool holding every node of the tree
+ *  @param root
+ *      Address of the tree root pointer, which is updated
+ *  @param offset
+ *      Offset of the struct avl within each element
+ *  @param movefn
+ *      Called on every element moved, so that outside references to it can be
+ *      updated. This may be NULL
+ *  @param data
+ *      User data for @p movefn
+ *  @returns Zero on success, or -1 if allocation failed, in which case the
+ *      tree is unchanged
+ */
+int avl_pool_relocate(struct avl_pool   *dst,    struct avl_pool *src,
+                      struct avl       **root,   size_t           offset,
+                      avl_pool_movefn_t *movefn, void            *data);
+
+
+/** @brief Relocate a tree within its own pool. The tree is copied into fresh
+ *      chunks, and if it held every live element of the pool, the old chunks
+ *      are released
+ *  @see avl_pool_relocate for the parameters and the return value
+ */
+int avl_pool_compact(struct avl_pool   *pool,   struct avl **root,
+                     size_t             offset,
+                     avl_pool_movefn_t *movefn, void        *data);
+
+
+#endif /* AVL_POOL_H */
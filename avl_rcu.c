@@ -0,0 +1,154 @@
+#include "avl_rcu.h"
+
+
+#ifndef AVL_PARENT
+
+/** @brief Copy hooks for one update. Replaced nodes are only collected here,
+ *      since they must not be retired before the new version is published
+ */
+struct avl_rcu_cow {
+    struct avl_cow  cow;                        /* Hooks. This comes first */
+    struct avl_rcu *rcu;                        /* Tree */
+    struct avl     *old[3 * AVL_MAX_HEIGHT + 1];/* Nodes to retire */
+    unsigned        len;                        /* Number of nodes in @p old */
+};
+
+
+static struct avl *avl_rcu_copy(struct avl_cow *cow, const struct avl *node)
+{
+    struct avl_rcu *rcu = ((struct avl_rcu_cow *)cow)->rcu;
+
+    return rcu->copyfn(node, rcu->data);
+}
+
+
+static void avl_rcu_retire(struct avl_cow *cow, struct avl *node)
+{
+    struct avl_rcu_cow *op = (struct avl_rcu_cow *)cow;
+
+    op->old[op->len++] = node;
+}
+
+
+static void avl_rcu_discard(struct avl_cow *cow, struct avl *node)
+{
+    struct avl_rcu *rcu = ((struct avl_rcu_cow *)cow)->rcu;
+
+    rcu->freefn(node, rcu->data);
+}
+
+
+/** @brief Free an element for the epoch domain */
+static void avl_rcu_free(void *ptr, void *data)
+{
+    struct avl_rcu *rcu = data;
+
+    rcu->freefn(ptr, rcu->data);
+}
+
+
+int avl_rcu_init(struct avl_rcu   *rcu,    avl_cmpfn_t      *cmpfn,
+                 avl_rcu_copyfn_t *copyfn, avl_rcu_freefn_t *freefn,
+                 void             *data)
+{
+    int err;
+
+    atomic_init(&rcu->root, NULL);
+    rcu->cmpfn = cmpfn;
+    rcu->copyfn = copyfn;
+    rcu->freefn = freefn;
+    rcu->data = data;
+    err = pthread_mutex_init(&rcu->lock, NULL);
+    if (err) {
+        return err;
+    }
+    err = avl_epoch_init(&rcu->epoch, avl_rcu_free, rcu);
+    if (err) {
+        pthread_mutex_destroy(&rcu->lock);
+    }
+    return err;
+}
+
+
+struct avl *avl_rcu_destroy(struct avl_rcu *rcu)
+{
+    avl_epoch_destroy(&rcu->epoch);
+    pthread_mutex_destroy(&rcu->lock);
+    return atomic_load(&rcu->root);
+}
+
+
+struct avl *avl_rcu_lookup(struct avl_rcu *rcu, struct avl *query)
+{
+    return avl_lookup(avl_rcu_root(rcu), query, rcu->cmpfn);
+}
+
+
+/** @brief Start the copy hooks of an update */
+static void avl_rcu_begin(struct avl_rcu_cow *op, struct avl_rcu *rcu)
+{
+    op->cow.copy = avl_rcu_copy;
+    op->cow.retire = avl_rcu_retire;
+    op->cow.discard = avl_rcu_discard;
+    op->rcu = rcu;
+    op->len = 0;
+}
+
+
+/** @brief Publish @p root, release the writer lock, and retire what the new
+ *      version replaced
+ */
+static void avl_rcu_publish(struct avl_rcu          *rcu,
+                            struct avl_epoch_thread *thread,
+                            struct avl_rcu_cow      *op,
+                            struct avl              *root)
+{
+    unsigned i;
+
+    atomic_store_explicit(&rcu->root, root, memory_order_release);
+    pthread_mutex_unlock(&rcu->lock);
+    for (i = 0; i < op->len; i++) {
+        avl_epoch_retire(thread, op->old[i]);
+    }
+}
+
+
+int avl_rcu_insert(struct avl_rcu *rcu, struct avl_epoch_thread *thread, struct avl *node)
+{
+    struct avl_rcu_cow op;
+    struct avl *root;
+    int res;
+
+    avl_rcu_begin(&op, rcu);
+    pthread_mutex_lock(&rcu->lock);
+    root = atomic_load_explicit(&rcu->root, memory_order_relaxed);
+    res = avl_insert_cow(&root, node, rcu->cmpfn, &op.cow);
+    if (res) {
+        pthread_mutex_unlock(&rcu->lock);
+        return res;
+    }
+    avl_rcu_publish(rcu, thread, &op, root);
+    return 0;
+}
+
+
+int avl_rcu_delete(struct avl_rcu *rcu, struct avl_epoch_thread *thread, struct avl *query)
+{
+    struct avl_rcu_cow op;
+    struct avl *root, *removed;
+    int res;
+
+    avl_rcu_begin(&op, rcu);
+    pthread_mutex_lock(&rcu->lock);
+    root = atomic_load_explicit(&rcu->root, memory_order_relaxed);
+    res = avl_delete_cow(&root, query, rcu->cmpfn, &op.cow, &removed);
+    if (res) {
+        pthread_mutex_unlock(&rcu->lock);
+        return res;
+    }
+    op.old[op.len++] = removed;
+    avl_rcu_publish(rcu, thread, &op, root);
+    return 0;
+}
+
+#endif /* AVL_PARENT */
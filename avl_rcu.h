@@ -0,0 +1,117 @@
+#pragma once
+
+#ifndef AVL_RCU_H
+#define AVL_RCU_H
+
+#include <stdatomic.h>
+#include "avl.h"
+#include "avl_epoch.h"
+
+
+#ifndef AVL_PARENT
+
+/** @brief Copy the whole element holding @p node, including the struct avl
+ *  @returns The copy's node, or NULL on failure
+ */
+typedef struct avl *avl_rcu_copyfn_t(const struct avl *node, void *data);
+
+
+/** @brief Free the element holding @p node */
+typedef void avl_rcu_freefn_t(struct avl *node, void *data);
+
+
+/** @brief A tree with any number of lock-free readers and serialized writers.
+ *      Writers never modify a published node: avl_insert_cow and
+ *      avl_delete_cow build a new version that shares every untouched
+ *      subtree, and it is published with one atomic store of the root. Readers
+ *      search whichever version they loaded without taking any lock, and
+ *      replaced nodes are freed through an epoch domain once no reader can
+ *      still hold them.
+ *
+ *      Every thread registers with the domain, with
+ *      avl_epoch_register(&rcu->epoch, &thread), and searches between
+ *      avl_epoch_enter and avl_epoch_exit. Nodes found there stay valid until
+ *      the exit, but must be treated as read-only. This is not available with
+ *      AVL_PARENT
+ */
+struct avl_rcu {
+    struct avl *_Atomic  root;      /* Root of the published version */
+    pthread_mutex_t      lock;      /* Serializes writers */
+    struct avl_epoch     epoch;     /* Reclaims replaced nodes */
+    avl_cmpfn_t         *cmpfn;     /* Comparison function */
+    avl_rcu_copyfn_t    *copyfn;    /* Copies elements */
+    avl_rcu_freefn_t    *freefn;    /* Frees elements */
+    void                *data;      /* User data for @p copyfn and @p freefn */
+};
+
+
+/** @brief Initialize an empty tree
+ *  @param rcu
+ *      Tree to initialize
+ *  @param cmpfn
+ *      Comparison function
+ *  @param copyfn
+ *      Copies an element whenever a writer must change it
+ *  @param freefn
+ *      Frees replaced and removed elements. This may be called from any
+ *      registered thread
+ *  @param data
+ *      User data for @p copyfn and @p freefn
+ *  @returns Zero on success, or an error number from pthread_mutex_init(3)
+ */
+int avl_rcu_init(struct avl_rcu   *rcu,    avl_cmpfn_t      *cmpfn,
+                 avl_rcu_copyfn_t *copyfn, avl_rcu_freefn_t *freefn,
+                 void             *data);
+
+
+/** @brief Destroy a tree, once every thread has been unregistered
+ *  @returns The root of the final version. Its nodes belong to the caller
+ */
+struct avl *avl_rcu_destroy(struct avl_rcu *rcu);
+
+
+/** @brief Get the root of the current version. Call this inside a critical
+ *      section, and use the same root for the whole of a multi-step search
+ */
+static inline struct avl *avl_rcu_root(struct avl_rcu *rcu)
+{
+    return atomic_load_explicit(&rcu->root, memory_order_acquire);
+}
+
+
+/** @brief avl_lookup on the current version, inside a critical section
+ *  @param rcu
+ *      Tree
+ *  @param query
+ *      Test node
+ *  @returns The node comparing equal to @p query, or NULL
+ */
+struct avl *avl_rcu_lookup(struct avl_rcu *rcu, struct avl *query);
+
+
+/** @brief Insert @p node and publish the new version. This blocks other
+ *      writers but no readers
+ *  @param rcu
+ *      Tree
+ *  @param thread
+ *      The calling thread's epoch state
+ *  @param node
+ *      Zeroed node to insert. Once published, it must not be modified
+ *  @returns Zero if @p node was inserted, 1 if an equal node was already in
+ *      the tree, and -1 if an element could not be copied
+ */
+int avl_rcu_insert(struct avl_rcu *rcu, struct avl_epoch_thread *thread, struct avl *node);
+
+
+/** @brief Remove the node comparing equal to @p query and publish the new
+ *      version. The removed element is freed once no reader can hold it
+ *  @returns Zero if a node was removed, 1 if there was none, and -1 if an
+ *      element could not be copied
+ *  @see avl_rcu_insert for the other parameters
+ */
+int avl_rcu_delete(struct avl_rcu *rcu, struct avl_epoch_thread *thread, struct avl *query);
+
+#endif /* AVL_PARENT */
+
+
+#endif /* AVL_RCU_H */
@@ -0,0 +1,327 @@
+#include <errno.h>
+#include <stdlib.h>
+#include "avl_shard.h"
+
+
+/** @brief Allocate an empty shard
+ *  @returns The shard, or NULL with @p err set
+ */
+static struct avl_shard *avl_shard_new(int *err)
+{
+    struct avl_shard *shard;
+
+    shard = malloc(sizeof *shard);
+    if (!shard) {
+        *err = ENOMEM;
+        return NULL;
+    }
+    *err = pthread_mutex_init(&shard->lock, NULL);
+    if (*err) {
+        free(shard);
+        return NULL;
+    }
+    shard->root = NULL;
+    return shard;
+}
+
+
+static void avl_shard_free(struct avl_shard *shard)
+{
+    pthread_mutex_destroy(&shard->lock);
+    free(shard);
+}
+
+
+/** @brief Make room for @p n shards */
+static int avl_sharded_reserve(struct avl_sharded *tree, unsigned n)
+{
+    struct avl_shard **shards;
+    struct avl **bounds;
+    unsigned cap;
+
+    if (n <= tree->cap) {
+        return 0;
+    }
+    cap = tree->cap ? 2 * tree->cap : 8;
+    if (cap < n) {
+        cap = n;
+    }
+    shards = realloc(tree->shards, cap * sizeof *shards);
+    if (!shards) {
+        return ENOMEM;
+    }
+    tree->shards = shards;
+    bounds = realloc(tree->bounds, cap * sizeof *bounds);
+    if (!bounds) {
+        return ENOMEM;
+    }
+    tree->bounds = bounds;
+    tree->cap = cap;
+    return 0;
+}
+
+
+int avl_sharded_init(struct avl_sharded *tree,   avl_cmpfn_t *cmpfn,
+                     struct avl *const  *bounds, unsigned     nbounds)
+{
+    unsigned i;
+    int err;
+
+    tree->cmpfn = cmpfn;
+    tree->shards = NULL;
+    tree->bounds = NULL;
+    tree->nshards = 0;
+    tree->cap = 0;
+    err = avl_sharded_reserve(tree, nbounds + 1);
+    if (!err) {
+        err = pthread_rwlock_init(&tree->lock, NULL);
+    }
+    if (err) {
+        free(tree->shards);
+        free(tree->bounds);
+        return err;
+    }
+    for (i = 0; i <= nbounds; i++) {
+        tree->shards[i] = avl_shard_new(&err);
+        if (!tree->shards[i]) {
+            while (i--) {
+                avl_shard_free(tree->shards[i]);
+            }
+            pthread_rwlock_destroy(&tree->lock);
+            free(tree->shards);
+            free(tree->bounds);
+            return err;
+        }
+        if (i < nbounds) {
+            tree->bounds[i] = bounds[i];
+        }
+    }
+    tree->nshards = nbounds + 1;
+    return 0;
+}
+
+
+struct avl *avl_sharded_destroy(struct avl_sharded *tree)
+{
+    struct avl *root = NULL;
+    unsigned i;
+
+    for (i = 0; i < tree->nshards; i++) {
+        root = avl_concat(root, tree->shards[i]->root);
+        avl_shard_free(tree->shards[i]);
+    }
+    pthread_rwlock_destroy(&tree->lock);
+    free(tree->shards);
+    free(tree->bounds);
+    return root;
+}
+
+
+unsigned avl_sharded_route(const struct avl_sharded *tree, struct avl *key)
+{
+    unsigned lo = 0, hi = tree->nshards - 1, mid;
+
+    /* Count the bounds not greater than the key */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (tree->cmpfn(key, tree->bounds[mid]) < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+
+/** @brief Lock the table shared and the shard responsible for @p key
+ *  @returns The shard
+ */
+static struct avl_shard *avl_sharded_enter(struct avl_sharded *tree, struct avl *key)
+{
+    struct avl_shard *shard;
+
+    pthread_rwlock_rdlock(&tree->lock);
+    shard = tree->shards[avl_sharded_route(tree, key)];
+    pthread_mutex_lock(&shard->lock);
+    return shard;
+}
+
+
+static void avl_sharded_leave(struct avl_sharded *tree, struct avl_shard *shard)
+{
+    pthread_mutex_unlock(&shard->lock);
+    pthread_rwlock_unlock(&tree->lock);
+}
+
+
+int avl_sharded_insert(struct avl_sharded *tree, struct avl *node, avl_joinfn_t *joinfn)
+{
+    struct avl_shard *shard;
+    int res;
+
+    shard = avl_sharded_enter(tree, node);
+    res = avl_insert(&shard->root, node, tree->cmpfn, joinfn);
+    avl_sharded_leave(tree, shard);
+    return res;
+}
+
+
+struct avl *avl_sharded_delete(struct avl_sharded *tree, struct avl *node, avl_delfn_t *delfn)
+{
+    struct avl_shard *shard;
+    struct avl *res;
+
+    shard = avl_sharded_enter(tree, node);
+    res = avl_delete(&shard->root, node, tree->cmpfn, delfn);
+    avl_sharded_leave(tree, shard);
+    return res;
+}
+
+
+struct avl *avl_sharded_lookup(struct avl_sharded *tree, struct avl *query)
+{
+    struct avl_shard *shard;
+    struct avl *res;
+
+    shard = avl_sharded_enter(tree, query);
+    res = avl_lookup(shard->root, query, tree->cmpfn);
+    avl_sharded_leave(tree, shard);
+    return res;
+}
+
+
+int avl_sharded_split(struct avl_sharded *tree, unsigned shard, struct avl *bound)
+{
+    struct avl_shard *fresh;
+    struct avl *left, *right, *mid;
+    unsigned i;
+    int err;
+
+    pthread_rwlock_wrlock(&tree->lock);
+    err = EINVAL;
+    if (shard >= tree->nshards
+     || (shard > 0 && tree->cmpfn(bound, tree->bounds[shard - 1]) <= 0)
+     || (shard < tree->nshards - 1 && tree->cmpfn(bound, tree->bounds[shard]) >= 0)) {
+        goto out;
+    }
+    err = avl_sharded_reserve(tree, tree->nshards + 1);
+    if (err) {
+        goto out;
+    }
+    fresh = avl_shard_new(&err);
+    if (!fresh) {
+        goto out;
+    }
+    mid = avl_split(tree->shards[shard]->root, bound, tree->cmpfn, &left, &right);
+    if (mid) {
+        /* A node equal to the bound belongs to the upper shard */
+        right = avl_join(NULL, mid, right);
+    }
+    tree->shards[shard]->root = left;
+    fresh->root = right;
+    for (i = tree->nshards; i > shard + 1; i--) {
+        tree->shards[i] = tree->shards[i - 1];
+        tree->bounds[i - 1] = tree->bounds[i - 2];
+    }
+    tree->shards[shard + 1] = fresh;
+    tree->bounds[shard] = bound;
+    tree->nshards++;
+out:
+    pthread_rwlock_unlock(&tree->lock);
+    return err;
+}
+
+
+struct avl *avl_sharded_merge(struct avl_sharded *tree, unsigned shard)
+{
+    struct avl_shard *gone;
+    struct avl *bound = NULL;
+    unsigned i;
+
+    pthread_rwlock_wrlock(&tree->lock);
+    if (shard + 1 < tree->nshards) {
+        gone = tree->shards[shard + 1];
+        bound = tree->bounds[shard];
+        tree->shards[shard]->root = avl_concat(tree->shards[shard]->root, gone->root);
+        avl_shard_free(gone);
+        tree->nshards--;
+        for (i = shard + 1; i < tree->nshards; i++) {
+            tree->shards[i] = tree->shards[i + 1];
+            tree->bounds[i - 1] = tree->bounds[i];
+        }
+    }
+    pthread_rwlock_unlock(&tree->lock);
+    return bound;
+}
+
+
+struct avl *avl_sharded_first(struct avl_sharded_cursor *cur, struct avl_sharded *tree)
+{
+    struct avl *node;
+
+    cur->tree = tree;
+    for (cur->shard = 0; cur->shard < tree->nshards; cur->shard++) {
+        node = avl_cursor_first(&cur->cur, tree->shards[cur->shard]->root);
+        if (node) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+
+struct avl *avl_sharded_last(struct avl_sharded_cursor *cur, struct avl_sharded *tree)
+{
+    struct avl *node;
+
+    cur->tree = tree;
+    for (cur->shard = tree->nshards; cur->shard-- > 0; ) {
+        node = avl_cursor_last(&cur->cur, tree->shards[cur->shard]->root);
+        if (node) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+
+struct avl *avl_sharded_next(struct avl_sharded_cursor *cur)
+{
+    struct avl_sharded *tree = cur->tree;
+    struct avl *node;
+
+    node = avl_cursor_next(&cur->cur);
+    while (!node && cur->shard + 1 < tree->nshards) {
+        node = avl_cursor_first(&cur->cur, tree->shards[++cur->shard]->root);
+    }
+    return node;
+}
+
+
+struct avl *avl_sharded_prev(struct avl_sharded_cursor *cur)
+{
+    struct avl_sharded *tree = cur->tree;
+    struct avl *node;
+
+    node = avl_cursor_prev(&cur->cur);
+    while (!node && cur->shard > 0) {
+        node = avl_cursor_last(&cur->cur, tree->shards[--cur->shard]->root);
+    }
+    return node;
+}
+
+
+struct avl *avl_sharded_seek(struct avl_sharded_cursor *cur, struct avl_sharded *tree,
+                             struct avl                *query)
+{
+    struct avl *node;
+
+    cur->tree = tree;
+    cur->shard = avl_sharded_route(tree, query);
+    node = avl_cursor_seek(&cur->cur, tree->shards[cur->shard]->root, query, tree->cmpfn);
+    while (!node && cur->shard + 1 < tree->nshards) {
+        node = avl_cursor_first(&cur->cur, tree->shards[++cur->shard]->root);
+    }
+    return node;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#ifndef AVL_SHARD_H
+#define AVL_SHARD_H
+
+#include <pthread.h>
+#include "avl.h"
+
+
+/** @brief One partition of a sharded tree */
+struct avl_shard {
+    pthread_mutex_t  lock;  /* Guards @p root for the routed operations */
+    struct avl      *root;  /* Tree of the nodes in this shard's range */
+};
+
+
+/** @brief A tree range-partitioned into independent shards, for concurrent
+ *      writers. Shard i holds the nodes comparing at least bounds[i - 1] and
+ *      less than bounds[i], where the missing ends are unbounded, so writers
+ *      to different ranges never contend. Each shard is a plain tree, and
+ *      nothing about rebalancing changes.
+ *
+ *      The routed operations take the table lock shared and one shard's lock.
+ *      Alternatively, a pipeline can give each shard to one worker thread:
+ *      route with avl_sharded_route and let the owner use the shard's root
+ *      directly without locking. Splits and merges take the table lock
+ *      exclusively and renumber the shards after the one they change
+ */
+struct avl_sharded {
+    pthread_rwlock_t   lock;        /* Held exclusively to split or merge */
+    avl_cmpfn_t       *cmpfn;       /* Comparison function */
+    struct avl_shard **shards;      /* Shards in key order */
+    struct avl       **bounds;      /* Least key of each shard but the first */
+    unsigned           nshards;     /* Number of shards */
+    unsigned           cap;         /* Allocated length of @p shards */
+};
+
+
+/** @brief Position in the combined in-order sequence of every shard */
+struct avl_sharded_cursor {
+    struct avl_cursor   cur;        /* Position within the current shard */
+    struct avl_sharded *tree;       /* Tree */
+    unsigned            shard;      /* Index of the current shard */
+};
+
+
+/** @brief Initialize an empty sharded tree
+ *  @param tree
+ *      Tree to initialize
+ *  @param cmpfn
+ *      Comparison function
+ *  @param bounds
+ *      Test nodes separating the shards, in increasing order. They must stay
+ *      valid until merged away or until the tree is destroyed
+ *  @param nbounds
+ *      Number of bounds. The tree has one more shard than this
+ *  @returns Zero on success, or an error number
+ */
+int avl_sharded_init(struct avl_sharded *tree,   avl_cmpfn_t *cmpfn,
+                     struct avl *const  *bounds, unsigned     nbounds);
+
+
+/** @brief Destroy a sharded tree that no thread is using any more
+ *  @param tree
+ *      Tree to destroy
+ *  @returns A single tree holding every node that was left in the shards
+ */
+struct avl *avl_sharded_destroy(struct avl_sharded *tree);
+
+
+/** @brief Find the shard responsible for @p key. The answer stays valid until
+ *      the next split or merge
+ *  @param tree
+ *      Tree
+ *  @param key
+ *      Test node
+ *  @returns The index of the shard
+ */
+unsigned avl_sharded_route(const struct avl_sharded *tree, struct avl *key);
+
+
+/** @brief avl_insert into the shard responsible for @p node
+ *  @see avl_insert for the parameters and result
+ */
+int avl_sharded_insert(struct avl_sharded *tree, struct avl *node, avl_joinfn_t *joinfn);
+
+
+/** @brief avl_delete from the shard responsible for @p node
+ *  @see avl_delete for the parameters and result
+ */
+struct avl *avl_sharded_delete(struct avl_sharded *tree, struct avl *node, avl_delfn_t *delfn);
+
+
+/** @brief avl_lookup in the shard responsible for @p query. The node returned
+ *      is only safe to use for as long as no other thread may delete it
+ *  @see avl_lookup for the parameters and result
+ */
+struct avl *avl_sharded_lookup(struct avl_sharded *tree, struct avl *query);
+
+
+/** @brief Split a shard in two at @p bound. Nodes comparing less than it stay,
+ *      and the rest move to a new shard right after it. This costs O(log n)
+ *      and blocks every other operation meanwhile
+ *  @param tree
+ *      Tree
+ *  @param shard
+ *      Index of the shard to split
+ *  @param bound
+ *      Test node for the new boundary, which must fall strictly inside the
+ *      shard's range. It must stay valid until merged away or until the tree
+ *      is destroyed
+ *  @returns Zero on success, EINVAL if @p shard or @p bound is out of range,
+ *      or ENOMEM
+ */
+int avl_sharded_split(struct avl_sharded *tree, unsigned shard, struct avl *bound);
+
+
+/** @brief Merge shard @p shard with the one after it in O(log n). This blocks
+ *      every other operation meanwhile
+ *  @param tree
+ *      Tree
+ *  @param shard
+ *      Index of the first of the two shards
+ *  @returns The bound that separated them, which the tree no longer uses, or
+ *      NULL if there is no shard after @p shard
+ */
+struct avl *avl_sharded_merge(struct avl_sharded *tree, unsigned shard);
+
+
+/** @brief Position @p cur on the least node of the whole tree. The cursor
+ *      functions take no locks, so no shard may change while a cursor is in
+ *      use, and no split or merge may happen
+ *  @param cur
+ *      Cursor to initialize
+ *  @param tree
+ *      Tree
+ *  @returns The least node, or NULL if every shard is empty
+ */
+struct avl *avl_sharded_first(struct avl_sharded_cursor *cur, struct avl_sharded *tree);
+
+
+/** @brief Position @p cur on the greatest node of the whole tree
+ *  @see avl_sharded_first
+ */
+struct avl *avl_sharded_last(struct avl_sharded_cursor *cur, struct avl_sharded *tree);
+
+
+/** @brief Advance @p cur to the next node, moving on to the following shards
+ *      as each one runs out
+ *  @returns The new current node, or NULL past the end of the last shard
+ */
+struct avl *avl_sharded_next(struct avl_sharded_cursor *cur);
+
+
+/** @brief Move @p cur to the previous node
+ *  @returns The new current node, or NULL before the start of the first shard
+ */
+struct avl *avl_sharded_prev(struct avl_sharded_cursor *cur);
+
+
+/** @brief Position @p cur on the least node not comparing less than @p query
+ *  @returns As for avl_cursor_seek
+ */
+struct avl *avl_sharded_seek(struct avl_sharded_cursor *cur, struct avl_sharded *tree,
+                             struct avl                *query);
+
+
+#endif /* AVL_SHARD_H */
@@ -0,0 +1,875 @@
+/* Throughput and latency percentiles of the core operations, avl_insert,
+ * avl_lookup, avl_foreach and avl_delete, against std::set, std::map and a
+ * B-tree, over several key distributions and tree sizes from 1K up to a limit
+ *
+ *  - random:  distinct pseudo-random keys
+ *  - sorted:  0, 1, 2, ...
+ *  - reverse: n - 1, n - 2, ...
+ *  - zipfian: Zipf-distributed ranks (theta 0.99), scrambled over the key space
+ *  - dups:    pseudo-random keys from only n / 16 distinct values
+ *
+ * Every phase runs twice: once untimed per operation, for the throughput and
+ * the cache-miss count, and once timing a sample of single operations, for
+ * the percentiles, which have the timer overhead printed up front subtracted.
+ * Lookups and deletes replay the insertion sequence. Cache misses come from
+ * perf_event_open(2) and are left out where it is unavailable.
+ *
+ * Built by the avl_bench target of CMakeLists.txt, or by hand with
+ *
+ *     cc -O2 -c avl.c && c++ -O2 -I. bench/avl_bench.cpp avl.o -o avl_bench
+ *
+ * and run as ./avl_bench [max size] [distribution...]. Sizes grow tenfold from
+ * 1000 up to the max size, 1000000 by default, so 100000000 runs the full set
+ * given enough memory. Foreach is reported per node visited
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "avl.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/** @brief Hardware cache-miss counter for the calling thread */
+class miss_counter {
+public:
+    miss_counter(): fd(-1)
+    {
+#ifdef __linux__
+        struct perf_event_attr attr;
+
+        std::memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~miss_counter()
+    {
+#ifdef __linux__
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    bool available() const
+    {
+        return fd >= 0;
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    /** @brief Stop counting
+     *  @returns The misses since start, or zero if unavailable
+     */
+    uint64_t stop()
+    {
+        uint64_t count = 0;
+
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof count) != sizeof count) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+
+private:
+    int fd;
+};
+
+
+typedef std::chrono::steady_clock bench_clock;
+
+
+static double seconds_since(bench_clock::time_point t0)
+{
+    return std::chrono::duration<double>(bench_clock::now() - t0).count();
+}
+
+
+static uint64_t mix(uint64_t x)
+{
+    /* splitmix64 finalizer, a bijection */
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+
+/** @brief Zipf-distributed ranks in [0, n), after Gray et al., "Quickly
+ *      Generating Billion-Record Synthetic Databases"
+ */
+class zipf_gen {
+public:
+    zipf_gen(uint64_t n, double theta): n(n), theta(theta), state(0x9e3779b97f4a7c15ULL)
+    {
+        double zeta2 = 1.0 + std::pow(0.5, theta);
+        uint64_t i;
+
+        zetan = 0.0;
+        for (i = 1; i <= n; i++) {
+            zetan += 1.0 / std::pow((double)i, theta);
+        }
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    uint64_t next()
+    {
+        double u, uz;
+        uint64_t rank;
+
+        state = mix(state + 0x9e3779b97f4a7c15ULL);
+        u = (state >> 11) * (1.0 / 9007199254740992.0);
+        uz = u * zetan;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, theta)) {
+            return 1;
+        }
+        rank = (uint64_t)(n * std::pow(eta * u - eta + 1.0, alpha));
+        return rank < n ? rank : n - 1;
+    }
+
+private:
+    uint64_t n;
+    double   theta, zetan, alpha, eta;
+    uint64_t state;
+};
+
+
+static const char *const distributions[] = { "random", "sorted", "reverse", "zipfian", "dups" };
+
+
+/** @brief The key sequence of distribution @p dist for a tree of size @p n */
+static std::vector<uint64_t> make_keys(const std::string &dist, size_t n)
+{
+    std::vector<uint64_t> keys(n);
+    size_t i;
+
+    if (dist == "sorted") {
+        for (i = 0; i < n; i++) {
+            keys[i] = i;
+        }
+    } else if (dist == "reverse") {
+        for (i = 0; i < n; i++) {
+            keys[i] = n - 1 - i;
+        }
+    } else if (dist == "zipfian") {
+        zipf_gen zipf(n, 0.99);
+
+        for (i = 0; i < n; i++) {
+            keys[i] = mix(zipf.next());
+        }
+    } else if (dist == "dups") {
+        for (i = 0; i < n; i++) {
+            keys[i] = mix(mix(i) % (n / 16 + 1));
+        }
+    } else {
+        for (i = 0; i < n; i++) {
+            keys[i] = mix(i);
+        }
+    }
+    return keys;
+}
+
+
+struct avl_item {
+    struct avl avl;
+    uint64_t   key;
+};
+
+
+static int avl_item_cmp(const struct avl *n1, const struct avl *n2)
+{
+    const avl_item *i1 = (const avl_item *)n1, *i2 = (const avl_item *)n2;
+
+    return (i1->key > i2->key) - (i1->key < i2->key);
+}
+
+
+static int avl_item_sum(struct avl *node, void *data)
+{
+    *(uint64_t *)data += ((avl_item *)node)->key;
+    return 0;
+}
+
+
+/** @brief The intrusive tree, with its nodes preallocated in one array */
+class avl_impl {
+public:
+    static const char *name()
+    {
+        return "avl";
+    }
+
+    explicit avl_impl(size_t n): items(n), root(NULL), used(0) {}
+
+    bool insert(uint64_t key)
+    {
+        avl_item *item = &items[used];
+
+        item->key = key;
+        if (avl_insert(&root, &item->avl, avl_item_cmp, NULL)) {
+            std::memset(&item->avl, 0, sizeof item->avl);
+            return false;
+        }
+        used++;
+        return true;
+    }
+
+    bool find(uint64_t key)
+    {
+        avl_item query;
+
+        query.key = key;
+        return avl_lookup(root, &query.avl, avl_item_cmp) != NULL;
+    }
+
+    bool erase(uint64_t key)
+    {
+        avl_item query;
+
+        query.key = key;
+        return avl_delete(&root, &query.avl, avl_item_cmp, NULL) != NULL;
+    }
+
+    uint64_t sum()
+    {
+        uint64_t total = 0;
+
+        avl_foreach(root, AVL_INORDER, avl_item_sum, &total);
+        return total;
+    }
+
+    /** @brief Forget every node, which must already have been erased */
+    void reset()
+    {
+        std::memset(&items[0], 0, used * sizeof items[0]);
+        root = NULL;
+        used = 0;
+    }
+
+private:
+    std::vector<avl_item> items;
+    struct avl           *root;
+    size_t                used;
+};
+
+
+class set_impl {
+public:
+    static const char *name()
+    {
+        return "std::set";
+    }
+
+    explicit set_impl(size_t) {}
+
+    bool insert(uint64_t key)
+    {
+        return set.insert(key).second;
+    }
+
+    bool find(uint64_t key)
+    {
+        return set.find(key) != set.end();
+    }
+
+    bool erase(uint64_t key)
+    {
+        return set.erase(key) != 0;
+    }
+
+    uint64_t sum()
+    {
+        uint64_t total = 0;
+
+        for (std::set<uint64_t>::const_iterator it = set.begin(); it != set.end(); ++it) {
+            total += *it;
+        }
+        return total;
+    }
+
+    void reset() {}
+
+private:
+    std::set<uint64_t> set;
+};
+
+
+class map_impl {
+public:
+    static const char *name()
+    {
+        return "std::map";
+    }
+
+    explicit map_impl(size_t) {}
+
+    bool insert(uint64_t key)
+    {
+        return map.insert(std::make_pair(key, key)).second;
+    }
+
+    bool find(uint64_t key)
+    {
+        return map.find(key) != map.end();
+    }
+
+    bool erase(uint64_t key)
+    {
+        return map.erase(key) != 0;
+    }
+
+    uint64_t sum()
+    {
+        uint64_t total = 0;
+
+        for (std::map<uint64_t, uint64_t>::const_iterator it = map.begin(); it != map.end(); ++it) {
+            total += it->second;
+        }
+        return total;
+    }
+
+    void reset() {}
+
+private:
+    std::map<uint64_t, uint64_t> map;
+};
+
+
+/** @brief A B-tree set with minimum degree T, after Cormen et al. Nodes split
+ *      on the way down for insertion and are topped up on the way down for
+ *      deletion, so neither ever backs up
+ */
+template <class Key, int T = 16>
+class btree_set {
+public:
+    btree_set(): root(NULL) {}
+
+    ~btree_set()
+    {
+        destroy(root);
+    }
+
+    bool find(const Key &key) const
+    {
+        const node *x = root;
+        int i;
+
+        while (x) {
+            i = x->lower(key);
+            if (i < x->n && x->keys[i] == key) {
+                return true;
+            }
+            x = x->leaf ? NULL : x->child[i];
+        }
+        return false;
+    }
+
+    bool insert(const Key &key)
+    {
+        node *x, *s;
+        int i;
+
+        if (!root) {
+            root = new node(true);
+        } else if (root->n == 2 * T - 1) {
+            s = new node(false);
+            s->child[0] = root;
+            split_child(s, 0);
+            root = s;
+        }
+        x = root;
+        for (;;) {
+            i = x->lower(key);
+            if (i < x->n && x->keys[i] == key) {
+                return false;
+            }
+            if (x->leaf) {
+                std::copy_backward(x->keys + i, x->keys + x->n, x->keys + x->n + 1);
+                x->keys[i] = key;
+                x->n++;
+                return true;
+            }
+            if (x->child[i]->n == 2 * T - 1) {
+                split_child(x, i);
+                if (x->keys[i] == key) {
+                    return false;
+                }
+                i += x->keys[i] < key;
+            }
+            x = x->child[i];
+        }
+    }
+
+    bool erase(const Key &key)
+    {
+        node *old;
+        bool res;
+
+        if (!root) {
+            return false;
+        }
+        res = erase(root, key);
+        if (!root->n) {
+            old = root;
+            root = root->leaf ? NULL : root->child[0];
+            old->leaf = true;
+            delete old;
+        }
+        return res;
+    }
+
+    template <class Fn>
+    void foreach(Fn &fn) const
+    {
+        foreach(root, fn);
+    }
+
+private:
+    struct node {
+        explicit node(bool leaf): n(0), leaf(leaf) {}
+
+        /** @brief Index of the first key not less than @p key */
+        int lower(const Key &key) const
+        {
+            return std::lower_bound(keys, keys + n, key) - keys;
+        }
+
+        int   n;
+        bool  leaf;
+        Key   keys[2 * T - 1];
+        node *child[2 * T];
+    };
+
+    /** @brief Split the full child @p i of @p x around its median */
+    static void split_child(node *x, int i)
+    {
+        node *y = x->child[i], *z = new node(y->leaf);
+
+        z->n = T - 1;
+        std::copy(y->keys + T, y->keys + 2 * T - 1, z->keys);
+        if (!y->leaf) {
+            std::copy(y->child + T, y->child + 2 * T, z->child);
+        }
+        y->n = T - 1;
+        std::copy_backward(x->child + i + 1, x->child + x->n + 1, x->child + x->n + 2);
+        x->child[i + 1] = z;
+        std::copy_backward(x->keys + i, x->keys + x->n, x->keys + x->n + 1);
+        x->keys[i] = y->keys[T - 1];
+        x->n++;
+    }
+
+    /** @brief Merge child @p i + 1 of @p x and the key between them into child
+     *      @p i
+     */
+    static void merge(node *x, int i)
+    {
+        node *y = x->child[i], *z = x->child[i + 1];
+
+        y->keys[y->n] = x->keys[i];
+        std::copy(z->keys, z->keys + z->n, y->keys + y->n + 1);
+        if (!y->leaf) {
+            std::copy(z->child, z->child + z->n + 1, y->child + y->n + 1);
+        }
+        y->n += z->n + 1;
+        std::copy(x->keys + i + 1, x->keys + x->n, x->keys + i);
+        std::copy(x->child + i + 2, x->child + x->n + 1, x->child + i + 1);
+        x->n--;
+        z->leaf = true;
+        delete z;
+    }
+
+    /** @brief Make sure child @p i of @p x has at least T keys
+     *  @returns The index of the child now covering its range
+     */
+    static int fill(node *x, int i)
+    {
+        node *c = x->child[i], *s;
+
+        if (i > 0 && x->child[i - 1]->n >= T) {
+            s = x->child[i - 1];
+            std::copy_backward(c->keys, c->keys + c->n, c->keys + c->n + 1);
+            if (!c->leaf) {
+                std::copy_backward(c->child, c->child + c->n + 1, c->child + c->n + 2);
+                c->child[0] = s->child[s->n];
+            }
+            c->keys[0] = x->keys[i - 1];
+            x->keys[i - 1] = s->keys[s->n - 1];
+            c->n++;
+            s->n--;
+        } else if (i < x->n && x->child[i + 1]->n >= T) {
+            s = x->child[i + 1];
+            c->keys[c->n] = x->keys[i];
+            if (!c->leaf) {
+                c->child[c->n + 1] = s->child[0];
+                std::copy(s->child + 1, s->child + s->n + 1, s->child);
+            }
+            x->keys[i] = s->keys[0];
+            std::copy(s->keys + 1, s->keys + s->n, s->keys);
+            c->n++;
+            s->n--;
+        } else if (i < x->n) {
+            merge(x, i);
+        } else {
+            merge(x, --i);
+        }
+        return i;
+    }
+
+    static bool erase(node *x, const Key &key)
+    {
+        node *y;
+        int i;
+
+        for (;;) {
+            i = x->lower(key);
+            if (i < x->n && x->keys[i] == key) {
+                if (x->leaf) {
+                    std::copy(x->keys + i + 1, x->keys + x->n, x->keys + i);
+                    x->n--;
+                    return true;
+                }
+                if (x->child[i]->n >= T) {
+                    /* Replace the key by its predecessor and delete that */
+                    for (y = x->child[i]; !y->leaf; y = y->child[y->n]);
+                    x->keys[i] = y->keys[y->n - 1];
+                    return erase(x->child[i], x->keys[i]) || true;
+                }
+                if (x->child[i + 1]->n >= T) {
+                    for (y = x->child[i + 1]; !y->leaf; y = y->child[0]);
+                    x->keys[i] = y->keys[0];
+                    return erase(x->child[i + 1], x->keys[i]) || true;
+                }
+                merge(x, i);
+                x = x->child[i];
+                continue;
+            }
+            if (x->leaf) {
+                return false;
+            }
+            if (x->child[i]->n < T) {
+                i = fill(x, i);
+            }
+            x = x->child[i];
+        }
+    }
+
+    template <class Fn>
+    static void foreach(const node *x, Fn &fn)
+    {
+        int i;
+
+        if (!x) {
+            return;
+        }
+        for (i = 0; i < x->n; i++) {
+            if (!x->leaf) {
+                foreach(x->child[i], fn);
+            }
+            fn(x->keys[i]);
+        }
+        if (!x->leaf) {
+            foreach(x->child[x->n], fn);
+        }
+    }
+
+    static void destroy(node *x)
+    {
+        int i;
+
+        if (x && !x->leaf) {
+            for (i = 0; i <= x->n; i++) {
+                destroy(x->child[i]);
+            }
+        }
+        delete x;
+    }
+
+    node *root;
+};
+
+
+struct btree_sum {
+    btree_sum(): total(0) {}
+
+    void operator()(uint64_t key)
+    {
+        total += key;
+    }
+
+    uint64_t total;
+};
+
+
+class btree_impl {
+public:
+    static const char *name()
+    {
+        return "btree";
+    }
+
+    explicit btree_impl(size_t) {}
+
+    bool insert(uint64_t key)
+    {
+        return tree.insert(key);
+    }
+
+    bool find(uint64_t key)
+    {
+        return tree.find(key);
+    }
+
+    bool erase(uint64_t key)
+    {
+        return tree.erase(key);
+    }
+
+    uint64_t sum()
+    {
+        btree_sum fn;
+
+        tree.foreach(fn);
+        return fn.total;
+    }
+
+    void reset() {}
+
+private:
+    btree_set<uint64_t> tree;
+};
+
+
+/** @brief Latencies of single operations, timed at every stride-th one */
+class samples {
+public:
+    explicit samples(size_t n): stride(std::max<size_t>(1, n / 200000)) {}
+
+    void add(double ns)
+    {
+        values.push_back(ns);
+    }
+
+    /** @brief Print the 50th, 99th and 99.9th percentiles, less @p overhead,
+     *      or dashes if nothing was sampled
+     */
+    void print(double overhead)
+    {
+        if (values.empty()) {
+            std::printf(" %8s %8s %8s", "-", "-", "-");
+            return;
+        }
+        std::sort(values.begin(), values.end());
+        std::printf(" %8.1f %8.1f %8.1f", at(0.5) - overhead, at(0.99) - overhead,
+                    at(0.999) - overhead);
+    }
+
+    size_t stride;
+
+private:
+    double at(double q) const
+    {
+        return values[std::min(values.size() - 1, (size_t)(q * values.size()))];
+    }
+
+    std::vector<double> values;
+};
+
+
+enum bench_op {
+    OP_INSERT,
+    OP_LOOKUP,
+    OP_FOREACH,
+    OP_DELETE
+};
+
+
+static const char *const op_names[] = { "insert", "lookup", "foreach", "delete" };
+
+
+/** @brief Untimed-per-operation result of one phase */
+struct phase {
+    double   secs;      /* Elapsed time */
+    uint64_t nmiss;     /* Cache misses, or zero */
+    size_t   hits;      /* Operations that found or added their key */
+};
+
+
+static double            timer_overhead;
+static miss_counter      misses;
+static volatile uint64_t sink;
+
+
+template <class Impl>
+static bool apply(Impl &impl, bench_op op, uint64_t key)
+{
+    switch (op) {
+    case OP_INSERT:
+        return impl.insert(key);
+    case OP_LOOKUP:
+        return impl.find(key);
+    default:
+        return impl.erase(key);
+    }
+}
+
+
+/** @brief Apply @p op to every key, timing only the whole pass */
+template <class Impl>
+static phase pass(Impl &impl, const std::vector<uint64_t> &keys, bench_op op)
+{
+    bench_clock::time_point t0;
+    size_t i, hits = 0;
+    phase res;
+
+    misses.start();
+    t0 = bench_clock::now();
+    if (op == OP_FOREACH) {
+        sink = impl.sum();
+    } else {
+        for (i = 0; i < keys.size(); i++) {
+            hits += apply(impl, op, keys[i]);
+        }
+    }
+    res.secs = seconds_since(t0);
+    res.nmiss = misses.stop();
+    res.hits = hits;
+    sink = hits;
+    return res;
+}
+
+
+/** @brief Apply @p op to every key, timing every stride-th one alone */
+template <class Impl>
+static void sampled(Impl &impl, const std::vector<uint64_t> &keys, bench_op op, samples &lat)
+{
+    bench_clock::time_point t0;
+    size_t i, hits = 0;
+
+    for (i = 0; i < keys.size(); i++) {
+        if (i % lat.stride) {
+            hits += apply(impl, op, keys[i]);
+        } else {
+            t0 = bench_clock::now();
+            hits += apply(impl, op, keys[i]);
+            lat.add(seconds_since(t0) * 1e9);
+        }
+    }
+    sink = hits;
+}
+
+
+/** @brief Run every phase on one implementation and print its rows. Foreach
+ *      is reported per node visited, with no percentiles
+ */
+template <class Impl>
+static void run(const std::vector<uint64_t> &keys)
+{
+    static const bench_op ops[] = { OP_INSERT, OP_LOOKUP, OP_FOREACH, OP_DELETE };
+    Impl impl(keys.size());
+    std::vector<samples> lat(4, samples(keys.size()));
+    phase res[4];
+    size_t n;
+    int i;
+
+    /* Throughput of a full cycle, then the same cycle again for the samples */
+    for (i = 0; i < 4; i++) {
+        res[ops[i]] = pass(impl, keys, ops[i]);
+    }
+    impl.reset();
+    sampled(impl, keys, OP_INSERT, lat[OP_INSERT]);
+    sampled(impl, keys, OP_LOOKUP, lat[OP_LOOKUP]);
+    sampled(impl, keys, OP_DELETE, lat[OP_DELETE]);
+    impl.reset();
+    for (i = 0; i < 4; i++) {
+        /* Foreach visits only as many nodes as were inserted */
+        n = ops[i] == OP_FOREACH ? res[OP_INSERT].hits : keys.size();
+        std::printf("  %-9s %-7s %9.2f %8.1f", Impl::name(), op_names[i], n / res[i].secs * 1e-6,
+                    res[i].secs * 1e9 / n);
+        lat[i].print(timer_overhead);
+        if (misses.available()) {
+            std::printf(" %8.2f", (double)res[i].nmiss / n);
+        }
+        std::printf("\n");
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t max = argc > 1 ? std::strtoul(argv[1], NULL, 0) : 1000000;
+    std::vector<std::string> dists;
+    bench_clock::time_point t0;
+    size_t n;
+    int i;
+
+    for (i = 2; i < argc; i++) {
+        dists.push_back(argv[i]);
+    }
+    if (dists.empty()) {
+        dists.assign(distributions, distributions + sizeof distributions / sizeof *distributions);
+    }
+    for (i = 0; i < 1000; i++) {
+        t0 = bench_clock::now();
+        timer_overhead += seconds_since(t0) * 1e9;
+    }
+    timer_overhead /= 1000;
+    std::printf("timer overhead %.1f ns, subtracted from the percentiles\n", timer_overhead);
+    if (!misses.available()) {
+        std::printf("no cache-miss counter available\n");
+    }
+    for (n = 1000; n <= max; n *= 10) {
+        for (i = 0; i < (int)dists.size(); i++) {
+            std::vector<uint64_t> keys = make_keys(dists[i], n);
+
+            std::printf("\nn=%zu %s\n", n, dists[i].c_str());
+            std::printf("  %-9s %-7s %9s %8s %8s %8s %8s%s\n", "impl", "op", "Mops/s", "ns/op",
+                        "p50", "p99", "p99.9", misses.available() ? "  miss/op" : "");
+            run<avl_impl>(keys);
+            run<set_impl>(keys);
+            run<map_impl>(keys);
+            run<btree_impl>(keys);
+            std::fflush(stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+/* Sorted batches through avl_insert_batch / avl_delete_batch versus the same
+ * keys through avl_insert / avl_delete one at a time
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/batch.c avl.c -o batch
+ *
+ * and run as ./batch [tree size] [batch size] [batches]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "bench.h"
+
+
+static unsigned long ncmp;
+
+
+static int counted_cmp(const struct avl *n1, const struct avl *n2)
+{
+    ncmp++;
+    return item_cmp(n1, n2);
+}
+
+
+static int key_cmp(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 1000000);
+    size_t m = bench_arg(argc, argv, 2, 50000);
+    int rounds = argc > 3 ? atoi(argv[3]) : 10;
+    unsigned long state = BENCH_SEED, *keys;
+    unsigned long cins[2] = { 0 }, cdel[2] = { 0 };
+    double t0, tins[2] = { 0.0 }, tdel[2] = { 0.0 };
+    struct item *items, *batch;
+    struct avl **nodes, *root;
+    size_t i, j;
+    int r, mode;
+
+    items = malloc(n * sizeof *items);
+    nodes = malloc((n > m ? n : m) * sizeof *nodes);
+    batch = malloc(m * sizeof *batch);
+    keys = malloc(m * sizeof *keys);
+    if (!items || !nodes || !batch || !keys) {
+        perror("malloc");
+        return 1;
+    }
+    for (mode = 0; mode < 2; mode++) {
+        /* The base tree holds the even keys. Batches are odd keys, so they are
+        all new */
+        for (i = 0; i < n; i++) {
+            memset(&items[i].avl, 0, sizeof items[i].avl);
+            items[i].key = i * 2;
+            nodes[i] = &items[i].avl;
+        }
+        root = avl_build_sorted(nodes, n);
+        state = BENCH_SEED;
+        for (r = 0; r < rounds; r++) {
+            for (i = 0; i < m; i++) {
+                keys[i] = (xorshift(&state) % n) * 2 + 1;
+            }
+            qsort(keys, m, sizeof *keys, key_cmp);
+            for (i = j = 0; i < m; i++) {
+                if (!j || keys[i] != batch[j - 1].key) {
+                    memset(&batch[j].avl, 0, sizeof batch[j].avl);
+                    batch[j].key = keys[i];
+                    nodes[j] = &batch[j].avl;
+                    j++;
+                }
+            }
+            ncmp = 0;
+            t0 = now();
+            if (mode) {
+                avl_insert_batch(&root, nodes, j, counted_cmp, NULL);
+            } else {
+                for (i = 0; i < j; i++) {
+                    avl_insert(&root, nodes[i], counted_cmp, NULL);
+                }
+            }
+            tins[mode] += now() - t0;
+            cins[mode] += ncmp;
+            ncmp = 0;
+            t0 = now();
+            if (mode) {
+                avl_delete_batch(&root, nodes, j, counted_cmp, NULL, NULL);
+            } else {
+                for (i = 0; i < j; i++) {
+                    avl_delete(&root, nodes[i], counted_cmp, NULL);
+                }
+            }
+            tdel[mode] += now() - t0;
+            cdel[mode] += ncmp;
+        }
+    }
+    printf("n=%zu batch=%zu rounds=%d\n", n, m, rounds);
+    for (mode = 0; mode < 2; mode++) {
+        printf("%-10s insert %6.1f ns %5.1f cmp, delete %6.1f ns %5.1f cmp per key\n",
+               mode ? "batched" : "one by one",
+               tins[mode] * 1e9 / ((double)m * rounds), (double)cins[mode] / ((double)m * rounds),
+               tdel[mode] * 1e9 / ((double)m * rounds), (double)cdel[mode] / ((double)m * rounds));
+    }
+    free(keys);
+    free(batch);
+    free(nodes);
+    free(items);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Fixture shared by the benchmarks: an element keyed by an unsigned long,
+ * its comparison function, a clock, a fixed random sequence and argument
+ * parsing
+ */
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+#include "avl.h"
+
+
+struct item {
+    struct avl    avl;
+    unsigned long key;
+};
+
+
+/** @brief Get the item containing @p node */
+static inline struct item *item_of(const struct avl *node)
+{
+    return (struct item *)((char *)node - offsetof(struct item, avl));
+}
+
+
+static inline int item_cmp(const struct avl *n1, const struct avl *n2)
+{
+    const struct item *i1 = item_of(n1), *i2 = item_of(n2);
+
+    return (i1->key > i2->key) - (i1->key < i2->key);
+}
+
+
+/** @brief Monotonic time in seconds */
+static inline double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/** @brief Seed of every benchmark's sequence, so that runs are repeatable */
+#define BENCH_SEED 88172645463325252UL
+
+
+/** @brief Step Marsaglia's xorshift generator */
+static inline unsigned long xorshift(unsigned long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+
+/** @brief Read argument @p i as a count, or return @p def if it is absent */
+static inline size_t bench_arg(int argc, char *argv[], int i, size_t def)
+{
+    return argc > i ? strtoul(argv[i], NULL, 0) : def;
+}
+
+
+#endif /* BENCH_H */
@@ -0,0 +1,106 @@
+/* Integer-keyed maps: avl_blocks against a plain tree with one key per node,
+ * for insertion, hits and misses over random keys
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -mavx2 -I. bench/block.c avl.c avl_block.c -o block
+ *
+ * and run as ./block [count...]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_block.h"
+#include "bench.h"
+
+
+static void run(size_t n)
+{
+    unsigned long state = BENCH_SEED;
+    struct avl_blocks blocks;
+    struct item *items, query;
+    struct avl *root = NULL;
+    long long *keys;
+    double t0, tins[2], thit[2], tmiss[2];
+    size_t i, found[2] = { 0 };
+    void *value;
+
+    keys = malloc(n * sizeof *keys);
+    items = calloc(n, sizeof *items);
+    if (!keys || !items) {
+        perror("malloc");
+        exit(1);
+    }
+    /* Even keys are inserted, and each one plus one is a miss */
+    for (i = 0; i < n; i++) {
+        keys[i] = (long long)(xorshift(&state) >> 2) & ~1LL;
+        items[i].key = (unsigned long)keys[i];
+    }
+
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        avl_insert(&root, &items[i].avl, item_cmp, NULL);
+    }
+    tins[0] = now() - t0;
+    avl_blocks_init(&blocks);
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        if (avl_blocks_insert(&blocks, keys[i], &items[i], NULL) < 0) {
+            perror("avl_blocks_insert");
+            exit(1);
+        }
+    }
+    tins[1] = now() - t0;
+
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        query.key = (unsigned long)keys[i];
+        found[0] += avl_lookup(root, &query.avl, item_cmp) != NULL;
+    }
+    thit[0] = now() - t0;
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        found[1] += avl_blocks_lookup(&blocks, keys[i], &value);
+    }
+    thit[1] = now() - t0;
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        query.key = (unsigned long)keys[i] + 1;
+        found[0] += avl_lookup(root, &query.avl, item_cmp) != NULL;
+    }
+    tmiss[0] = now() - t0;
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        found[1] += avl_blocks_lookup(&blocks, keys[i] + 1, &value);
+    }
+    tmiss[1] = now() - t0;
+
+    printf("%zu keys, %zu blocks (%.1f keys each), height %u against %u\n",
+           blocks.count, blocks.blocks, (double)blocks.count / blocks.blocks,
+           avl_height(blocks.root), avl_height(root));
+    printf("ns/op        avl  blocks\n");
+    printf("insert  %7.1f %7.1f\n", tins[0] * 1e9 / n, tins[1] * 1e9 / n);
+    printf("hit     %7.1f %7.1f\n", thit[0] * 1e9 / n, thit[1] * 1e9 / n);
+    printf("miss    %7.1f %7.1f%s\n\n", tmiss[0] * 1e9 / n, tmiss[1] * 1e9 / n,
+           found[0] == found[1] ? "" : "  (results differ)");
+    fflush(stdout);
+    avl_blocks_destroy(&blocks);
+    free(items);
+    free(keys);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int a;
+
+    if (argc < 2) {
+        run(1000000);
+        run(10000000);
+    }
+    for (a = 1; a < argc; a++) {
+        run(strtoul(argv[a], NULL, 0));
+    }
+    return 0;
+}
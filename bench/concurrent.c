@@ -0,0 +1,329 @@
+/* Throughput of the concurrent trees against a plain tree under a lock, from 1
+ * to 64 threads:
+ *
+ *  - read-mostly: every thread looks up random keys while one extra thread
+ *    inserts and deletes, against avl_rcu and a pthread rwlock
+ *  - mixed: every thread does 80% lookups, 10% inserts and 10% removals,
+ *    against avl_conc and a pthread mutex
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/concurrent.c avl.c avl_epoch.c avl_rcu.c avl_conc.c -o concurrent -lpthread
+ *
+ * and run as ./concurrent [keys] [max threads] [seconds per point]
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "avl.h"
+#include "avl_conc.h"
+#include "avl_rcu.h"
+#include "bench.h"
+
+
+struct citem {
+    struct avl_cnode node;
+    unsigned long    key;
+};
+
+
+enum bench_kind {
+    BENCH_RCU,      /* avl_rcu, read-mostly */
+    BENCH_RWLOCK,   /* Plain tree under a rwlock, read-mostly */
+    BENCH_CONC,     /* avl_conc, mixed */
+    BENCH_MUTEX     /* Plain tree under a mutex, mixed */
+};
+
+
+struct shared {
+    enum bench_kind  kind;
+    unsigned long    keys;
+    atomic_int       stop;
+    struct avl_rcu   rcu;
+    struct avl_conc  conc;
+    struct avl      *root;
+    pthread_rwlock_t rwlock;
+    pthread_mutex_t  mutex;
+};
+
+
+struct worker {
+    pthread_t      thread;
+    struct shared *sh;
+    unsigned long  seed;
+    int            writer;
+    unsigned long  ops;
+};
+
+
+static int citem_cmp(const struct avl_cnode *n1, const struct avl_cnode *n2)
+{
+    const struct citem *i1 = (const struct citem *)n1, *i2 = (const struct citem *)n2;
+
+    return (i1->key > i2->key) - (i1->key < i2->key);
+}
+
+
+static struct avl *item_copy(const struct avl *node, void *data)
+{
+    struct item *copy;
+
+    (void)data;
+    copy = malloc(sizeof *copy);
+    if (copy) {
+        *copy = *(const struct item *)((const char *)node - offsetof(struct item, avl));
+    }
+    return copy ? &copy->avl : NULL;
+}
+
+
+static void item_free(struct avl *node, void *data)
+{
+    (void)data;
+    free((char *)node - offsetof(struct item, avl));
+}
+
+
+static void citem_free(struct avl_cnode *node, void *data)
+{
+    (void)data;
+    free(node);
+}
+
+
+static struct item *item_new(unsigned long key)
+{
+    struct item *item;
+
+    item = calloc(1, sizeof *item);
+    if (!item) {
+        perror("calloc");
+        exit(1);
+    }
+    item->key = key;
+    return item;
+}
+
+
+static struct citem *citem_new(unsigned long key)
+{
+    struct citem *item;
+
+    item = malloc(sizeof *item);
+    if (!item) {
+        perror("malloc");
+        exit(1);
+    }
+    item->key = key;
+    return item;
+}
+
+
+/** @brief Insert into or delete from the plain tree, which must be locked */
+static void locked_update(struct shared *sh, unsigned long key, int insert)
+{
+    struct item query, *item;
+    struct avl *node;
+
+    if (insert) {
+        item = item_new(key);
+        if (avl_insert(&sh->root, &item->avl, item_cmp, NULL)) {
+            free(item);
+        }
+    } else {
+        query.key = key;
+        node = avl_delete(&sh->root, &query.avl, item_cmp, NULL);
+        if (node) {
+            item_free(node, NULL);
+        }
+    }
+}
+
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = arg;
+    struct shared *sh = w->sh;
+    struct avl_epoch_thread thread;
+    struct item query, *item;
+    struct citem cquery, *citem;
+    unsigned long key, op;
+
+    if (sh->kind == BENCH_RCU) {
+        avl_epoch_register(&sh->rcu.epoch, &thread);
+    } else if (sh->kind == BENCH_CONC) {
+        avl_epoch_register(&sh->conc.epoch, &thread);
+    }
+    while (!atomic_load_explicit(&sh->stop, memory_order_relaxed)) {
+        key = xorshift(&w->seed) % sh->keys;
+        op = w->writer ? 1 + (key & 1) : xorshift(&w->seed) % 10;
+        query.key = key;
+        cquery.key = key;
+        switch (sh->kind) {
+        case BENCH_RCU:
+            if (op == 1) {
+                item = item_new(key);
+                if (avl_rcu_insert(&sh->rcu, &thread, &item->avl)) {
+                    free(item);
+                }
+            } else if (op == 2) {
+                avl_rcu_delete(&sh->rcu, &thread, &query.avl);
+            } else {
+                avl_epoch_enter(&thread);
+                avl_rcu_lookup(&sh->rcu, &query.avl);
+                avl_epoch_exit(&thread);
+            }
+            break;
+        case BENCH_RWLOCK:
+            if (op == 1 || op == 2) {
+                pthread_rwlock_wrlock(&sh->rwlock);
+                locked_update(sh, key, op == 1);
+            } else {
+                pthread_rwlock_rdlock(&sh->rwlock);
+                avl_lookup(sh->root, &query.avl, item_cmp);
+            }
+            pthread_rwlock_unlock(&sh->rwlock);
+            break;
+        case BENCH_CONC:
+            if (op == 1) {
+                citem = citem_new(key);
+                if (avl_conc_insert(&sh->conc, &thread, &citem->node)) {
+                    free(citem);
+                }
+            } else if (op == 2) {
+                avl_conc_remove(&sh->conc, &thread, &cquery.node);
+            } else {
+                avl_epoch_enter(&thread);
+                avl_conc_lookup(&sh->conc, &cquery.node);
+                avl_epoch_exit(&thread);
+            }
+            break;
+        case BENCH_MUTEX:
+            pthread_mutex_lock(&sh->mutex);
+            if (op == 1 || op == 2) {
+                locked_update(sh, key, op == 1);
+            } else {
+                avl_lookup(sh->root, &query.avl, item_cmp);
+            }
+            pthread_mutex_unlock(&sh->mutex);
+            break;
+        }
+        w->ops++;
+    }
+    if (sh->kind == BENCH_RCU || sh->kind == BENCH_CONC) {
+        avl_epoch_unregister(&thread);
+    }
+    return NULL;
+}
+
+
+static void tree_free(struct avl *root)
+{
+    struct avl *node;
+
+    while ((node = root)) {
+        avl_delete(&root, node, item_cmp, NULL);
+        item_free(node, NULL);
+    }
+}
+
+
+/** @brief Run one point: @p nthreads workers, plus a writer for the
+ *      read-mostly kinds, for @p seconds
+ *  @returns Millions of operations per second, over the workers only
+ */
+static double run(enum bench_kind kind, unsigned long keys, int nthreads, double seconds)
+{
+    struct avl_epoch_thread thread;
+    struct shared sh;
+    struct worker *workers;
+    unsigned long key, ops = 0;
+    struct item *item;
+    struct avl *root;
+    int i, n, extra;
+    double t0, t1;
+
+    sh.kind = kind;
+    sh.keys = keys;
+    sh.root = NULL;
+    atomic_init(&sh.stop, 0);
+    avl_rcu_init(&sh.rcu, item_cmp, item_copy, item_free, NULL);
+    avl_conc_init(&sh.conc, citem_cmp, citem_free, NULL);
+    pthread_rwlock_init(&sh.rwlock, NULL);
+    pthread_mutex_init(&sh.mutex, NULL);
+    /* Fill half of the key space */
+    avl_epoch_register(&sh.conc.epoch, &thread);
+    for (key = 0; key < keys; key += 2) {
+        if (kind == BENCH_CONC) {
+            avl_conc_insert(&sh.conc, &thread, &citem_new(key)->node);
+        } else {
+            item = item_new(key);
+            avl_insert(&sh.root, &item->avl, item_cmp, NULL);
+        }
+    }
+    avl_epoch_unregister(&thread);
+    if (kind == BENCH_RCU) {
+        atomic_store(&sh.rcu.root, sh.root);
+        sh.root = NULL;
+    }
+    extra = kind == BENCH_RCU || kind == BENCH_RWLOCK;
+    n = nthreads + extra;
+    workers = calloc(n, sizeof *workers);
+    if (!workers) {
+        perror("calloc");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        workers[i].sh = &sh;
+        workers[i].seed = BENCH_SEED + 7919 * i;
+        workers[i].writer = i == nthreads;
+        pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+    }
+    t0 = now();
+    do {
+        struct timespec ts = { 0, 10000000 };
+
+        nanosleep(&ts, NULL);
+        t1 = now();
+    } while (t1 - t0 < seconds);
+    atomic_store(&sh.stop, 1);
+    for (i = 0; i < n; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (!workers[i].writer) {
+            ops += workers[i].ops;
+        }
+    }
+    t1 = now();
+    free(workers);
+    avl_conc_destroy(&sh.conc);
+    root = avl_rcu_destroy(&sh.rcu);
+    tree_free(root);
+    tree_free(sh.root);
+    pthread_rwlock_destroy(&sh.rwlock);
+    pthread_mutex_destroy(&sh.mutex);
+    return ops / (t1 - t0) * 1e-6;
+}
+
+
+int main(int argc, char *argv[])
+{
+    unsigned long keys = bench_arg(argc, argv, 1, 1000000);
+    int max = argc > 2 ? atoi(argv[2]) : 64;
+    double seconds = argc > 3 ? atof(argv[3]) : 0.5;
+    int n;
+
+    printf("keys=%lu, Mops/s over the readers or workers\n", keys);
+    printf("threads      rcu   rwlock     conc    mutex\n");
+    for (n = 1; n <= max; n *= 2) {
+        printf("%7d", n);
+        printf(" %8.2f", run(BENCH_RCU, keys, n, seconds));
+        printf(" %8.2f", run(BENCH_RWLOCK, keys, n, seconds));
+        printf(" %8.2f", run(BENCH_CONC, keys, n, seconds));
+        printf(" %8.2f\n", run(BENCH_MUTEX, keys, n, seconds));
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+/* Bulk expiry: removing a fraction of the nodes with one avl_delete call each
+ * against a single avl_delete_if pass
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/delete_if.c avl.c -o delete_if
+ *
+ * and run as ./delete_if [count] [percent removed...]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "bench.h"
+
+
+struct entry {
+    struct item   item;
+    unsigned long expiry;
+};
+
+
+static int entry_expired(struct avl *node, void *data)
+{
+    return ((struct entry *)item_of(node))->expiry < *(unsigned long *)data;
+}
+
+
+static struct avl *fill(struct entry *items, size_t n)
+{
+    struct avl *root = NULL;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        memset(&items[i].item.avl, 0, sizeof items[i].item.avl);
+        avl_insert(&root, &items[i].item.avl, item_cmp, NULL);
+    }
+    return root;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const unsigned long defaults[] = { 1, 5, 10, 30, 60 };
+    size_t n = bench_arg(argc, argv, 1, 1000000);
+    unsigned long state = BENCH_SEED, cutoff, pct;
+    struct entry *items;
+    struct avl *root;
+    double t0, tdel, tif;
+    size_t i, removed;
+    int a, npct;
+
+    items = malloc(n * sizeof *items);
+    if (!items) {
+        perror("malloc");
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        items[i].item.key = xorshift(&state);
+        items[i].expiry = (state >> 17) % 100;
+    }
+    npct = argc > 2 ? argc - 2 : (int)(sizeof defaults / sizeof *defaults);
+    printf("%zu nodes, ms\n", n);
+    printf("removed   avl_delete  avl_delete_if\n");
+    for (a = 0; a < npct; a++) {
+        pct = argc > 2 ? strtoul(argv[a + 2], NULL, 0) : defaults[a];
+        cutoff = pct;
+        root = fill(items, n);
+        t0 = now();
+        for (i = 0; i < n; i++) {
+            if (items[i].expiry < cutoff) {
+                avl_delete(&root, &items[i].item.avl, item_cmp, NULL);
+            }
+        }
+        tdel = now() - t0;
+        root = fill(items, n);
+        t0 = now();
+        removed = avl_delete_if(&root, entry_expired, NULL, &cutoff);
+        tif = now() - t0;
+        printf("%6lu%% %12.1f %14.1f   (%zu nodes)\n", pct, tdel * 1e3, tif * 1e3, removed);
+        fflush(stdout);
+    }
+    free(items);
+    return 0;
+}
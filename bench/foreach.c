@@ -0,0 +1,82 @@
+/* Full-scan throughput of avl_foreach in each order and of avl_foreach_batch,
+ * over a tree whose nodes are scattered through memory relative to key order
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/foreach.c avl.c -o foreach
+ *
+ * and run as ./foreach [count] [rounds]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "avl.h"
+#include "bench.h"
+
+
+static int sum_one(struct avl *node, void *data)
+{
+    *(unsigned long *)data += ((struct item *)node)->key;
+    return 0;
+}
+
+
+static int sum_batch(struct avl *const *nodes, size_t n, void *data)
+{
+    unsigned long sum = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        sum += ((const struct item *)nodes[i])->key;
+    }
+    *(unsigned long *)data += sum;
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const char *const names[] = { "preorder", "inorder", "postorder" };
+    size_t n = bench_arg(argc, argv, 1, 1000000);
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    unsigned long state = BENCH_SEED, sum = 0;
+    struct item *items;
+    struct avl *root = NULL;
+    double t0, t;
+    size_t i;
+    int dir, r;
+
+    items = calloc(n, sizeof *items);
+    if (!items) {
+        perror("calloc");
+        return 1;
+    }
+    /* Random keys, so neighbors in key order are far apart in memory */
+    for (i = 0; i < n; i++) {
+        items[i].key = xorshift(&state);
+        avl_insert(&root, &items[i].avl, item_cmp, NULL);
+    }
+    printf("%zu nodes, ns per node\n", n);
+    for (dir = AVL_PREORDER; dir <= AVL_POSTORDER; dir++) {
+        t = 1e9;
+        for (r = 0; r < rounds; r++) {
+            t0 = now();
+            avl_foreach(root, (avl_iterdir_t)dir, sum_one, &sum);
+            t0 = now() - t0;
+            t = t0 < t ? t0 : t;
+        }
+        printf("foreach %-9s %6.2f\n", names[dir], t * 1e9 / n);
+        t = 1e9;
+        for (r = 0; r < rounds; r++) {
+            t0 = now();
+            avl_foreach_batch(root, (avl_iterdir_t)dir, sum_batch, &sum);
+            t0 = now() - t0;
+            t = t0 < t ? t0 : t;
+        }
+        printf("batch   %-9s %6.2f\n", names[dir], t * 1e9 / n);
+    }
+    /* Keep the sums live */
+    printf("(checksum %lx)\n", sum);
+    free(items);
+    return 0;
+}
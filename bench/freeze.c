@@ -0,0 +1,129 @@
+/* avl_lookup against the frozen Eytzinger and integer B-tree snapshots
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/freeze.c avl.c avl_freeze.c -o freeze
+ *
+ * adding -mavx2 or -msse4.2 to enable the SIMD block search, and run as
+ * ./freeze [count] [lookups]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "avl_freeze.h"
+#include "bench.h"
+
+
+static long long item_key(const struct avl *node)
+{
+    return (long long)((const struct item *)((const char *)node - offsetof(struct item, avl)))->key;
+}
+
+
+/** @brief Lookup method under test */
+typedef struct avl *lookupfn_t(const void *index, struct avl *query);
+
+
+static struct avl *lookup_tree(const void *index, struct avl *query)
+{
+    return avl_lookup((struct avl *)index, query, item_cmp);
+}
+
+
+static struct avl *lookup_frozen(const void *index, struct avl *query)
+{
+    return avl_frozen_lookup(index, query, item_cmp);
+}
+
+
+static struct avl *lookup_int(const void *index, struct avl *query)
+{
+    return avl_frozen_int_lookup(index, item_key(query));
+}
+
+
+/** @brief Time random lookups, all of which hit */
+static double lookups(lookupfn_t *fn, const void *index, size_t n, size_t m)
+{
+    unsigned long state = 2463534242UL;
+    struct item query;
+    size_t i, hits = 0;
+    double t0;
+
+    t0 = now();
+    for (i = 0; i < m; i++) {
+        query.key = xorshift(&state) % n;
+        hits += fn(index, &query.avl) != NULL;
+    }
+    if (hits != m) {
+        fprintf(stderr, "lost %zu keys\n", m - hits);
+        exit(1);
+    }
+    return (now() - t0) * 1e9 / m;
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 4000000);
+    size_t m = bench_arg(argc, argv, 2, 2000000);
+    unsigned long state = BENCH_SEED;
+    struct avl_frozen_int fint;
+    struct avl_frozen frozen;
+    struct avl **nodes, *root;
+    size_t i, j, *perm, tmp;
+    struct item *items;
+    double t0, tf, ti;
+
+    items = malloc(n * sizeof *items);
+    nodes = malloc(n * sizeof *nodes);
+    perm = malloc(n * sizeof *perm);
+    if (!items || !nodes || !perm) {
+        perror("malloc");
+        return 1;
+    }
+    /* Scatter the nodes: key order is a random permutation of address order */
+    for (i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = xorshift(&state) % (i + 1);
+        tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+    for (i = 0; i < n; i++) {
+        memset(&items[i].avl, 0, sizeof items[i].avl);
+        items[i].key = perm[i];
+        nodes[perm[i]] = &items[i].avl;
+    }
+    root = avl_build_sorted(nodes, n);
+    avl_frozen_init(&frozen);
+    avl_frozen_int_init(&fint);
+    t0 = now();
+    if (avl_freeze(&frozen, root)) {
+        perror("avl_freeze");
+        return 1;
+    }
+    tf = now() - t0;
+    t0 = now();
+    if (avl_freeze_int(&fint, root, item_key)) {
+        perror("avl_freeze_int");
+        return 1;
+    }
+    ti = now() - t0;
+    printf("n=%zu lookups=%zu\n", n, m);
+    printf("avl_lookup            %6.1f ns/lookup\n", lookups(lookup_tree, root, n, m));
+    printf("avl_frozen_lookup     %6.1f ns/lookup (freeze %.0f ms)\n",
+           lookups(lookup_frozen, &frozen, n, m), tf * 1e3);
+    printf("avl_frozen_int_lookup %6.1f ns/lookup (freeze %.0f ms)\n",
+           lookups(lookup_int, &fint, n, m), ti * 1e3);
+    avl_frozen_int_destroy(&fint);
+    avl_frozen_destroy(&frozen);
+    free(perm);
+    free(nodes);
+    free(items);
+    return 0;
+}
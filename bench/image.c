@@ -0,0 +1,92 @@
+/* Startup cost of rebuilding a tree from its keys against mapping an image of
+ * it, and lookup latency on the mapped image against the heap tree
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -DAVL_RELATIVE -I. bench/image.c avl.c avl_layout.c avl_image.c -o image
+ *
+ * and run as ./image [count] [lookups] [path]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_image.h"
+#include "bench.h"
+
+
+/** @brief Time random lookups, all of which hit */
+static double lookups(struct avl *root, size_t n, size_t m)
+{
+    unsigned long state = 2463534242UL;
+    struct item query;
+    size_t i, hits = 0;
+    double t0;
+
+    t0 = now();
+    for (i = 0; i < m; i++) {
+        query.key = xorshift(&state) % n;
+        hits += avl_lookup(root, &query.avl, item_cmp) != NULL;
+    }
+    if (hits != m) {
+        fprintf(stderr, "lost %zu keys\n", m - hits);
+        exit(1);
+    }
+    return (now() - t0) * 1e9 / m;
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 4000000);
+    size_t m = bench_arg(argc, argv, 2, 2000000);
+    const char *path = argc > 3 ? argv[3] : "avl.img";
+    unsigned long state = BENCH_SEED;
+    struct avl_image image;
+    struct item *items;
+    struct avl *root = NULL;
+    size_t i;
+    double t0;
+
+    items = calloc(n, sizeof *items);
+    if (!items) {
+        perror("calloc");
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        items[i].key = i;
+    }
+    /* Insert in random order, as a restart replaying a log would */
+    for (i = n - 1; i > 0; i--) {
+        size_t j = xorshift(&state) % (i + 1);
+        unsigned long tmp = items[i].key;
+
+        items[i].key = items[j].key;
+        items[j].key = tmp;
+    }
+    printf("n=%zu lookups=%zu\n", n, m);
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        avl_insert(&root, &items[i].avl, item_cmp, NULL);
+    }
+    printf("rebuild   %8.2f ms\n", (now() - t0) * 1e3);
+    t0 = now();
+    if (avl_image_write(path, root, AVL_LAYOUT_VEB, sizeof *items, offsetof(struct item, avl))) {
+        perror(path);
+        return 1;
+    }
+    printf("write     %8.2f ms\n", (now() - t0) * 1e3);
+    t0 = now();
+    if (avl_image_open(&image, path, AVL_IMAGE_READ)) {
+        perror(path);
+        return 1;
+    }
+    printf("open      %8.2f ms\n", (now() - t0) * 1e3);
+    printf("heap      %8.1f ns/lookup\n", lookups(root, n, m));
+    printf("image     %8.1f ns/lookup (first pass, page cache warm)\n", lookups(image.root, n, m));
+    printf("image     %8.1f ns/lookup\n", lookups(image.root, n, m));
+    avl_image_close(&image);
+    remove(path);
+    free(items);
+    return 0;
+}
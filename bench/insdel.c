@@ -0,0 +1,78 @@
+/* Insert/delete throughput benchmark
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/insdel.c avl.c -o insdel
+ *
+ * and run as ./insdel [count] [rounds]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "bench.h"
+
+
+/** @brief Fisher-Yates shuffle using a fixed xorshift generator, so that every
+ *      run sees the same sequence
+ */
+static void shuffle(struct item **v, size_t n, unsigned long *state)
+{
+    struct item *tmp;
+    size_t i, j;
+
+    for (i = n - 1; i > 0; i--) {
+        *state ^= *state << 13;
+        *state ^= *state >> 7;
+        *state ^= *state << 17;
+        j = *state % (i + 1);
+        tmp = v[i];
+        v[i] = v[j];
+        v[j] = tmp;
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 1000000);
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    double t0, tins = 0.0, tdel = 0.0;
+    unsigned long state = BENCH_SEED;
+    struct item *items, **order;
+    struct avl *root = NULL;
+    size_t i;
+    int r;
+
+    items = malloc(n * sizeof *items);
+    order = malloc(n * sizeof *order);
+    if (!items || !order) {
+        perror("malloc");
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        items[i].key = i * 2654435761UL;
+        order[i] = &items[i];
+    }
+    for (r = 0; r < rounds; r++) {
+        shuffle(order, n, &state);
+        t0 = now();
+        for (i = 0; i < n; i++) {
+            memset(&order[i]->avl, 0, sizeof order[i]->avl);
+            avl_insert(&root, &order[i]->avl, item_cmp, NULL);
+        }
+        tins += now() - t0;
+        shuffle(order, n, &state);
+        t0 = now();
+        for (i = 0; i < n; i++) {
+            avl_delete(&root, &order[i]->avl, item_cmp, NULL);
+        }
+        tdel += now() - t0;
+    }
+    printf("n=%zu rounds=%d insert %.1f ns/op, delete %.1f ns/op\n", n, rounds,
+           tins * 1e9 / ((double)n * rounds), tdel * 1e9 / ((double)n * rounds));
+    free(order);
+    free(items);
+    return 0;
+}
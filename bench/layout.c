@@ -0,0 +1,95 @@
+/* Lookup latency on a tree whose nodes are scattered in memory, before and
+ * after avl_relayout into breadth-first and van Emde Boas order
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/layout.c avl.c avl_layout.c -o layout
+ *
+ * and run as ./layout [count] [lookups]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "avl_layout.h"
+#include "bench.h"
+
+
+/** @brief Time random lookups, all of which hit */
+static double lookups(struct avl *root, size_t n, size_t m)
+{
+    unsigned long state = 2463534242UL;
+    struct item query;
+    size_t i, hits = 0;
+    double t0;
+
+    t0 = now();
+    for (i = 0; i < m; i++) {
+        query.key = xorshift(&state) % n;
+        hits += avl_lookup(root, &query.avl, item_cmp) != NULL;
+    }
+    if (hits != m) {
+        fprintf(stderr, "lost %zu keys\n", m - hits);
+        exit(1);
+    }
+    return (now() - t0) * 1e9 / m;
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 4000000);
+    size_t m = bench_arg(argc, argv, 2, 2000000);
+    unsigned long state = BENCH_SEED;
+    struct item *items, *bfs, *veb;
+    struct avl **nodes, *root;
+    size_t i, j, *perm, tmp;
+    double t0;
+
+    items = malloc(n * sizeof *items);
+    bfs = malloc(n * sizeof *bfs);
+    veb = malloc(n * sizeof *veb);
+    nodes = malloc(n * sizeof *nodes);
+    perm = malloc(n * sizeof *perm);
+    if (!items || !bfs || !veb || !nodes || !perm) {
+        perror("malloc");
+        return 1;
+    }
+    /* Scatter the nodes: key order is a random permutation of address order,
+    as it ends up after long churn */
+    for (i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = xorshift(&state) % (i + 1);
+        tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+    for (i = 0; i < n; i++) {
+        memset(&items[i].avl, 0, sizeof items[i].avl);
+        items[i].key = perm[i];
+        nodes[perm[i]] = &items[i].avl;
+    }
+    root = avl_build_sorted(nodes, n);
+    printf("n=%zu lookups=%zu\n", n, m);
+    printf("scattered %6.1f ns/lookup\n", lookups(root, n, m));
+
+    t0 = now();
+    root = avl_relayout(root, AVL_LAYOUT_BFS, bfs, sizeof *bfs,
+                        offsetof(struct item, avl), NULL, NULL);
+    t0 = now() - t0;
+    printf("bfs       %6.1f ns/lookup (relayout %.0f ms)\n", lookups(root, n, m), t0 * 1e3);
+    t0 = now();
+    root = avl_relayout(root, AVL_LAYOUT_VEB, veb, sizeof *veb,
+                        offsetof(struct item, avl), NULL, NULL);
+    t0 = now() - t0;
+    printf("veb       %6.1f ns/lookup (relayout %.0f ms)\n", lookups(root, n, m), t0 * 1e3);
+    free(perm);
+    free(nodes);
+    free(veb);
+    free(bfs);
+    free(items);
+    return 0;
+}
@@ -0,0 +1,92 @@
+/* One-at-a-time lookups versus avl_lookup_batch on a tree much larger than the
+ * cache
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/lookup_batch.c avl.c -o lookup_batch
+ *
+ * and run as ./lookup_batch [count] [lookups] [batch]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "bench.h"
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 4000000);
+    size_t m = bench_arg(argc, argv, 2, 4000000);
+    size_t batch = bench_arg(argc, argv, 3, 1024);
+    unsigned long state = BENCH_SEED;
+    struct item *items, *probes;
+    struct avl **nodes, **queries, **out, *root;
+    size_t i, j, *perm, tmp, hits1 = 0, hits2 = 0;
+    double t0, tone, tbatch;
+
+    items = malloc(n * sizeof *items);
+    nodes = malloc(n * sizeof *nodes);
+    perm = malloc(n * sizeof *perm);
+    probes = malloc(m * sizeof *probes);
+    queries = malloc(m * sizeof *queries);
+    out = malloc(m * sizeof *out);
+    if (!items || !nodes || !perm || !probes || !queries || !out) {
+        perror("malloc");
+        return 1;
+    }
+    /* Key order is a random permutation of address order, so that neighbours
+    in the tree are not neighbours in memory */
+    for (i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = xorshift(&state) % (i + 1);
+        tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+    for (i = 0; i < n; i++) {
+        memset(&items[i].avl, 0, sizeof items[i].avl);
+        items[i].key = perm[i] * 2;
+        nodes[perm[i]] = &items[i].avl;
+    }
+    root = avl_build_sorted(nodes, n);
+    /* About half the probes hit */
+    for (i = 0; i < m; i++) {
+        probes[i].key = xorshift(&state) % (2 * n);
+        queries[i] = &probes[i].avl;
+    }
+
+    t0 = now();
+    for (i = 0; i < m; i++) {
+        hits1 += avl_lookup(root, queries[i], item_cmp) != NULL;
+    }
+    tone = now() - t0;
+
+    t0 = now();
+    for (i = 0; i < m; i += batch) {
+        avl_lookup_batch(root, queries + i, m - i < batch ? m - i : batch,
+                         item_cmp, out + i);
+    }
+    tbatch = now() - t0;
+    for (i = 0; i < m; i++) {
+        hits2 += out[i] != NULL;
+    }
+    if (hits1 != hits2) {
+        fprintf(stderr, "mismatch: %zu hits one at a time, %zu batched\n", hits1, hits2);
+        return 1;
+    }
+
+    printf("n=%zu lookups=%zu batch=%zu hits=%zu\n", n, m, batch, hits1);
+    printf("avl_lookup       %.1f ns/op\n", tone * 1e9 / m);
+    printf("avl_lookup_batch %.1f ns/op\n", tbatch * 1e9 / m);
+    free(out);
+    free(queries);
+    free(probes);
+    free(perm);
+    free(nodes);
+    free(items);
+    return 0;
+}
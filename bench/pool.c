@@ -0,0 +1,121 @@
+/* malloc(3) per node versus avl_pool, and lookup speed before and after
+ * avl_pool_compact on a tree that has seen heavy churn
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/pool.c avl.c avl_pool.c -o pool
+ *
+ * and run as ./pool [count]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "avl_pool.h"
+#include "bench.h"
+
+
+static int free_item(struct avl *node, void *data)
+{
+    (void)data;
+    free((char *)node - offsetof(struct item, avl));
+    return 0;
+}
+
+
+/** @brief Time random lookups of keys below @p range */
+static double lookups(struct avl *root, size_t range, size_t m)
+{
+    unsigned long state = 2463534242UL;
+    struct item query;
+    size_t i, hits = 0;
+    double t0;
+
+    t0 = now();
+    for (i = 0; i < m; i++) {
+        query.key = xorshift(&state) % range;
+        hits += avl_lookup(root, &query.avl, item_cmp) != NULL;
+    }
+    if (!hits) {
+        puts("no hits");
+    }
+    return (now() - t0) * 1e9 / m;
+}
+
+
+/** @brief Insert @p n random keys, then replace half of them @p churn times
+ *  @param pool
+ *      Pool to allocate from, or NULL for malloc(3)
+ *  @returns The time spent per insertion or deletion, in nanoseconds
+ */
+static double build(struct avl **root, struct avl_pool *pool, size_t n, int churn)
+{
+    unsigned long state = BENCH_SEED;
+    struct item *it, query;
+    struct avl *old;
+    size_t i, ops = 0;
+    double t0;
+    int r;
+
+    t0 = now();
+    for (r = 0; r <= churn; r++) {
+        for (i = 0; i < n; i++) {
+            if (r) {
+                query.key = xorshift(&state) % (4 * n);
+                old = avl_delete(root, &query.avl, item_cmp, NULL);
+                if (old) {
+                    it = (struct item *)((char *)old - offsetof(struct item, avl));
+                    if (pool) {
+                        avl_pool_free(pool, it);
+                    } else {
+                        free(it);
+                    }
+                }
+                ops++;
+            }
+            it = pool ? avl_pool_alloc(pool) : calloc(1, sizeof *it);
+            it->key = xorshift(&state) % (4 * n);
+            if (avl_insert(root, &it->avl, item_cmp, NULL)) {
+                if (pool) {
+                    avl_pool_free(pool, it);
+                } else {
+                    free(it);
+                }
+            }
+            ops++;
+        }
+    }
+    return (now() - t0) * 1e9 / ops;
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 1000000), m = 2000000;
+    struct avl *root = NULL;
+    struct avl_pool pool;
+    double t, tl, t0;
+
+    t = build(&root, NULL, n, 3);
+    tl = lookups(root, 4 * n, m);
+    printf("malloc    %6.1f ns/update, lookup %6.1f ns\n", t, tl);
+    t0 = now();
+    avl_foreach(root, AVL_POSTORDER, free_item, NULL);
+    printf("          free walk %.1f ms\n", (now() - t0) * 1e3);
+
+    root = NULL;
+    avl_pool_init(&pool, sizeof (struct item), 0);
+    t = build(&root, &pool, n, 3);
+    tl = lookups(root, 4 * n, m);
+    printf("avl_pool  %6.1f ns/update, lookup %6.1f ns\n", t, tl);
+    t0 = now();
+    avl_pool_compact(&pool, &root, offsetof(struct item, avl), NULL, NULL);
+    printf("          compact %.1f ms, ", (now() - t0) * 1e3);
+    tl = lookups(root, 4 * n, m);
+    printf("lookup after compact %6.1f ns\n", tl);
+    t0 = now();
+    avl_pool_destroy(&pool);
+    printf("          destroy %.3f ms\n", (now() - t0) * 1e3);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/* String-keyed lookups with and without inline key prefixes. The keys live in
+ * their own allocations, as they would behind a record's char pointer, so the
+ * comparison function costs a dependent load per level that the prefix skips
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -DAVL_PREFIX -DAVL_STATS -I. bench/prefix.c avl.c -o prefix
+ *
+ * and run as ./prefix [count] [shared prefix]. Keys are the shared prefix,
+ * empty by default, followed by twelve random letters
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "bench.h"
+
+#ifndef AVL_PREFIX
+# error "bench/prefix.c needs AVL_PREFIX"
+#endif
+
+
+struct sitem {
+    struct avl  avl;
+    const char *key;
+};
+
+
+static int sitem_cmp(const struct avl *n1, const struct avl *n2)
+{
+    const struct sitem *i1, *i2;
+
+    i1 = (const struct sitem *)((const char *)n1 - offsetof(struct sitem, avl));
+    i2 = (const struct sitem *)((const char *)n2 - offsetof(struct sitem, avl));
+    return strcmp(i1->key, i2->key);
+}
+
+
+/** @brief Look up every key through a fresh query node, returning ns/lookup */
+static double probe(struct avl *root, struct sitem *items, size_t n, int prefixed)
+{
+    struct sitem query;
+    size_t i, found = 0;
+    double t0;
+
+    memset(&query, 0, sizeof query);
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        query.key = items[(i * 7919) % n].key;
+        query.avl.prefix = prefixed ? avl_prefix_bytes(query.key, (size_t)-1) : 0;
+        found += avl_lookup(root, &query.avl, sitem_cmp) != NULL;
+    }
+    t0 = now() - t0;
+    if (found != n) {
+        fprintf(stderr, "lost %zu keys\n", n - found);
+        exit(1);
+    }
+    return t0 * 1e9 / n;
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 1000000);
+    const char *shared = argc > 2 ? argv[2] : "";
+    size_t len = strlen(shared), i, j;
+    unsigned long state = BENCH_SEED;
+    struct sitem *items;
+    struct avl *root = NULL;
+    double t[2];
+    char *key;
+    int pass;
+
+    items = calloc(n, sizeof *items);
+    if (!items) {
+        perror("calloc");
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        key = malloc(len + 13);
+        if (!key) {
+            perror("malloc");
+            return 1;
+        }
+        memcpy(key, shared, len);
+        for (j = 0; j < 12; j++) {
+            key[len + j] = 'a' + (char)(xorshift(&state) % 26);
+        }
+        key[len + 12] = '\0';
+        items[i].key = key;
+    }
+    printf("%zu keys \"%s...\", ns/lookup and comparator calls/lookup\n", n, shared);
+    /* All-zero prefixes tie everywhere, which is the plain tree */
+    for (pass = 0; pass < 2; pass++) {
+        root = NULL;
+        for (i = 0; i < n; i++) {
+            memset(&items[i].avl, 0, sizeof items[i].avl);
+            items[i].avl.prefix = pass ? avl_prefix_bytes(items[i].key, (size_t)-1) : 0;
+            avl_insert(&root, &items[i].avl, sitem_cmp, NULL);
+        }
+#ifdef AVL_STATS
+        avl_stats_reset();
+#endif
+        t[pass] = probe(root, items, n, pass);
+        printf("%-12s %7.1f", pass ? "prefixed" : "no prefix", t[pass]);
+#ifdef AVL_STATS
+        {
+            struct avl_stats stats;
+
+            avl_stats_snapshot(&stats);
+            printf(" %7.2f", (double)stats.compares / n);
+        }
+#endif
+        printf("\n");
+    }
+    for (i = 0; i < n; i++) {
+        free((char *)items[i].key);
+    }
+    free(items);
+    return 0;
+}
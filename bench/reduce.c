@@ -0,0 +1,96 @@
+/* Full-tree reduction: a sequential avl_foreach against avl_par_reduce and
+ * avl_par_foreach on worker pools of increasing size
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/reduce.c avl.c avl_par.c -o reduce -lpthread
+ *
+ * and run as ./reduce [count] [max threads]
+ */
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_par.h"
+#include "bench.h"
+
+
+static atomic_ulong total;
+
+
+static int sum_one(struct avl *node, void *data)
+{
+    *(unsigned long *)data += ((struct item *)node)->key;
+    return 0;
+}
+
+
+static void sum_map(void *acc, struct avl *node, void *data)
+{
+    (void)data;
+    *(unsigned long *)acc += ((struct item *)node)->key;
+}
+
+
+static void sum_combine(void *left, const void *right, void *data)
+{
+    (void)data;
+    *(unsigned long *)left += *(const unsigned long *)right;
+}
+
+
+static int sum_atomic(struct avl *node, void *data)
+{
+    (void)data;
+    atomic_fetch_add_explicit(&total, ((struct item *)node)->key, memory_order_relaxed);
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 10000000);
+    unsigned max = bench_arg(argc, argv, 2, 8);
+    unsigned long state = BENCH_SEED, seq = 0, par, zero = 0;
+    struct avl_workers workers;
+    struct item *items;
+    struct avl *root = NULL;
+    unsigned t;
+    double t0;
+    size_t i;
+
+    items = calloc(n, sizeof *items);
+    if (!items) {
+        perror("calloc");
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        items[i].key = xorshift(&state) >> 16;
+        avl_insert(&root, &items[i].avl, item_cmp, NULL);
+    }
+    t0 = now();
+    avl_foreach(root, AVL_INORDER, sum_one, &seq);
+    printf("%zu nodes, sequential foreach %.1f ms\n", n, (now() - t0) * 1e3);
+    printf("threads   reduce  foreach (ms)\n");
+    for (t = 1; t <= max; t *= 2) {
+        /* The caller's thread works too, so start one fewer */
+        if (avl_workers_init(&workers, t - 1)) {
+            perror("avl_workers_init");
+            return 1;
+        }
+        t0 = now();
+        avl_par_reduce(root, sum_map, sum_combine, &zero, &par, sizeof par, NULL,
+                       &workers.exec, 0);
+        printf("%7u %8.1f", t, (now() - t0) * 1e3);
+        atomic_store(&total, 0);
+        t0 = now();
+        avl_par_foreach(root, sum_atomic, NULL, &workers.exec, 0);
+        printf(" %8.1f%s\n", (now() - t0) * 1e3,
+               par == seq && atomic_load(&total) == seq ? "" : "  (wrong sum)");
+        avl_workers_destroy(&workers);
+        fflush(stdout);
+    }
+    free(items);
+    return 0;
+}
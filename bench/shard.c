@@ -0,0 +1,137 @@
+/* Write throughput of a sharded tree against a single tree under one mutex,
+ * with every thread inserting and then deleting its own random keys
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/shard.c avl.c avl_shard.c -o shard -lpthread
+ *
+ * and run as ./shard [keys per thread] [max threads] [shards per thread]
+ */
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "avl_shard.h"
+#include "bench.h"
+
+
+struct worker {
+    pthread_t           thread;
+    struct avl_sharded *sharded;    /* Sharded tree, or NULL for the single one */
+    struct item        *items;      /* This thread's keys */
+    size_t              n;          /* Number of keys */
+};
+
+
+static struct avl      *single;
+static pthread_mutex_t  single_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = arg;
+    size_t i;
+
+    for (i = 0; i < w->n; i++) {
+        if (w->sharded) {
+            avl_sharded_insert(w->sharded, &w->items[i].avl, NULL);
+        } else {
+            pthread_mutex_lock(&single_lock);
+            avl_insert(&single, &w->items[i].avl, item_cmp, NULL);
+            pthread_mutex_unlock(&single_lock);
+        }
+    }
+    for (i = 0; i < w->n; i++) {
+        if (w->sharded) {
+            avl_sharded_delete(w->sharded, &w->items[i].avl, NULL);
+        } else {
+            pthread_mutex_lock(&single_lock);
+            avl_delete(&single, &w->items[i].avl, item_cmp, NULL);
+            pthread_mutex_unlock(&single_lock);
+        }
+    }
+    return NULL;
+}
+
+
+/** @brief Run @p nthreads writers, each with @p n keys
+ *  @returns Millions of operations per second
+ */
+static double run(struct avl_sharded *sharded, struct item *items, size_t n, int nthreads)
+{
+    struct worker workers[256];
+    double t0;
+    size_t j;
+    int i;
+
+    /* Nodes must be zeroed before they are inserted again */
+    for (j = 0; j < n * nthreads; j++) {
+        memset(&items[j].avl, 0, sizeof items[j].avl);
+    }
+    for (i = 0; i < nthreads; i++) {
+        workers[i].sharded = sharded;
+        workers[i].items = items + i * n;
+        workers[i].n = n;
+    }
+    t0 = now();
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    return 2.0 * n * nthreads / (now() - t0) * 1e-6;
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 250000);
+    int max = argc > 2 ? atoi(argv[2]) : 64;
+    unsigned per = bench_arg(argc, argv, 3, 4);
+    unsigned long state = BENCH_SEED;
+    struct avl_sharded sharded;
+    struct item *items, *bounds;
+    struct avl **bptr;
+    unsigned nbounds, j;
+    size_t i;
+    int t;
+
+    if (max > 256) {
+        max = 256;
+    }
+    items = calloc(n * max, sizeof *items);
+    bounds = calloc((size_t)max * per, sizeof *bounds);
+    bptr = calloc((size_t)max * per, sizeof *bptr);
+    if (!items || !bounds || !bptr) {
+        perror("calloc");
+        return 1;
+    }
+    for (i = 0; i < n * max; i++) {
+        items[i].key = xorshift(&state);
+    }
+    printf("%zu keys per thread, Mops/s\n", n);
+    printf("threads   single  sharded\n");
+    for (t = 1; t <= max; t *= 2) {
+        /* Evenly spaced bounds, with the requested number of shards per thread */
+        nbounds = t * per - 1;
+        for (j = 0; j < nbounds; j++) {
+            bounds[j].key = (unsigned long)-1 / (nbounds + 1) * (j + 1);
+            bptr[j] = &bounds[j].avl;
+        }
+        if (avl_sharded_init(&sharded, item_cmp, bptr, nbounds)) {
+            perror("avl_sharded_init");
+            return 1;
+        }
+        printf("%7d %8.2f", t, run(NULL, items, n, t));
+        printf(" %8.2f\n", run(&sharded, items, n, t));
+        avl_sharded_destroy(&sharded);
+        fflush(stdout);
+    }
+    free(bptr);
+    free(bounds);
+    free(items);
+    return 0;
+}
@@ -0,0 +1,222 @@
+/* Function-pointer comparison versus a tree generated with AVL_DEFINE, for
+ * 64-bit integer keys and short string keys
+ *
+ * Build from the repository root with
+ *
+ *     cc -O2 -I. bench/specialize.c avl.c -o specialize
+ *
+ * and run as ./specialize [count] [rounds]
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "avl_gen.h"
+#include "bench.h"
+
+
+struct inode {
+    struct avl avl;
+    uint64_t   key;
+};
+
+
+struct snode {
+    struct avl avl;
+    char       key[16];
+};
+
+
+AVL_DEFINE(itree, struct inode, avl, key, AVL_CMP_NUM)
+
+AVL_DEFINE(stree, struct snode, avl, key, strcmp)
+
+
+static int inode_cmp(const struct avl *n1, const struct avl *n2)
+{
+    const struct inode *i1, *i2;
+
+    i1 = (const struct inode *)((const char *)n1 - offsetof(struct inode, avl));
+    i2 = (const struct inode *)((const char *)n2 - offsetof(struct inode, avl));
+    return (i1->key > i2->key) - (i1->key < i2->key);
+}
+
+
+static int snode_cmp(const struct avl *n1, const struct avl *n2)
+{
+    const struct snode *s1, *s2;
+
+    s1 = (const struct snode *)((const char *)n1 - offsetof(struct snode, avl));
+    s2 = (const struct snode *)((const char *)n2 - offsetof(struct snode, avl));
+    return strcmp(s1->key, s2->key);
+}
+
+
+/** @brief Fisher-Yates shuffle of an index permutation using a fixed xorshift
+ *      generator, so that every run sees the same sequence
+ */
+static void shuffle(size_t *v, size_t n, unsigned long *state)
+{
+    size_t i, j, tmp;
+
+    for (i = n - 1; i > 0; i--) {
+        *state ^= *state << 13;
+        *state ^= *state >> 7;
+        *state ^= *state << 17;
+        j = *state % (i + 1);
+        tmp = v[i];
+        v[i] = v[j];
+        v[j] = tmp;
+    }
+}
+
+
+/** @brief Accumulated times, in seconds, of the three phases of a round */
+struct times {
+    double ins, find, del;
+};
+
+
+static void report(const char *label, const struct times *t, double ops)
+{
+    printf("%-18s insert %6.1f  find %6.1f  delete %6.1f ns/op\n", label,
+           t->ins * 1e9 / ops, t->find * 1e9 / ops, t->del * 1e9 / ops);
+}
+
+
+static void bench_int(struct inode *items, size_t *order, size_t n, int rounds,
+                      unsigned long *state, int generated, struct times *t)
+{
+    struct avl *root = NULL;
+    size_t i, found;
+    double t0;
+    int r;
+
+    for (r = 0; r < rounds; r++) {
+        shuffle(order, n, state);
+        t0 = now();
+        for (i = 0; i < n; i++) {
+            memset(&items[order[i]].avl, 0, sizeof items[order[i]].avl);
+            if (generated) {
+                itree_insert(&root, &items[order[i]]);
+            } else {
+                avl_insert(&root, &items[order[i]].avl, inode_cmp, NULL);
+            }
+        }
+        t->ins += now() - t0;
+        shuffle(order, n, state);
+        t0 = now();
+        for (i = found = 0; i < n; i++) {
+            if (generated) {
+                found += itree_find(root, &items[order[i]]) != NULL;
+            } else {
+                found += avl_lookup(root, &items[order[i]].avl, inode_cmp) != NULL;
+            }
+        }
+        t->find += now() - t0;
+        if (found != n) {
+            fprintf(stderr, "lost %zu keys\n", n - found);
+            exit(1);
+        }
+        shuffle(order, n, state);
+        t0 = now();
+        for (i = 0; i < n; i++) {
+            if (generated) {
+                itree_remove(&root, &items[order[i]]);
+            } else {
+                avl_delete(&root, &items[order[i]].avl, inode_cmp, NULL);
+            }
+        }
+        t->del += now() - t0;
+    }
+}
+
+
+static void bench_str(struct snode *items, size_t *order, size_t n, int rounds,
+                      unsigned long *state, int generated, struct times *t)
+{
+    struct avl *root = NULL;
+    size_t i, found;
+    double t0;
+    int r;
+
+    for (r = 0; r < rounds; r++) {
+        shuffle(order, n, state);
+        t0 = now();
+        for (i = 0; i < n; i++) {
+            memset(&items[order[i]].avl, 0, sizeof items[order[i]].avl);
+            if (generated) {
+                stree_insert(&root, &items[order[i]]);
+            } else {
+                avl_insert(&root, &items[order[i]].avl, snode_cmp, NULL);
+            }
+        }
+        t->ins += now() - t0;
+        shuffle(order, n, state);
+        t0 = now();
+        for (i = found = 0; i < n; i++) {
+            if (generated) {
+                found += stree_find(root, &items[order[i]]) != NULL;
+            } else {
+                found += avl_lookup(root, &items[order[i]].avl, snode_cmp) != NULL;
+            }
+        }
+        t->find += now() - t0;
+        if (found != n) {
+            fprintf(stderr, "lost %zu keys\n", n - found);
+            exit(1);
+        }
+        shuffle(order, n, state);
+        t0 = now();
+        for (i = 0; i < n; i++) {
+            if (generated) {
+                stree_remove(&root, &items[order[i]]);
+            } else {
+                avl_delete(&root, &items[order[i]].avl, snode_cmp, NULL);
+            }
+        }
+        t->del += now() - t0;
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = bench_arg(argc, argv, 1, 1000000);
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    unsigned long state = BENCH_SEED;
+    struct times t[4];
+    struct inode *ints;
+    struct snode *strs;
+    size_t *order, i;
+
+    ints = malloc(n * sizeof *ints);
+    strs = malloc(n * sizeof *strs);
+    order = malloc(n * sizeof *order);
+    if (!ints || !strs || !order) {
+        perror("malloc");
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        ints[i].key = i * 0x9e3779b97f4a7c15ULL;
+        snprintf(strs[i].key, sizeof strs[i].key, "%015llx",
+                 (unsigned long long)(ints[i].key >> 4));
+        order[i] = i;
+    }
+    memset(t, 0, sizeof t);
+    bench_int(ints, order, n, rounds, &state, 0, &t[0]);
+    bench_int(ints, order, n, rounds, &state, 1, &t[1]);
+    bench_str(strs, order, n, rounds, &state, 0, &t[2]);
+    bench_str(strs, order, n, rounds, &state, 1, &t[3]);
+    printf("n=%zu rounds=%d\n", n, rounds);
+    report("u64 cmpfn", &t[0], (double)n * rounds);
+    report("u64 AVL_DEFINE", &t[1], (double)n * rounds);
+    report("string cmpfn", &t[2], (double)n * rounds);
+    report("string AVL_DEFINE", &t[3], (double)n * rounds);
+    free(order);
+    free(strs);
+    free(ints);
+    return 0;
+}
@@ -0,0 +1,141 @@
+/* Several threads inserting, removing and looking up keys in one avl_conc at
+ * once. Each thread owns the keys congruent to its index, so that it knows
+ * what every call should return. Once they are joined the tree is quiescent
+ * and must be a strict AVL tree holding exactly the keys left present
+ */
+#include <pthread.h>
+#include "avl_conc.h"
+#include "test.h"
+
+
+#define THREADS 4           /* Writers */
+#define KEYS    4096        /* Key range, shared out among the writers */
+#define OPS     200000      /* Random operations per writer */
+
+
+struct citem {
+    struct avl_cnode node;
+    unsigned long    key;
+};
+
+
+struct worker {
+    pthread_t        thread;
+    struct avl_conc *tree;
+    unsigned         index;
+};
+
+
+static unsigned char present[KEYS];
+
+
+static int citem_cmp(const struct avl_cnode *n1, const struct avl_cnode *n2)
+{
+    const struct citem *i1 = (const struct citem *)n1, *i2 = (const struct citem *)n2;
+
+    return (i1->key > i2->key) - (i1->key < i2->key);
+}
+
+
+static void citem_free(struct avl_cnode *node, void *data)
+{
+    (void)data;
+    free(node);
+}
+
+
+static void *work(void *arg)
+{
+    struct worker *w = arg;
+    struct avl_epoch_thread thread;
+    unsigned long state = 88172645463325252UL + w->index, key;
+    struct citem query, *item;
+    struct avl_cnode *found;
+    size_t i;
+    int op;
+
+    avl_epoch_register(&w->tree->epoch, &thread);
+    for (i = 0; i < OPS; i++) {
+        key = xorshift(&state) % (KEYS / THREADS) * THREADS + w->index;
+        op = (int)(xorshift(&state) % 3);
+        query.key = key;
+        if (op == 0) {
+            item = malloc(sizeof *item);
+            TEST_CHECK(item != NULL);
+            item->key = key;
+            if (avl_conc_insert(w->tree, &thread, &item->node)) {
+                TEST_CHECK(present[key]);
+                free(item);
+            } else {
+                TEST_CHECK(!present[key]);
+            }
+            present[key] = 1;
+        } else if (op == 1) {
+            TEST_CHECK((avl_conc_remove(w->tree, &thread, &query.node) == 0) == present[key]);
+            present[key] = 0;
+        } else {
+            avl_epoch_enter(&thread);
+            found = avl_conc_lookup(w->tree, &query.node);
+            TEST_CHECK(present[key] ? found && ((struct citem *)found)->key == key : !found);
+            avl_epoch_exit(&thread);
+        }
+    }
+    avl_epoch_unregister(&thread);
+    return NULL;
+}
+
+
+/** @brief Check the subtree at @p node and count the keys present in it
+ *  @param lo
+ *      Every key must be at least this
+ *  @param hi
+ *      Every key must be less than this
+ *  @returns The height of the subtree
+ */
+static int check(struct avl_cnode *node, unsigned long lo, unsigned long hi, size_t *count)
+{
+    struct citem *item = (struct citem *)node;
+    int hl, hr;
+
+    if (!node) {
+        return 0;
+    }
+    TEST_CHECK(item->key >= lo && item->key < hi);
+    hl = check(atomic_load(&node->child[0]), lo, item->key, count);
+    hr = check(atomic_load(&node->child[1]), item->key + 1, hi, count);
+    TEST_CHECK(hl - hr <= 1 && hr - hl <= 1);
+    TEST_CHECK(atomic_load(&node->height) == 1 + (hl > hr ? hl : hr));
+    if (atomic_load(&node->present)) {
+        TEST_CHECK(present[item->key]);
+        ++*count;
+    } else {
+        /* A routing node with fewer than two children is spliced out */
+        TEST_CHECK(atomic_load(&node->child[0]) && atomic_load(&node->child[1]));
+    }
+    return 1 + (hl > hr ? hl : hr);
+}
+
+
+int main(void)
+{
+    struct worker workers[THREADS];
+    struct avl_conc tree;
+    size_t count = 0, expect = 0, i;
+
+    TEST_CHECK(avl_conc_init(&tree, citem_cmp, citem_free, NULL) == 0);
+    for (i = 0; i < THREADS; i++) {
+        workers[i].tree = &tree;
+        workers[i].index = (unsigned)i;
+        TEST_CHECK(pthread_create(&workers[i].thread, NULL, work, &workers[i]) == 0);
+    }
+    for (i = 0; i < THREADS; i++) {
+        TEST_CHECK(pthread_join(workers[i].thread, NULL) == 0);
+    }
+    check(atomic_load(&tree.holder.child[1]), 0, KEYS, &count);
+    for (i = 0; i < KEYS; i++) {
+        expect += present[i];
+    }
+    TEST_CHECK(count == expect);
+    avl_conc_destroy(&tree);
+    return 0;
+}
@@ -0,0 +1,150 @@
+/* The parallel set operations and bulk build against their sequential
+ * counterparts. Each one runs on two copies of the same input, and the trees
+ * that come out must be identical node for node, with the same nodes dropped
+ * and joined along the way. A small grain makes the pool split the work
+ */
+#include "avl_par.h"
+#include "test.h"
+
+
+#define NODES   50000       /* Nodes in the larger input */
+#define GRAIN   64          /* Split cutoff */
+#define WORKERS 3           /* Threads besides the caller's */
+
+
+/** @brief What became of a node */
+enum fate {
+    FATE_KEPT,
+    FATE_DROPPED,
+    FATE_JOINED
+};
+
+
+struct pitem {
+    struct item item;
+    enum fate   fate;
+};
+
+
+/* The same input twice over: once for the sequential call, once for the
+parallel one. The first NODES of each copy are the tree at root */
+static struct pitem pool[2][2 * NODES];
+static struct avl *nodes[2 * NODES];
+
+
+static void pitem_drop(struct avl *node, void *data)
+{
+    (void)data;
+    ((struct pitem *)item_of(node))->fate = FATE_DROPPED;
+}
+
+
+static void pitem_join(struct avl **node, struct avl *join)
+{
+    (void)node;
+    ((struct pitem *)item_of(join))->fate = FATE_JOINED;
+}
+
+
+/** @brief Point @p nodes at the @p n nodes of copy @p c starting at @p first,
+ *      after giving them increasing keys spread over about [0, @p range)
+ */
+static void fill(int c, size_t first, size_t n, unsigned long range, unsigned long seed)
+{
+    unsigned long key = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        /* Step by 1 to 2 * range / n, so the keys stay distinct and in range */
+        key += 1 + xorshift(&seed) % (2 * range / n);
+        item_set(&pool[c][first + i].item, key);
+        pool[c][first + i].fate = FATE_KEPT;
+        nodes[i] = &pool[c][first + i].item.avl;
+    }
+}
+
+
+static struct avl *build(int c, size_t first, size_t n, unsigned long range, unsigned long seed)
+{
+    fill(c, first, n, range, seed);
+    return avl_build_sorted(nodes, n);
+}
+
+
+/** @brief Check that the tree at @p t0 in the first copy and the one at @p t1
+ *      in the second are built from corresponding nodes in the same shape
+ */
+static void check_same(struct avl *t0, struct avl *t1)
+{
+    if (!t0 || !t1) {
+        TEST_CHECK(!t0 && !t1);
+        return;
+    }
+    TEST_CHECK((struct pitem *)item_of(t0) - pool[0] == (struct pitem *)item_of(t1) - pool[1]);
+    check_same(AVL_CHILD(t0, 0), AVL_CHILD(t1, 0));
+    check_same(AVL_CHILD(t0, 1), AVL_CHILD(t1, 1));
+}
+
+
+/** @brief Check the results of one operation on both copies */
+static void check_results(struct avl *t0, struct avl *t1)
+{
+    struct avl_shape shape;
+    size_t i;
+
+    check_same(t0, t1);
+    TEST_CHECK(avl_analyze(t0, item_cmp, &shape) == AVL_SHAPE_OK);
+    for (i = 0; i < 2 * NODES; i++) {
+        TEST_CHECK(pool[0][i].fate == pool[1][i].fate);
+    }
+}
+
+
+int main(void)
+{
+    static const size_t others[] = { NODES, NODES / 10, NODES / 1000, 1, 0 };
+    struct avl_workers workers;
+    struct avl *root[2], *other[2];
+    size_t i, m;
+    int c, op;
+
+    TEST_CHECK(avl_workers_init(&workers, WORKERS) == 0);
+
+    for (i = 0; i < sizeof others / sizeof *others; i++) {
+        m = others[i];
+        for (op = 0; op < 3; op++) {
+            for (c = 0; c < 2; c++) {
+                root[c] = build(c, 0, NODES, 4 * NODES, 1 + i * 3 + op);
+                other[c] = m ? build(c, NODES, m, 4 * NODES, 1000 + i * 3 + op) : NULL;
+            }
+            if (op == 0) {
+                avl_union(&root[0], other[0], item_cmp, pitem_join);
+                avl_par_union(&root[1], other[1], item_cmp, pitem_join, &workers.exec, GRAIN);
+            } else if (op == 1) {
+                avl_intersect(&root[0], other[0], item_cmp, pitem_join, pitem_drop, NULL);
+                avl_par_intersect(&root[1], other[1], item_cmp, pitem_join, pitem_drop, NULL,
+                                  &workers.exec, GRAIN);
+            } else {
+                avl_difference(&root[0], other[0], item_cmp, pitem_drop, NULL);
+                avl_par_difference(&root[1], other[1], item_cmp, pitem_drop, NULL,
+                                   &workers.exec, GRAIN);
+            }
+            check_results(root[0], root[1]);
+        }
+    }
+
+    /* Bulk builds of every size up to a few grains, then a large one */
+    for (m = 0; m <= 4 * GRAIN; m++) {
+        root[0] = build(0, 0, m, 4 * NODES, m);
+        fill(1, 0, m, 4 * NODES, m);
+        root[1] = avl_par_build_sorted(nodes, m, &workers.exec, GRAIN);
+        check_results(root[0], root[1]);
+    }
+    root[0] = build(0, 0, NODES, 4 * NODES, 7);
+    fill(1, 0, NODES, 4 * NODES, 7);
+    root[1] = avl_par_build_sorted(nodes, NODES, &workers.exec, GRAIN);
+    check_results(root[0], root[1]);
+
+    avl_workers_destroy(&workers);
+    return 0;
+}
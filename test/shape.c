@@ -0,0 +1,109 @@
+/* Random insertions and deletions against a reference bitmap, with the shape
+ * of the tree validated by avl_analyze as it grows, shrinks, splits and joins.
+ * This is built once for each combination of layout options
+ */
+#include "test.h"
+
+
+#define KEYS    8192        /* Key range, so that duplicates occur */
+#define OPS     200000      /* Random operations */
+#define EVERY   997         /* Operations between full checks */
+
+
+static struct item items[KEYS];
+static unsigned char present[KEYS];
+
+
+/** @brief Check that the in-order sequence is exactly the keys present */
+static void check_contents(struct avl *root, size_t count)
+{
+    struct avl_cursor cur;
+    struct avl *node;
+    unsigned long key = 0;
+    size_t seen = 0;
+
+    for (node = avl_cursor_first(&cur, root); node; node = avl_cursor_next(&cur)) {
+        while (!present[key]) {
+            key++;
+        }
+        TEST_CHECK(node == &items[key].avl);
+        key++;
+        seen++;
+    }
+    TEST_CHECK(seen == count);
+    test_shape(root, count);
+}
+
+
+static int drop_odd(struct avl *node, void *data)
+{
+    (void)data;
+    return item_of(node)->key & 1;
+}
+
+
+int main(void)
+{
+    unsigned long state = 88172645463325252UL, key;
+    struct avl *root = NULL, *left, *right, *mid;
+    struct item query;
+    size_t count = 0, i;
+    int op;
+
+    for (i = 0; i < OPS; i++) {
+        key = xorshift(&state) % KEYS;
+        op = (int)(xorshift(&state) % 3);
+        item_set(&query, key);
+        if (op == 0) {
+            if (!present[key]) {
+                item_set(&items[key], key);
+            }
+            TEST_CHECK(avl_insert(&root, &items[key].avl, item_cmp, NULL) == present[key]);
+            count += !present[key];
+            present[key] = 1;
+        } else if (op == 1) {
+            TEST_CHECK(avl_delete(&root, &query.avl, item_cmp, NULL)
+                       == (present[key] ? &items[key].avl : NULL));
+            count -= present[key];
+            present[key] = 0;
+        } else {
+            TEST_CHECK(avl_lookup(root, &query.avl, item_cmp)
+                       == (present[key] ? &items[key].avl : NULL));
+        }
+        if (i % EVERY == 0) {
+            check_contents(root, count);
+        }
+    }
+    check_contents(root, count);
+
+    /* Split around a key in the middle and put the tree back together */
+    item_set(&query, KEYS / 2);
+    mid = avl_split(root, &query.avl, item_cmp, &left, &right);
+    TEST_CHECK(mid == (present[KEYS / 2] ? &items[KEYS / 2].avl : NULL));
+    for (i = 0, key = 0; key < KEYS / 2; key++) {
+        i += present[key];
+    }
+    test_shape(left, i);
+    test_shape(right, count - i - present[KEYS / 2]);
+    root = mid ? avl_join(left, mid, right) : avl_concat(left, right);
+    check_contents(root, count);
+
+    /* Filter out the odd keys in one pass */
+    for (key = 1; key < KEYS; key += 2) {
+        count -= present[key];
+        present[key] = 0;
+    }
+    avl_delete_if(&root, drop_odd, NULL, NULL);
+    check_contents(root, count);
+
+    /* Empty it again one node at a time */
+    for (key = 0; key < KEYS; key++) {
+        if (present[key]) {
+            TEST_CHECK(avl_delete(&root, &items[key].avl, item_cmp, NULL) == &items[key].avl);
+            present[key] = 0;
+            count--;
+        }
+    }
+    TEST_CHECK(!root && !count);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#ifndef TEST_H
+#define TEST_H
+
+/* Shared by the tests: a check that reports where it failed and exits, a
+ * fixed random sequence, and an element keyed by an unsigned long
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+
+
+/** @brief Fail the test with the location and text of @p cond unless it holds */
+#define TEST_CHECK(cond) \
+    ((cond) ? (void)0 : test_fail(__FILE__, __LINE__, #cond))
+
+
+static inline void test_fail(const char *file, int line, const char *what)
+{
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    exit(1);
+}
+
+
+/** @brief Step Marsaglia's xorshift generator */
+static inline unsigned long xorshift(unsigned long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+
+struct item {
+    struct avl    avl;
+    unsigned long key;
+};
+
+
+static inline struct item *item_of(const struct avl *node)
+{
+    return (struct item *)((char *)node - offsetof(struct item, avl));
+}
+
+
+static inline int item_cmp(const struct avl *n1, const struct avl *n2)
+{
+    const struct item *i1 = item_of(n1), *i2 = item_of(n2);
+
+    return (i1->key > i2->key) - (i1->key < i2->key);
+}
+
+
+/** @brief Zero the links of @p item and give it @p key. Under AVL_PREFIX the
+ *      prefix drops the low byte of the key, so that the comparison function
+ *      still settles some ties
+ */
+static inline void item_set(struct item *item, unsigned long key)
+{
+    memset(&item->avl, 0, sizeof item->avl);
+    item->key = key;
+#ifdef AVL_PREFIX
+    item->avl.prefix = key >> 8;
+#endif
+}
+
+
+/** @brief Check the shape of the tree at @p root and that it has @p nodes nodes */
+static inline void test_shape(struct avl *root, size_t nodes)
+{
+    struct avl_shape shape;
+
+    TEST_CHECK(avl_analyze(root, item_cmp, &shape) == AVL_SHAPE_OK);
+    TEST_CHECK(shape.nodes == nodes);
+#ifdef AVL_SIZE
+    TEST_CHECK(avl_size(root) == nodes);
+#endif
+}
+
+
+#endif /* TEST_H */
@@ -0,0 +1,134 @@
+/* avl_tree driven through random insertions, erasures and searches alongside
+ * a std::set of the same keys, which every answer is checked against
+ */
+#include <iterator>
+#include <set>
+#include "avl.hpp"
+#include "test.h"
+
+
+#define KEYS    4096        /* Key range, so that duplicates occur */
+#define OPS     100000      /* Random operations */
+#define EVERY   997         /* Operations between full checks */
+
+
+struct elem {
+    unsigned long key;
+    struct avl    hook;
+};
+
+
+typedef avl_key_less<elem, unsigned long, &elem::key> elem_less;
+typedef avl_tree<elem, &elem::hook, elem_less> elem_tree;
+
+
+static elem elems[KEYS];
+
+
+static int elem_cmp(const struct avl *n1, const struct avl *n2)
+{
+    const elem *e1 = elem_tree::entry(const_cast<struct avl *>(n1));
+    const elem *e2 = elem_tree::entry(const_cast<struct avl *>(n2));
+
+    return (e1->key > e2->key) - (e1->key < e2->key);
+}
+
+
+/** @brief Give @p e the key @p key, and under AVL_PREFIX the same prefix as item_set */
+static void elem_set(elem &e, unsigned long key)
+{
+    e.key = key;
+#ifdef AVL_PREFIX
+    e.hook.prefix = key >> 8;
+#endif
+}
+
+
+/** @brief Check both directions of iteration and the shape of the tree */
+static void check_contents(const elem_tree &tree, const std::set<unsigned long> &ref)
+{
+    std::set<unsigned long>::const_iterator r;
+    std::set<unsigned long>::const_reverse_iterator rr;
+    elem_tree::const_iterator it;
+    elem_tree::const_reverse_iterator rit;
+    struct avl_shape shape;
+
+    for (it = tree.begin(), r = ref.begin(); it != tree.end(); ++it, ++r) {
+        TEST_CHECK(r != ref.end() && it->key == *r && &*it == &elems[*r]);
+    }
+    TEST_CHECK(r == ref.end());
+    for (rit = tree.rbegin(), rr = ref.rbegin(); rit != tree.rend(); ++rit, ++rr) {
+        TEST_CHECK(rr != ref.rend() && rit->key == *rr);
+    }
+    TEST_CHECK(rr == ref.rend());
+    TEST_CHECK(tree.empty() == ref.empty());
+#ifdef AVL_SIZE
+    TEST_CHECK(tree.size() == ref.size());
+#endif
+    TEST_CHECK(avl_analyze(tree.root(), elem_cmp, &shape) == AVL_SHAPE_OK);
+    TEST_CHECK(shape.nodes == ref.size());
+}
+
+
+int main()
+{
+    unsigned long state = 88172645463325252UL, key;
+    std::set<unsigned long> ref;
+    std::set<unsigned long>::iterator r;
+    elem_tree tree;
+    elem_tree::iterator it;
+    elem query;
+    size_t i;
+    int op;
+
+    for (i = 0; i < OPS; i++) {
+        key = xorshift(&state) % KEYS;
+        op = (int)(xorshift(&state) % 5);
+        elem_set(query, key);
+        if (op == 0) {
+            elem_set(elems[key], key);
+            std::pair<elem_tree::iterator, bool> res = tree.insert(elems[key]);
+            TEST_CHECK(res.second == ref.insert(key).second);
+            TEST_CHECK(&*res.first == &elems[key]);
+        } else if (op == 1) {
+            TEST_CHECK(tree.erase(key) == ref.erase(key));
+        } else if (op == 2) {
+            /* Erase through an iterator, which must land on the successor */
+            it = tree.lower_bound(query);
+            r = ref.lower_bound(key);
+            TEST_CHECK((it == tree.end()) == (r == ref.end()));
+            if (r != ref.end()) {
+                it = tree.erase(it);
+                r = ref.erase(r);
+                TEST_CHECK((it == tree.end()) == (r == ref.end()));
+                TEST_CHECK(r == ref.end() || it->key == *r);
+            }
+        } else if (op == 3) {
+            it = tree.find(query);
+            TEST_CHECK(ref.count(key) ? &*it == &elems[key] : it == tree.end());
+            TEST_CHECK(tree.count(key) == ref.count(key));
+        } else {
+            it = tree.upper_bound(key);
+            r = ref.upper_bound(key);
+            TEST_CHECK(r == ref.end() ? it == tree.end() : it != tree.end() && it->key == *r);
+            if (it != tree.begin()) {
+                TEST_CHECK(r != ref.begin() && std::prev(it)->key == *std::prev(r));
+            }
+        }
+        if (i % EVERY == 0) {
+            check_contents(tree, ref);
+        }
+    }
+    check_contents(tree, ref);
+
+    /* A moved tree keeps every element, and the old one is left empty */
+    elem_tree moved(std::move(tree));
+    TEST_CHECK(tree.empty());
+    check_contents(moved, ref);
+    while (!moved.empty()) {
+        moved.erase(moved.begin());
+        ref.erase(ref.begin());
+    }
+    check_contents(moved, ref);
+    return 0;
+}